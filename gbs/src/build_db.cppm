@@ -0,0 +1,601 @@
+module;
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+export module build_db;
+import dep_scan;
+import hash;
+import process;
+
+namespace fs = std::filesystem;
+
+// Version of the on-disk format. Databases with a different header are discarded.
+constexpr std::string_view db_header = "gbs.db 8";
+
+// The last seen state of a file. Used to avoid rehashing files that haven't been touched.
+struct file_stamp {
+	std::uintmax_t size = 0;
+	std::int64_t mtime = 0;
+	std::uint64_t hash = 0;
+};
+
+// The module declarations of a source file, the state of the file when it was scanned, and the hash of the
+// command that scanned it. The built-in scanner has a command hash of 0.
+struct scan_record {
+	std::uintmax_t size = 0;
+	std::int64_t mtime = 0;
+	std::uint64_t command_hash = 0;
+	std::string export_name;
+	std::set<std::string> import_names;
+
+	// Set when the record is used by this run. Only used records are saved.
+	bool used = false;
+};
+
+// A dependency of an object file, and the hash it had when the object was built
+export struct object_dependency {
+	fs::path path;
+	std::uint64_t hash = 0;
+};
+
+// Get the response files referenced by '@file' arguments in a command line, including quoted ones like '@"a b/c"'.
+// The command line is split the same way it is when the command is run.
+export std::vector<fs::path> get_response_files(std::string_view const cmd) {
+	std::vector<fs::path> files;
+	for (std::string const& arg : split_command_line(cmd)) {
+		if (arg.size() > 1 && arg.front() == '@')
+			files.emplace_back(arg.substr(1));
+	}
+	return files;
+}
+
+// Describes what an object file was built from
+export struct object_record {
+	fs::path source;
+	std::uint64_t source_hash = 0;
+	std::uint64_t command_hash = 0;
+
+	// How long the last compile took
+	std::chrono::milliseconds build_time{ 0 };
+
+	// Peak memory used by the last compile, in bytes
+	std::uint64_t peak_memory = 0;
+
+	// The key of the object in the object cache, or 0 if it isn't cached.
+	// Kept for module interfaces, since it is part of the cache key of every source importing them.
+	std::uint64_t cache_key = 0;
+
+	std::vector<object_dependency> deps;
+};
+
+// Describes what an executable or library was linked from, how long the link took, and how much memory it used
+export struct link_record {
+	std::chrono::milliseconds build_time{ 0 };
+	std::uint64_t peak_memory = 0;
+	std::uint64_t command_hash = 0;
+
+	// The objects and libraries linked, sorted by path
+	std::vector<object_dependency> inputs;
+};
+
+template<typename T>
+static std::optional<T> parse_number(std::string_view const sv) {
+	T value{};
+	auto const [ptr, ec] = std::from_chars(sv.data(), sv.data() + sv.size(), value);
+	if (ec != std::errc{} || ptr != sv.data() + sv.size())
+		return std::nullopt;
+	return value;
+}
+
+static std::vector<std::string_view> split_fields(std::string_view line) {
+	std::vector<std::string_view> fields;
+	while (true) {
+		auto const tab = line.find('\t');
+		fields.push_back(line.substr(0, tab));
+		if (tab == std::string_view::npos)
+			break;
+		line.remove_prefix(tab + 1);
+	}
+	return fields;
+}
+
+// Persistent database of content hashes used for up-to-date checks.
+// Stored as 'BUILDDB' in each output directory, eg. 'gbs.out/clang_21.1.0/debug/BUILDDB'.
+export class build_db {
+	fs::path db_path;
+
+	// Last seen state of all hashed files
+	std::unordered_map<fs::path, file_stamp> files;
+
+	// Object files from previous builds, and what they were built from
+	std::unordered_map<fs::path, object_record> objects;
+
+	// Object files being built in this run. Moved to 'objects' when they succeed.
+	std::unordered_map<fs::path, object_record> pending;
+
+	// Executables and libraries from previous builds
+	std::unordered_map<fs::path, link_record> links;
+
+	// Module dependency scans of source files
+	std::unordered_map<fs::path, scan_record> scans;
+
+	// Average build time of the objects in 'objects'. Used when there is no history for an object.
+	std::chrono::milliseconds average_build_time{ 1000 };
+
+	// Average peak memory of the compiles and links. Used when there is no history for a target.
+	std::uint64_t average_compile_memory = 0;
+	std::uint64_t average_link_memory = 0;
+
+	mutable std::mutex mtx;
+
+public:
+	explicit build_db(fs::path path) : db_path(std::move(path)) {
+		load();
+	}
+
+	build_db(build_db const&) = delete;
+	build_db& operator=(build_db const&) = delete;
+
+	// Get the content hash of a file. Files are only rehashed if their size or timestamp has changed.
+	std::optional<std::uint64_t> file_hash(fs::path const& path) {
+		fs::path const key = path.lexically_normal();
+
+		std::error_code ec;
+		auto const size = fs::file_size(key, ec);
+		if (ec)
+			return std::nullopt;
+		auto const mtime = static_cast<std::int64_t>(fs::last_write_time(key, ec).time_since_epoch().count());
+		if (ec)
+			return std::nullopt;
+
+		{
+			std::scoped_lock lock(mtx);
+			if (auto const it = files.find(key); it != files.end() && it->second.size == size && it->second.mtime == mtime)
+				return it->second.hash;
+		}
+
+		auto const hash = hash_file(key);
+		if (!hash)
+			return std::nullopt;
+
+		std::scoped_lock lock(mtx);
+		files[key] = file_stamp{ size, mtime, *hash };
+		return hash;
+	}
+
+	// Get the module dependencies of a source file with the built-in scanner. Files are only rescanned if their size
+	// or timestamp has changed, so unchanged files are not opened.
+	source_dependency module_dependencies(fs::path const& path) {
+		return scan_dependencies(path, 0, [&] { return std::optional{ extract_module_dependencies(path) }; })
+			.value_or(source_dependency{ path });
+	}
+
+	// Get the module dependencies of a source file from 'scan', which is only called if the file or the hash of the
+	// scan command has changed since the last scan. Failed scans are not kept.
+	std::optional<source_dependency> scan_dependencies(fs::path const& path, std::uint64_t const command_hash, auto&& scan) {
+		fs::path const key = path.lexically_normal();
+
+		std::error_code ec;
+		auto const size = fs::file_size(key, ec);
+		auto const mtime = ec ? 0 : static_cast<std::int64_t>(fs::last_write_time(key, ec).time_since_epoch().count());
+		if (ec)
+			return scan();
+
+		{
+			std::scoped_lock lock(mtx);
+			if (auto const it = scans.find(key); it != scans.end() && it->second.size == size && it->second.mtime == mtime && it->second.command_hash == command_hash) {
+				it->second.used = true;
+				return source_dependency{ path, it->second.export_name, it->second.import_names };
+			}
+		}
+
+		std::optional<source_dependency> deps = scan();
+		if (!deps)
+			return std::nullopt;
+
+		std::scoped_lock lock(mtx);
+		scans[key] = scan_record{ size, mtime, command_hash, deps->export_name, deps->import_names, true };
+		return deps;
+	}
+
+	// Hash a command line, including the contents of the response files it references
+	std::uint64_t hash_command(std::string_view const cmd) {
+		std::uint64_t hash = hash_bytes(cmd);
+		for (fs::path const& response_file : get_response_files(cmd))
+			hash = hash_bytes(hash_to_string(file_hash(response_file).value_or(0)), hash);
+		return hash;
+	}
+
+	// Returns true if the object file exists, was built with the same command, and none of its inputs have changed since
+	bool is_up_to_date(fs::path const& obj, fs::path const& source, std::uint64_t const command_hash) {
+		if (!fs::exists(obj))
+			return false;
+
+		object_record record;
+		{
+			std::scoped_lock lock(mtx);
+			auto const it = objects.find(obj.lexically_normal());
+			if (it == objects.end())
+				return false;
+			record = it->second;
+		}
+
+		if (record.source != source.lexically_normal() || record.command_hash != command_hash)
+			return false;
+
+		if (file_hash(source) != record.source_hash)
+			return false;
+
+		for (object_dependency const& dep : record.deps) {
+			if (file_hash(dep.path) != dep.hash)
+				return false;
+		}
+
+		return true;
+	}
+
+	// Start recording the inputs of an object file that is about to be built
+	void begin_object(fs::path const& obj, fs::path const& source, std::uint64_t const command_hash) {
+		object_record record;
+		record.source = source.lexically_normal();
+		record.source_hash = file_hash(source).value_or(0);
+		record.command_hash = command_hash;
+
+		std::scoped_lock lock(mtx);
+		pending[obj.lexically_normal()] = std::move(record);
+	}
+
+	// Add a dependency to an object file that is being built.
+	// Dependencies that can't be read from here, like system headers inside WSL, are ignored.
+	void add_dependency(fs::path const& obj, fs::path const& dep) {
+		auto const hash = file_hash(dep);
+		if (!hash)
+			return;
+
+		std::scoped_lock lock(mtx);
+		if (auto const it = pending.find(obj.lexically_normal()); it != pending.end())
+			it->second.deps.push_back({ dep.lexically_normal(), *hash });
+	}
+
+	// Get the dependencies an object file had the last time it was built
+	[[nodiscard]] std::vector<fs::path> previous_dependencies(fs::path const& obj) const {
+		std::vector<fs::path> deps;
+		std::scoped_lock lock(mtx);
+		if (auto const it = objects.find(obj.lexically_normal()); it != objects.end()) {
+			for (object_dependency const& dep : it->second.deps)
+				deps.push_back(dep.path);
+		}
+		return deps;
+	}
+
+	// Add the dependencies of the objects of imported modules to an object that is being built. A module interface is
+	// compiled from its headers, so importers have to be rebuilt when one changes, even if the module's source hasn't.
+	// Modules being built in this run are taken from their pending records. Returns the files that were added.
+	std::vector<fs::path> add_module_dependencies(fs::path const& obj, std::span<fs::path const> module_objects) {
+		std::vector<fs::path> deps;
+		{
+			std::scoped_lock lock(mtx);
+			for (fs::path const& module : module_objects) {
+				fs::path const key = module.lexically_normal();
+				object_record const* record = nullptr;
+				if (auto const it = pending.find(key); it != pending.end())
+					record = &it->second;
+				else if (auto const it = objects.find(key); it != objects.end())
+					record = &it->second;
+				if (!record)
+					continue;
+
+				for (object_dependency const& dep : record->deps)
+					deps.push_back(dep.path);
+			}
+		}
+
+		for (fs::path const& dep : deps)
+			add_dependency(obj, dep);
+		return deps;
+	}
+
+	// Get the record of an object file that is being built
+	[[nodiscard]] std::optional<object_record> pending_record(fs::path const& obj) const {
+		std::scoped_lock lock(mtx);
+		if (auto const it = pending.find(obj.lexically_normal()); it != pending.end())
+			return it->second;
+		return std::nullopt;
+	}
+
+	// Called when an object file was successfully built
+	void commit_object(fs::path const& obj, std::chrono::milliseconds const build_time, std::uint64_t const peak_memory) {
+		std::scoped_lock lock(mtx);
+		auto node = pending.extract(obj.lexically_normal());
+		if (node.empty())
+			return;
+
+		node.mapped().build_time = build_time;
+		node.mapped().peak_memory = peak_memory;
+
+		// The same file can be reported more than once, eg. a module interface that is also in the depfile
+		auto& deps = node.mapped().deps;
+		std::ranges::sort(deps, {}, &object_dependency::path);
+		auto const dupes = std::ranges::unique(deps, {}, &object_dependency::path);
+		deps.erase(dupes.begin(), dupes.end());
+
+		objects.insert_or_assign(node.key(), std::move(node.mapped()));
+	}
+
+	// Set the object cache key of a built or restored object
+	void set_cache_key(fs::path const& obj, std::uint64_t const key) {
+		std::scoped_lock lock(mtx);
+		if (auto const it = objects.find(obj.lexically_normal()); it != objects.end())
+			it->second.cache_key = key;
+	}
+
+	// Get the object cache key of the object built from a source, if it has one
+	[[nodiscard]] std::optional<std::uint64_t> source_cache_key(fs::path const& source) const {
+		fs::path const key = source.lexically_normal();
+		std::scoped_lock lock(mtx);
+		for (auto const& [obj, record] : objects) {
+			if (record.source == key && record.cache_key != 0)
+				return record.cache_key;
+		}
+		return std::nullopt;
+	}
+
+	// Returns true if the target exists, was linked with the same command, and from the same inputs with the same content.
+	// Content is compared rather than timestamps, since objects restored from a cache can be older than the target.
+	bool is_link_up_to_date(fs::path const& target, std::uint64_t const command_hash, std::span<fs::path const> inputs) {
+		if (!fs::exists(target))
+			return false;
+
+		link_record record;
+		{
+			std::scoped_lock lock(mtx);
+			auto const it = links.find(target.lexically_normal());
+			if (it == links.end())
+				return false;
+			record = it->second;
+		}
+
+		std::vector<fs::path> paths = normalized_paths(inputs);
+		if (record.command_hash != command_hash || record.inputs.size() != paths.size())
+			return false;
+
+		for (std::size_t i = 0; i < paths.size(); ++i) {
+			if (record.inputs[i].path != paths[i] || file_hash(paths[i]) != record.inputs[i].hash)
+				return false;
+		}
+		return true;
+	}
+
+	// Called when an executable or library was successfully linked from 'inputs' with a command hashed by 'hash_command'
+	void commit_link(fs::path const& target, std::uint64_t const command_hash, std::span<fs::path const> inputs, std::chrono::milliseconds const build_time, std::uint64_t const peak_memory) {
+		link_record record{ build_time, peak_memory, command_hash, {} };
+		for (fs::path const& input : normalized_paths(inputs))
+			record.inputs.push_back({ input, file_hash(input).value_or(0) });
+
+		std::scoped_lock lock(mtx);
+		links.insert_or_assign(target.lexically_normal(), std::move(record));
+	}
+
+	// How long an object or link is expected to take, based on its last build.
+	// Targets that haven't been built before are assumed to take the average time.
+	[[nodiscard]] std::chrono::milliseconds expected_build_time(fs::path const& target) const {
+		fs::path const key = target.lexically_normal();
+		std::scoped_lock lock(mtx);
+		if (auto const it = objects.find(key); it != objects.end() && it->second.build_time.count() > 0)
+			return it->second.build_time;
+		if (auto const it = links.find(key); it != links.end() && it->second.build_time.count() > 0)
+			return it->second.build_time;
+		return average_build_time;
+	}
+
+	// How much memory compiling an object is expected to use, based on its last build
+	[[nodiscard]] std::uint64_t expected_compile_memory(fs::path const& obj) const {
+		std::scoped_lock lock(mtx);
+		if (auto const it = objects.find(obj.lexically_normal()); it != objects.end() && it->second.peak_memory > 0)
+			return it->second.peak_memory;
+		return average_compile_memory;
+	}
+
+	// How much memory linking a target is expected to use, based on its last build
+	[[nodiscard]] std::uint64_t expected_link_memory(fs::path const& target) const {
+		std::scoped_lock lock(mtx);
+		if (auto const it = links.find(target.lexically_normal()); it != links.end() && it->second.peak_memory > 0)
+			return it->second.peak_memory;
+		return average_link_memory;
+	}
+
+	// Write the database to disk
+	bool save() const {
+		std::scoped_lock lock(mtx);
+
+		// Only keep the stamps of files that are still referenced
+		std::unordered_set<fs::path> referenced;
+		for (auto const& [obj, record] : objects) {
+			referenced.insert(record.source);
+			for (object_dependency const& dep : record.deps)
+				referenced.insert(dep.path);
+		}
+		for (auto const& [target, record] : links) {
+			for (object_dependency const& input : record.inputs)
+				referenced.insert(input.path);
+		}
+
+		fs::path const tmp_path = fs::path{ db_path }.concat(".tmp");
+		{
+			std::ofstream out(tmp_path, std::ios::binary);
+			if (!out)
+				return false;
+
+			out << db_header << '\n';
+			for (auto const& [path, stamp] : files) {
+				if (referenced.contains(path))
+					out << "file\t" << stamp.size << '\t' << stamp.mtime << '\t' << hash_to_string(stamp.hash) << '\t' << path.generic_string() << '\n';
+			}
+
+			for (auto const& [obj, record] : objects) {
+				out << "obj\t" << obj.generic_string() << '\t' << record.source.generic_string() << '\t' << hash_to_string(record.source_hash) << '\t' << hash_to_string(record.command_hash) << '\t' << record.build_time.count() << '\t' << record.peak_memory << '\t' << hash_to_string(record.cache_key) << '\n';
+				for (object_dependency const& dep : record.deps)
+					out << "dep\t" << hash_to_string(dep.hash) << '\t' << dep.path.generic_string() << '\n';
+			}
+
+			for (auto const& [target, record] : links) {
+				out << "link\t" << target.generic_string() << '\t' << record.build_time.count() << '\t' << record.peak_memory << '\t' << hash_to_string(record.command_hash) << '\n';
+				for (object_dependency const& input : record.inputs)
+					out << "in\t" << hash_to_string(input.hash) << '\t' << input.path.generic_string() << '\n';
+			}
+
+			for (auto const& [path, record] : scans) {
+				if (!record.used)
+					continue;
+				out << "scan\t" << record.size << '\t' << record.mtime << '\t' << hash_to_string(record.command_hash) << '\t' << record.export_name << '\t' << path.generic_string() << '\n';
+				for (std::string const& name : record.import_names)
+					out << "import\t" << name << '\n';
+			}
+
+			if (!out)
+				return false;
+		}
+
+		std::error_code ec;
+		fs::rename(tmp_path, db_path, ec);
+		return !ec;
+	}
+
+private:
+	// Normalize and sort paths, so lists of the same files compare equal
+	static std::vector<fs::path> normalized_paths(std::span<fs::path const> paths) {
+		std::vector<fs::path> result;
+		for (fs::path const& path : paths)
+			result.push_back(path.lexically_normal());
+		std::ranges::sort(result);
+		auto const dupes = std::ranges::unique(result);
+		result.erase(dupes.begin(), dupes.end());
+		return result;
+	}
+
+	void load() {
+		std::ifstream in(db_path, std::ios::binary);
+		if (!in)
+			return;
+
+		std::string line;
+		if (!std::getline(in, line) || line != db_header)
+			return;
+
+		object_record* current = nullptr;
+		link_record* current_link = nullptr;
+		scan_record* current_scan = nullptr;
+		while (std::getline(in, line)) {
+			auto const fields = split_fields(line);
+
+			if (fields[0] == "file" && fields.size() == 5) {
+				auto const size = parse_number<std::uintmax_t>(fields[1]);
+				auto const mtime = parse_number<std::int64_t>(fields[2]);
+				auto const hash = hash_from_string(fields[3]);
+				if (!size || !mtime || !hash)
+					return discard();
+				files[fs::path{ fields[4] }.lexically_normal()] = file_stamp{ *size, *mtime, *hash };
+			}
+			else if (fields[0] == "obj" && fields.size() == 8) {
+				auto const hash = hash_from_string(fields[3]);
+				auto const command_hash = hash_from_string(fields[4]);
+				auto const build_time = parse_number<std::int64_t>(fields[5]);
+				auto const peak_memory = parse_number<std::uint64_t>(fields[6]);
+				auto const cache_key = hash_from_string(fields[7]);
+				if (!hash || !command_hash || !build_time || !peak_memory || !cache_key)
+					return discard();
+				current = &objects[fs::path{ fields[1] }.lexically_normal()];
+				*current = object_record{};
+				current->source = fs::path{ fields[2] }.lexically_normal();
+				current->source_hash = *hash;
+				current->command_hash = *command_hash;
+				current->build_time = std::chrono::milliseconds{ *build_time };
+				current->peak_memory = *peak_memory;
+				current->cache_key = *cache_key;
+			}
+			else if (fields[0] == "dep" && fields.size() == 3 && current != nullptr) {
+				auto const hash = hash_from_string(fields[1]);
+				if (!hash)
+					return discard();
+				current->deps.push_back({ fs::path{ fields[2] }.lexically_normal(), *hash });
+			}
+			else if (fields[0] == "link" && fields.size() == 5) {
+				auto const build_time = parse_number<std::int64_t>(fields[2]);
+				auto const peak_memory = parse_number<std::uint64_t>(fields[3]);
+				auto const command_hash = hash_from_string(fields[4]);
+				if (!build_time || !peak_memory || !command_hash)
+					return discard();
+				current_link = &links[fs::path{ fields[1] }.lexically_normal()];
+				*current_link = link_record{ std::chrono::milliseconds{ *build_time }, *peak_memory, *command_hash, {} };
+			}
+			else if (fields[0] == "in" && fields.size() == 3 && current_link != nullptr) {
+				auto const hash = hash_from_string(fields[1]);
+				if (!hash)
+					return discard();
+				current_link->inputs.push_back({ fs::path{ fields[2] }.lexically_normal(), *hash });
+			}
+			else if (fields[0] == "scan" && fields.size() == 6) {
+				auto const size = parse_number<std::uintmax_t>(fields[1]);
+				auto const mtime = parse_number<std::int64_t>(fields[2]);
+				auto const command_hash = hash_from_string(fields[3]);
+				if (!size || !mtime || !command_hash)
+					return discard();
+				current_scan = &scans[fs::path{ fields[5] }.lexically_normal()];
+				*current_scan = scan_record{ *size, *mtime, *command_hash, std::string{ fields[4] }, {} };
+			}
+			else if (fields[0] == "import" && fields.size() == 2 && current_scan != nullptr) {
+				current_scan->import_names.emplace(fields[1]);
+			}
+			else {
+				return discard();
+			}
+		}
+
+		// Find the average build time
+		std::chrono::milliseconds total{ 0 };
+		std::int64_t count = 0;
+		for (auto const& [obj, record] : objects) {
+			if (record.build_time.count() > 0) {
+				total += record.build_time;
+				count += 1;
+			}
+		}
+		if (count > 0)
+			average_build_time = total / count;
+
+		// Find the average memory use
+		auto const average_memory = [](auto const& records) {
+			std::uint64_t total_memory = 0;
+			std::uint64_t memory_count = 0;
+			for (auto const& [path, record] : records) {
+				if (record.peak_memory > 0) {
+					total_memory += record.peak_memory;
+					memory_count += 1;
+				}
+			}
+			return memory_count > 0 ? total_memory / memory_count : 0;
+		};
+		average_compile_memory = average_memory(objects);
+		average_link_memory = average_memory(links);
+	}
+
+	// Throw away a corrupt database. Everything will be rebuilt.
+	void discard() {
+		files.clear();
+		objects.clear();
+		links.clear();
+		scans.clear();
+	}
+};
@@ -0,0 +1,174 @@
+module;
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <print>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <vector>
+export module build_options;
+
+// Options passed to the build command, eg. 'build=keep_going'
+export struct build_options {
+	// Keep building everything that doesn't depend on a failed task.
+	// By default the build stops starting new tasks after the first failure.
+	bool keep_going = false;
+
+	// The maximum number of jobs to run in parallel. 0 uses all hardware threads.
+	std::size_t jobs = 0;
+
+	// Only start compiles and links while their expected peak memory, recorded in earlier builds, fits in the budget
+	bool limit_memory = false;
+
+	// The memory budget in bytes. 0 uses the memory available when the build starts.
+	std::uint64_t memory_budget = 0;
+
+	// The maximum number of links to run in parallel. 0 means no limit.
+	std::size_t link_jobs = 0;
+
+	// Write a Chrome trace of the build, and print the slowest compiles and the critical path
+	bool trace = false;
+
+	// Restore objects from, and store them in, the object cache in '~/.gbs/cache'
+	bool cache = false;
+
+	// The size limit of the object cache in bytes. The least recently used objects are removed when it is exceeded.
+	std::uint64_t cache_size = 5ull << 30;
+
+	// Url of a shared cache, eg. 'http://cache:8080'. Checked when the local object cache misses, and filled in the background.
+	std::string cache_url;
+
+	// Workers to send compiles to, as 'host:port'. See the 'worker' command.
+	std::vector<std::string> workers;
+
+	// Find the module dependencies of the sources with the compiler's P1689 scanner instead of the built-in one
+	bool compiler_scan = false;
+
+	// Build module interfaces first, and their objects in separate tasks, so importers don't wait for code generation
+	bool two_phase = false;
+
+	// Compile the plain .cpp files of each project and library in unity files of about this many files. 0 disables it.
+	std::size_t unity_batch = 0;
+};
+
+// Parse a positive count, eg. '8'
+static std::optional<std::size_t> parse_count(std::string_view const value) {
+	std::size_t count = 0;
+	auto const [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), count);
+	if (ec != std::errc{} || ptr != value.data() + value.size() || count == 0)
+		return std::nullopt;
+	return count;
+}
+
+// Parse a size in bytes, eg. '512M' or '16G'. Sizes that don't fit in 64 bits are rejected.
+static std::optional<std::uint64_t> parse_size(std::string_view value) {
+	std::uint64_t scale = 1;
+	if (value.ends_with('K') || value.ends_with('k'))
+		scale = 1ull << 10;
+	else if (value.ends_with('M') || value.ends_with('m'))
+		scale = 1ull << 20;
+	else if (value.ends_with('G') || value.ends_with('g'))
+		scale = 1ull << 30;
+	if (scale != 1)
+		value.remove_suffix(1);
+
+	auto const size = parse_count(value);
+	if (!size || *size > std::numeric_limits<std::uint64_t>::max() / scale)
+		return std::nullopt;
+	return static_cast<std::uint64_t>(*size) * scale;
+}
+
+// Parse a comma-separated list of build options
+export std::optional<build_options> parse_build_options(std::string_view const args) {
+	build_options options;
+
+	for (auto const subrange : args | std::views::split(',')) {
+		std::string_view const option{ subrange.begin(), subrange.end() };
+		if (option.empty())
+			continue;
+
+		if (option == "keep_going")
+			options.keep_going = true;
+		else if (option == "fail_fast")
+			options.keep_going = false;
+		else if (option.starts_with("jobs=")) {
+			auto const jobs = parse_count(option.substr(5));
+			if (!jobs) {
+				std::println(std::cerr, "<gbs> Error: invalid job count '{}'", option.substr(5));
+				return std::nullopt;
+			}
+			options.jobs = *jobs;
+		}
+		else if (option == "trace") {
+			options.trace = true;
+		}
+		else if (option == "cache") {
+			options.cache = true;
+		}
+		else if (option.starts_with("cache_size=")) {
+			auto const size = parse_size(option.substr(11));
+			if (!size) {
+				std::println(std::cerr, "<gbs> Error: invalid cache size '{}'", option.substr(11));
+				return std::nullopt;
+			}
+			options.cache_size = *size;
+		}
+		else if (option.starts_with("cache=")) {
+			options.cache = true;
+			options.cache_url = option.substr(6);
+		}
+		else if (option.starts_with("worker=")) {
+			options.workers.emplace_back(option.substr(7));
+		}
+		else if (option == "mem") {
+			options.limit_memory = true;
+		}
+		else if (option.starts_with("mem=")) {
+			auto const budget = parse_size(option.substr(4));
+			if (!budget) {
+				std::println(std::cerr, "<gbs> Error: invalid memory budget '{}'", option.substr(4));
+				return std::nullopt;
+			}
+			options.limit_memory = true;
+			options.memory_budget = *budget;
+		}
+		else if (option == "unity") {
+			options.unity_batch = 8;
+		}
+		else if (option.starts_with("unity=")) {
+			auto const batch = parse_count(option.substr(6));
+			if (!batch) {
+				std::println(std::cerr, "<gbs> Error: invalid unity batch size '{}'", option.substr(6));
+				return std::nullopt;
+			}
+			options.unity_batch = *batch;
+		}
+		else if (option == "two_phase") {
+			options.two_phase = true;
+		}
+		else if (option == "scan=compiler") {
+			options.compiler_scan = true;
+		}
+		else if (option == "scan=builtin") {
+			options.compiler_scan = false;
+		}
+		else if (option.starts_with("link_jobs=")) {
+			auto const link_jobs = parse_count(option.substr(10));
+			if (!link_jobs) {
+				std::println(std::cerr, "<gbs> Error: invalid link job count '{}'", option.substr(10));
+				return std::nullopt;
+			}
+			options.link_jobs = *link_jobs;
+		}
+		else {
+			std::println(std::cerr, "<gbs> Error: unknown build option '{}'", option);
+			return std::nullopt;
+		}
+	}
+
+	return options;
+}
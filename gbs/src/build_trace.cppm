@@ -0,0 +1,112 @@
+module;
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <mutex>
+#include <print>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+export module build_trace;
+import json;
+
+namespace fs = std::filesystem;
+using clock_type = std::chrono::steady_clock;
+
+// Records what happened during a build, and writes it as a Chrome trace-event file.
+// Open the file in 'chrome://tracing' or 'https://ui.perfetto.dev'.
+export class build_trace {
+	struct span {
+		std::string category;
+		fs::path file;
+		clock_type::time_point start;
+		clock_type::time_point end;
+		std::size_t thread = 0;
+		int exit_code = 0;
+	};
+
+	mutable std::mutex mtx;
+	clock_type::time_point const origin = clock_type::now();
+	std::string config;
+
+	// Small ids for the threads that recorded spans. The thread that created the trace is 0.
+	std::unordered_map<std::thread::id, std::size_t> threads;
+	std::vector<span> spans;
+
+public:
+	explicit build_trace(std::string_view const config) : config(config) {
+		threads[std::this_thread::get_id()] = 0;
+	}
+
+	// Record a span of work done on the current thread, eg. 'compile' or 'link'
+	void add_span(std::string_view const category, fs::path const& file, clock_type::time_point const start, clock_type::time_point const end, int const exit_code = 0) {
+		std::scoped_lock lock(mtx);
+		auto const [it, inserted] = threads.try_emplace(std::this_thread::get_id(), threads.size());
+		spans.push_back({ std::string{ category }, file, start, end, it->second, exit_code });
+	}
+
+	// Write the trace to a json file
+	bool write(fs::path const& path) const {
+		std::scoped_lock lock(mtx);
+
+		std::ofstream out(path, std::ios::binary);
+		if (!out)
+			return false;
+
+		auto const micros = [](clock_type::duration const d) {
+			return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+		};
+
+		out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+		bool first = true;
+		for (auto const& [id, tid] : threads) {
+			std::string const name = tid == 0 ? std::string{ "main" } : std::format("worker {}", tid);
+			out << (first ? "" : ",\n");
+			out << std::format(R"({{"name":"thread_name","ph":"M","pid":1,"tid":{},"args":{{"name":{}}}}})", tid, json_quote(name));
+			first = false;
+		}
+
+		for (span const& s : spans) {
+			out << (first ? "" : ",\n");
+			out << std::format(R"({{"name":{},"cat":{},"ph":"X","ts":{},"dur":{},"pid":1,"tid":{},"args":{{"file":{},"config":{},"exit_code":{}}}}})",
+				json_quote(s.file.filename().generic_string()), json_quote(s.category),
+				micros(s.start - origin), micros(s.end - s.start), s.thread,
+				json_quote(s.file.generic_string()), json_quote(config), s.exit_code);
+			first = false;
+		}
+
+		out << "\n]}\n";
+		return static_cast<bool>(out);
+	}
+
+	// Print the slowest spans of a category, eg. the translation units that took longest to compile
+	void print_slowest(std::string_view const category, std::size_t const count) const {
+		std::vector<span> matches;
+		{
+			std::scoped_lock lock(mtx);
+			for (span const& s : spans) {
+				if (s.category == category)
+					matches.push_back(s);
+			}
+		}
+
+		if (matches.empty())
+			return;
+
+		std::ranges::sort(matches, std::ranges::greater{}, [](span const& s) { return s.end - s.start; });
+		if (matches.size() > count)
+			matches.resize(count);
+
+		std::println("<gbs> Slowest {} steps:", category);
+		for (span const& s : matches) {
+			auto const ms = std::chrono::duration_cast<std::chrono::milliseconds>(s.end - s.start).count();
+			std::println("<gbs>   {:>8} ms  {}", ms, s.file.generic_string());
+		}
+	}
+};
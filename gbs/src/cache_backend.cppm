@@ -0,0 +1,151 @@
+module;
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <print>
+#include <string>
+#include <string_view>
+export module cache_backend;
+import hash;
+import http;
+import net;
+import process;
+
+namespace fs = std::filesystem;
+
+// Storage for a shared build cache, using the layout of bazel-remote:
+//   'ac'  (action cache) maps keys to small records.
+//   'cas' (content addressable storage) maps the SHA-256 of a blob to the blob.
+// Keys are 64 character lowercase hex strings.
+export class cache_backend {
+public:
+	virtual ~cache_backend() = default;
+
+	// Get a blob. Returns nothing if it is not found or the cache can't be reached.
+	virtual std::optional<std::string> get(std::string_view kind, std::string_view key) = 0;
+
+	// Store a blob. Returns false if it failed.
+	virtual bool put(std::string_view kind, std::string_view key, std::string_view data) = 0;
+};
+
+// A cache reached over HTTP with 'GET/PUT <url>/<kind>/<key>', like bazel-remote.
+// bazel-remote has to be run with '--disable_http_ac_validation', since gbs does not store
+// bazel ActionResult messages in the action cache.
+export class http_cache_backend final : public cache_backend {
+	http_url url;
+
+	// Set after the first failed connection, so an unreachable cache doesn't slow down every compile
+	std::atomic_bool unreachable{ false };
+
+public:
+	explicit http_cache_backend(http_url url) : url(std::move(url)) {}
+
+	std::optional<std::string> get(std::string_view const kind, std::string_view const key) override {
+		auto response = request("GET", kind, key, {});
+		if (!response || response->status != 200)
+			return std::nullopt;
+		return std::move(response->body);
+	}
+
+	bool put(std::string_view const kind, std::string_view const key, std::string_view const data) override {
+		auto const response = request("PUT", kind, key, data);
+		return response && response->status >= 200 && response->status < 300;
+	}
+
+private:
+	std::optional<http_response> request(std::string_view const method, std::string_view const kind, std::string_view const key, std::string_view const data) {
+		if (unreachable)
+			return std::nullopt;
+
+		auto response = send_http_request(url, method, std::format("/{}/{}", kind, key), data);
+		if (!response && !unreachable.exchange(true))
+			std::println(std::cerr, "<gbs> Warning: remote cache at '{}:{}' can't be reached, it will not be used for the rest of the build", url.host, url.port);
+		return response;
+	}
+};
+
+// Create a cache backend from a url. Only 'http://' is supported.
+export std::unique_ptr<cache_backend> make_cache_backend(std::string_view const url) {
+	if (auto const http = parse_http_url(url))
+		return std::make_unique<http_cache_backend>(*http);
+
+	std::println(std::cerr, "<gbs> Error: unsupported cache url '{}'", url);
+	return {};
+}
+
+// Only allow hex keys, so requests can't reach outside the cache directory
+static bool is_valid_key(std::string_view const key) {
+	return !key.empty() && key.size() <= 128 && key.find_first_not_of("0123456789abcdef") == std::string_view::npos;
+}
+
+// Serve a cache over HTTP, storing the blobs in 'dir'. Used as a stand-in for bazel-remote.
+// Anyone who can connect can store results, so it listens on 'address', which is the loopback interface unless
+// another one is given.
+export bool run_cache_server(std::string const& address, std::uint16_t const port, fs::path const& dir) {
+	std::error_code ec;
+	fs::create_directories(dir / "ac", ec);
+	fs::create_directories(dir / "cas", ec);
+	if (ec) {
+		std::println(std::cerr, "<gbs> Error: could not create cache directory '{}': {}", dir.generic_string(), ec.message());
+		return false;
+	}
+
+	std::string const host = address.empty() ? std::string{ "127.0.0.1" } : address;
+	tcp_listener listener(port, host);
+	if (!listener.is_open()) {
+		std::println(std::cerr, "<gbs> Error: could not listen on {}:{}", host, port);
+		return false;
+	}
+
+	std::println("<gbs> Serving cache '{}' on {}:{}", dir.generic_string(), host, listener.port());
+	serve_http(listener, [&dir](http_request const& request) -> http_response {
+		// '/ac/<key>' or '/cas/<key>'
+		std::string_view path = request.path;
+		if (path.starts_with('/'))
+			path.remove_prefix(1);
+		auto const slash = path.find('/');
+		std::string_view const kind = path.substr(0, slash);
+		std::string_view const key = slash == std::string_view::npos ? std::string_view{} : path.substr(slash + 1);
+		if ((kind != "ac" && kind != "cas") || !is_valid_key(key))
+			return { 400, {} };
+
+		fs::path const file = dir / kind / key;
+		if (request.method == "GET" || request.method == "HEAD") {
+			std::ifstream in(file, std::ios::binary);
+			if (!in)
+				return { 404, {} };
+			return { 200, std::string{ std::istreambuf_iterator<char>(in), {} } };
+		}
+
+		if (request.method == "PUT") {
+			if (kind == "cas" && sha256_hex(request.body) != key)
+				return { 400, {} };
+
+			// Write to a temporary file first, so readers never see a partial blob
+			fs::path const tmp = unique_temp_path(file);
+			bool written = false;
+			{
+				std::ofstream out(tmp, std::ios::binary);
+				out.write(request.body.data(), static_cast<std::streamsize>(request.body.size()));
+				written = static_cast<bool>(out);
+			}
+			std::error_code ec;
+			if (written)
+				fs::rename(tmp, file, ec);
+			if (written && !ec)
+				return { 200, {} };
+
+			fs::remove(tmp, ec);
+			return { 500, {} };
+		}
+
+		return { 405, {} };
+	});
+	return true;
+}
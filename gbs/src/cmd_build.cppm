@@ -1,20 +1,31 @@
 module;
 #include <algorithm>
+#include <array>
+#include <cctype>
+#include <chrono>
 #include <coroutine>
+#include <cstdint>
 #include <execution>
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <iterator>
 #include <locale>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <print>
 #include <ranges>
 #include <set>
 #include <shared_mutex>
+#include <span>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
 export module cmd_build;
 import env;
 import context;
@@ -24,6 +35,20 @@ import os;
 import dep_scan;
 import task;
 import task_graph;
+import jobserver;
+import resource_limits;
+import build_trace;
+import object_cache;
+import cache_backend;
+import executor;
+import hash;
+import build_db;
+import dep_file;
+import process;
+import build_options;
+import thread_pool;
+import std_module_store;
+import unity;
 
 namespace fs = std::filesystem;
 using imports_map = std::unordered_map<fs::path, import_set>;  // source -> {imports}
@@ -36,27 +61,308 @@ static std::string to_upper(std::string const& cstr) {
 	return str;
 }
 
-static bool is_file_out_of_date(fs::path const& path, fs::path const& obj) {
-	if (!fs::exists(obj))
-		return true;
-
-	return (fs::last_write_time(obj) <= fs::last_write_time(path));
-}
-
 static fs::path get_object_filepath(fs::path const& path, context const& ctx) {
 	fs::path const obj = (ctx.output_dir() / path.filename()).replace_extension("obj");
 	return obj;
 }
 
-static auto make_build_job(context const& ctx, fs::path const& path, fs::path const& obj, std::string_view defines) {
+// The command that runs the compiler with 'build_args', without the dependency file
+static std::string make_compile_command(context const& ctx, std::string_view build_args, std::string_view defines) {
 	auto cmd =
 		ctx.build_command_prefix() +
-		ctx.build_command(path.generic_string(), obj) +
+		std::string{ build_args } +
 		ctx.get_response_args().data() +
 		ctx.get_module_directory();
 	if (!defines.empty())
 		cmd += ctx.build_define(defines);
-	return [cmd = std::move(cmd)] { std::system(cmd.c_str()); };
+	return cmd;
+}
+
+// The command that compiles a file, without the dependency file. The dependency scanners are given this as well.
+static std::string make_compile_command(context const& ctx, fs::path const& path, fs::path const& obj, std::string_view defines) {
+	return make_compile_command(ctx, ctx.build_command(path.generic_string(), obj), defines);
+}
+
+static std::string make_build_command(context const& ctx, fs::path const& path, fs::path const& obj, std::string_view defines) {
+	return make_compile_command(ctx, path, obj, defines) + ctx.build_depfile(get_depfile_path(obj));
+}
+
+// State shared by the tasks of a build
+struct build_state {
+	build_db& db;
+	executor& exec;
+
+	// Runs everything that has to run on this machine, at most the local job count at a time
+	local_executor& local;
+
+	// Optional; null if not enabled
+	build_trace* trace = nullptr;
+	object_cache* cache = nullptr;
+
+	// The module interface written by each module source
+	std::unordered_map<fs::path, fs::path> module_bmis;
+
+	// The objects of the modules each object imports, directly or indirectly
+	std::unordered_map<fs::path, std::vector<fs::path>> imported_modules;
+
+	// The include directories of the libraries. Only used for remote compiles.
+	std::vector<fs::path> include_dirs;
+
+	// Module dependencies found by the compiler's scanner. Only used with 'scan=compiler'.
+	std::unordered_map<fs::path, source_dependency> compiler_scans;
+
+	// Build module interfaces and their objects in separate tasks
+	bool two_phase = false;
+
+	// The number of files in a unity file. 0 if unity builds are off.
+	std::size_t unity_batch = 0;
+};
+
+// Passed from the task that writes a module interface to the task that compiles its object
+struct two_phase_result {
+	// Set if the lookup restored both from the cache
+	bool restored = false;
+
+	std::chrono::milliseconds precompile_time{ 0 };
+	std::uint64_t peak_memory = 0;
+	std::optional<std::uint64_t> cache_key;
+	std::vector<fs::path> deps;
+};
+
+// Print the output of a compiler/linker command in one go
+static void print_result(process_result const& result, fs::path const& target) {
+	print_output(result.output);
+	if (!result.succeeded())
+		print_output(std::format("<gbs> Error: building '{}' failed with exit code {}", target.generic_string(), result.exit_code));
+}
+
+// Run a compiler/linker command on this machine and print its output
+static process_result run_command(build_state& state, std::string_view const cmd, fs::path const& target) {
+	process_result result = state.local.run(cmd);
+	print_result(result, target);
+	return result;
+}
+
+// Find the project headers a source includes, directly or through other headers, for a source that hasn't been built
+// before. Includes are looked for next to the file including them, then in the include directories of the libraries.
+// Headers outside the project, like the system headers, have to be on the workers already.
+static std::vector<fs::path> find_included_headers(build_state const& state, fs::path const& source) {
+	std::set<fs::path> headers;
+	std::vector<fs::path> pending{ source };
+	while (!pending.empty()) {
+		fs::path const file = std::move(pending.back());
+		pending.pop_back();
+
+		for (std::string const& include : extract_includes(file)) {
+			fs::path const name = include.substr(1, include.size() - 2);
+			std::vector<fs::path> candidates;
+			if (include.front() == '"')
+				candidates.push_back(file.parent_path() / name);
+			for (fs::path const& dir : state.include_dirs)
+				candidates.push_back(dir / name);
+
+			for (fs::path const& candidate : candidates) {
+				std::error_code ec;
+				fs::path const header = candidate.lexically_normal();
+				if (!fs::is_regular_file(header, ec))
+					continue;
+				if (!header.is_absolute() && headers.insert(header).second)
+					pending.push_back(header);
+				break;
+			}
+		}
+	}
+	return headers | std::ranges::to<std::vector>();
+}
+
+// Collect the files a compile reads, so it can run on another machine
+static std::vector<job_input> collect_inputs(build_state& state, std::string_view const cmd, fs::path const& path, fs::path const& obj) {
+	std::set<fs::path> files{ path.lexically_normal() };
+	for (fs::path const& response_file : get_response_files(cmd))
+		files.insert(response_file.lexically_normal());
+
+	// The interfaces of the imported modules
+	if (auto const record = state.db.pending_record(obj)) {
+		for (object_dependency const& dep : record->deps) {
+			if (auto const it = state.module_bmis.find(dep.path); it != state.module_bmis.end())
+				files.insert(it->second);
+		}
+	}
+
+	// The headers used by the last build of the source, or the ones it includes if it hasn't been built before
+	std::vector<fs::path> headers = state.db.previous_dependencies(obj);
+	if (headers.empty())
+		headers = find_included_headers(state, path);
+	files.insert_range(headers);
+
+	std::vector<job_input> inputs;
+	for (fs::path const& file : files) {
+		if (file.is_absolute())
+			continue;
+		if (auto const hash = state.db.file_hash(file))
+			inputs.push_back({ file, *hash });
+	}
+	return inputs;
+}
+
+// Returns true if 'target' was linked with 'cmd' from 'inputs' as they are now, so linking it again would give the same result
+static bool is_link_up_to_date(build_state& state, std::string_view const cmd, fs::path const& target, std::span<fs::path const> inputs) {
+	return state.db.is_link_up_to_date(target, state.db.hash_command(cmd), inputs);
+}
+
+// Run a link command, and record it with its inputs, how long it took and how much memory it used
+static bool run_link_command(build_state& state, std::string_view const cmd, fs::path const& target, std::span<fs::path const> inputs) {
+	auto const start = std::chrono::steady_clock::now();
+	process_result const result = run_command(state, cmd, target);
+	auto const end = std::chrono::steady_clock::now();
+	if (state.trace)
+		state.trace->add_span("link", target, start, end, result.exit_code);
+	if (!result.succeeded())
+		return false;
+
+	auto const build_time = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+	state.db.commit_link(target, state.db.hash_command(cmd), inputs, build_time, result.peak_memory);
+	return true;
+}
+
+// Create a task that links 'target'
+static task_ptr create_link_task(task_graph& graph, build_db& db, fs::path const& name, fs::path const& target, std::function<bool()> work) {
+	task_ptr task = graph.create_task(name, std::move(work));
+	task->kind = task_kind::link;
+	task->cost = db.expected_build_time(target).count();
+	task->memory = db.expected_link_memory(target);
+	return task;
+}
+
+// Record the headers of the modules an object imports, once they have been built. Returns the files that were added.
+static std::vector<fs::path> add_module_dependencies(build_state& state, fs::path const& obj) {
+	auto const it = state.imported_modules.find(obj.lexically_normal());
+	if (it == state.imported_modules.end())
+		return {};
+	return state.db.add_module_dependencies(obj, it->second);
+}
+
+// Restore an object from the cache if it has been built before
+static auto make_cache_lookup(build_state& state, fs::path const& path, fs::path const& obj, std::optional<fs::path> const& bmi) {
+	return [&state, path, obj, bmi] {
+		auto const start = std::chrono::steady_clock::now();
+		auto const cache_key = state.cache->input_key(state.db, obj);
+		if (!cache_key || !state.cache->restore(state.db, *cache_key, path, obj, bmi))
+			return false;
+
+		if (state.trace)
+			state.trace->add_span("cache", path, start, std::chrono::steady_clock::now());
+		return true;
+	};
+}
+
+static auto make_build_job(build_state& state, std::string cmd, fs::path const& path, fs::path const& obj, std::optional<fs::path> const& bmi) {
+	return [cmd = std::move(cmd), &state, path, obj, bmi, depfile = get_depfile_path(obj)] {
+		build_db& db = state.db;
+
+		compile_job job{ cmd, {}, { obj, depfile }, depfile };
+
+		// Compiles that write a module interface stay local, since the importers need the interface here,
+		// and it is usually larger than the object
+		bool const local_only = bmi.has_value();
+		if (!local_only && state.exec.remote_slots() > 0)
+			job.inputs = collect_inputs(state, cmd, path, obj);
+
+		auto const start = std::chrono::steady_clock::now();
+		process_result const result = local_only ? state.local.run(cmd) : state.exec.run(job);
+		auto const end = std::chrono::steady_clock::now();
+		print_result(result, path);
+		if (state.trace)
+			state.trace->add_span("compile", path, start, end, result.exit_code);
+		if (!result.succeeded())
+			return false;
+		auto const build_time = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+
+		// The cache key has to be taken before the headers are added to the pending record
+		std::optional<std::uint64_t> const cache_key = state.cache ? state.cache->input_key(db, obj) : std::nullopt;
+
+		// Record the headers the object was built from, and those of the modules it imports
+		std::vector<fs::path> deps = read_dependency_file(depfile);
+		for (fs::path const& dep : deps) {
+			if (dep.lexically_normal() != path.lexically_normal())
+				db.add_dependency(obj, dep);
+		}
+		deps.append_range(add_module_dependencies(state, obj));
+		db.commit_object(obj, build_time, result.peak_memory);
+
+		if (cache_key)
+			state.cache->store(db, *cache_key, path, obj, bmi, deps, build_time, result.peak_memory);
+		return true;
+	};
+}
+
+// Create the tasks of a module built in two steps. The first writes the interface, and is named after the source so
+// importers wait for it. The second compiles the interface to an object, and is returned, since links need the object.
+// If 'pch_task' is set, the first step waits for the precompiled header it builds.
+static task_ptr create_two_phase_tasks(build_state& state, task_graph& tg, std::string precompile_cmd, std::string object_cmd, fs::path const& path, fs::path const& obj, fs::path const& bmi, task_ptr const& pch_task) {
+	auto const result = std::make_shared<two_phase_result>();
+
+	task_ptr const precompile = tg.create_task(path, [&state, result, cmd = std::move(precompile_cmd), path, obj, depfile = get_depfile_path(obj)] {
+		auto const start = std::chrono::steady_clock::now();
+		process_result const process = state.local.run(cmd);
+		auto const end = std::chrono::steady_clock::now();
+		print_result(process, path);
+		if (state.trace)
+			state.trace->add_span("precompile", path, start, end, process.exit_code);
+		if (!process.succeeded())
+			return false;
+
+		// The cache key has to be taken before the headers are added to the pending record
+		result->cache_key = state.cache ? state.cache->input_key(state.db, obj) : std::nullopt;
+		result->deps = read_dependency_file(depfile);
+		for (fs::path const& dep : result->deps) {
+			if (dep.lexically_normal() != path.lexically_normal())
+				state.db.add_dependency(obj, dep);
+		}
+		result->deps.append_range(add_module_dependencies(state, obj));
+		result->precompile_time = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+		result->peak_memory = process.peak_memory;
+		return true;
+	});
+	if (state.cache) {
+		precompile->lookup = [result, lookup = make_cache_lookup(state, path, obj, bmi)] {
+			result->restored = lookup();
+			return result->restored;
+		};
+	}
+
+	task_ptr const object = tg.create_task(obj, [&state, result, cmd = std::move(object_cmd), path, obj, bmi] {
+		if (result->restored)
+			return true;
+
+		auto const start = std::chrono::steady_clock::now();
+		process_result const process = state.local.run(cmd);
+		auto const end = std::chrono::steady_clock::now();
+		print_result(process, path);
+		if (state.trace)
+			state.trace->add_span("codegen", path, start, end, process.exit_code);
+		if (!process.succeeded())
+			return false;
+
+		auto const build_time = result->precompile_time + std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+		auto const peak_memory = std::max(result->peak_memory, process.peak_memory);
+		state.db.commit_object(obj, build_time, peak_memory);
+		if (result->cache_key)
+			state.cache->store(state.db, *result->cache_key, path, obj, bmi, result->deps, build_time, peak_memory);
+		return true;
+	});
+
+	// The build time of the object covers both steps, which are assumed to take about as long
+	for (task_ptr const& t : { precompile, object }) {
+		t->kind = task_kind::compile;
+		t->cost = state.db.expected_build_time(obj).count() / 2;
+		t->memory = state.db.expected_compile_memory(obj);
+	}
+
+	if (pch_task)
+		tg.add_dependency(pch_task, precompile);
+	tg.add_dependency(precompile, object);
+	return object;
 }
 
 static bool init_build(context& ctx) {
@@ -78,10 +384,20 @@ static bool init_build(context& ctx) {
 	}
 	else {
 		std::string const base_name = fs::current_path().stem().generic_string();
-		auto const cmd = ctx.build_command_prefix() + ctx.get_response_args().data() + " -dumpmachine > arch.txt";
-		std::string arch;
-		if (0 == std::system(cmd.c_str()) && std::getline(std::ifstream("arch.txt"), arch)) {
-			std::remove("arch.txt");
+		auto const cmd = ctx.build_command_prefix() + ctx.get_response_args().data() + " -dumpmachine";
+		process_result const result = run_process(cmd);
+
+		// The triple is the only line without spaces; warnings may be printed as well
+		std::string_view arch;
+		for (auto const line : result.output | std::views::split('\n')) {
+			std::string_view const sv{ line.begin(), line.end() };
+			if (!sv.empty() && !sv.contains(' ')) {
+				arch = sv.substr(0, sv.find('\r'));
+				break;
+			}
+		}
+
+		if (result.succeeded() && !arch.empty()) {
 			ctx.set_target_os(os_from_target_triple(arch));
 		}
 		else {
@@ -105,61 +421,359 @@ static bool init_build(context& ctx) {
 	return true;
 }
 
+// Collect the include paths of all the libraries in the 'lib' directory
+static std::set<fs::path> get_library_includes() {
+	std::set<fs::path> includes;
+	if (!fs::exists("lib"))
+		return includes;
+
+	for (fs::directory_entry const& dir : fs::directory_iterator("lib")) {
+		if (!dir.is_directory())
+			continue;
+
+		fs::path const lib = dir.path().lexically_normal();
+		if (fs::exists(lib / "src")) includes.insert(lib / "src");
+		if (fs::exists(lib / "inc")) includes.insert(lib / "inc");
+		if (fs::exists(lib / "include")) includes.insert(lib / "include");
+		if (!lib.has_extension())
+			includes.insert(lib);
+	}
+
+	return includes;
+}
+
 static bool is_valid_sourcefile(fs::path const& file) {
 	static constexpr std::array<std::string_view, 4> extensions{ ".cpp", ".c", ".cppm", ".ixx" };
 	return extensions.end() != std::find(extensions.begin(), extensions.end(), file.extension());
 }
 
+// Write a file only if its content changed, so its timestamp tells when the content last changed
+static void write_if_changed(fs::path const& path, std::string const& content) {
+	{
+		std::ifstream in(path, std::ios::binary);
+		if (in && std::string{ std::istreambuf_iterator<char>(in), {} } == content)
+			return;
+	}
+
+	std::ofstream out(path, std::ios::binary);
+	out << content;
+}
+
 // Create the object list file
 static fs::path create_object_file_list(context& ctx, std::string_view name, std::span<const fs::path> paths) {
 	fs::path objlist_name = (ctx.output_dir() / name).concat("_OBJLIST");
-	std::ofstream objlist(objlist_name);
+	std::string objlist;
 	for(fs::path const& src : paths) {
 		fs::path const obj = (ctx.output_dir() / src.filename()).replace_extension("obj");
-		objlist << obj.generic_string() << ' ';
+		objlist += obj.generic_string() + ' ';
 	}
-	objlist.close();
+	write_if_changed(objlist_name, objlist);
 	return objlist_name;
 }
 
-static task_ptr create_build_task(context const& ctx, task_graph& tg, fs::path const& path, module_map& modmap, imports_map& impmap, std::string_view defines = "") {
+// Collect the files a link reads: the objects of its sources and of the static libraries, and the libraries it links to, if any.
+// The lists naming them are response files of the link command, so they are part of its hash.
+static std::vector<fs::path> collect_link_inputs(context const& ctx, std::span<const fs::path> sources,
+	std::set<fs::path> const& lib_objects, std::set<fs::path> const* libs) {
+	std::vector<fs::path> inputs;
+	for (fs::path const& src : sources)
+		inputs.push_back(get_object_filepath(src, ctx));
+	inputs.insert_range(inputs.end(), lib_objects);
+
+	if (libs)
+		inputs.insert_range(inputs.end(), *libs);
+	return inputs;
+}
+
+// Collect the module interfaces a source imports, directly or indirectly
+static void collect_module_sources(fs::path const& path, module_map const& modmap, imports_map const& impmap, std::set<fs::path>& sources) {
+	auto const it = impmap.find(path);
+	if (it == impmap.end())
+		return;
+
+	for (auto const& imp : it->second) {
+		auto const mod = modmap.find(imp);
+		if (mod != modmap.end() && sources.insert(mod->second).second)
+			collect_module_sources(mod->second, modmap, impmap, sources);
+	}
+}
+
+// A precompiled header used by the sources of a project or library
+struct precompiled_header {
+	// The header the sources include, and the file the compiler precompiles it to
+	fs::path header;
+	fs::path pch;
+
+	// Set if the precompiled header is built by this build
+	task_ptr task;
+
+	// The headers it was last built from
+	std::vector<fs::path> deps;
+};
+
+// Create a job that compiles a header to a precompiled header or header unit. Only compiles on this machine read
+// them, so they are always built locally.
+static auto make_header_job(build_state& state, std::string cmd, fs::path const& name, fs::path const& source, fs::path const& out, std::string_view const category) {
+	return [&state, cmd = std::move(cmd), name, source, out, category] {
+		auto const start = std::chrono::steady_clock::now();
+		process_result const result = state.local.run(cmd);
+		auto const end = std::chrono::steady_clock::now();
+		print_result(result, name);
+		if (state.trace)
+			state.trace->add_span(category, name, start, end, result.exit_code);
+		if (!result.succeeded())
+			return false;
+
+		for (fs::path const& dep : read_dependency_file(get_depfile_path(out))) {
+			if (dep.lexically_normal() != source.lexically_normal())
+				state.db.add_dependency(out, dep);
+		}
+		state.db.commit_object(out, std::chrono::duration_cast<std::chrono::milliseconds>(end - start), result.peak_memory);
+		return true;
+	};
+}
+
+// Precompile the 'pch.h' of a project or library, if it has one and the compiler supports it
+static std::optional<precompiled_header> create_pch_task(context const& ctx, task_graph& tg, build_state& state, fs::path const& dir, std::string_view defines = "") {
+	fs::path const header = dir / "pch.h";
+	if (!fs::exists(header))
+		return std::nullopt;
+
+	// The compilers look for the precompiled header next to the header they include, so a header in the output
+	// directory includes the real one
+	std::string const name = (dir == "." ? fs::current_path().stem() : dir.filename()).generic_string();
+	fs::path const wrapper = ctx.output_dir() / (name + ".pch.h");
+	fs::path const pch = ctx.pch_path(wrapper);
+	auto const args = ctx.pch_command(wrapper, pch);
+	if (!args)
+		return std::nullopt;
+	write_if_changed(wrapper, std::format("#include \"{}\"\n", fs::absolute(header).generic_string()));
+
+	build_db& db = state.db;
+	precompiled_header result{ wrapper, pch };
+	std::string cmd = make_compile_command(ctx, *args, defines) + ctx.build_depfile(get_depfile_path(pch));
+	std::uint64_t const cmd_hash = db.hash_command(cmd);
+	if (!db.is_up_to_date(pch, wrapper, cmd_hash)) {
+		db.begin_object(pch, wrapper, cmd_hash);
+		result.task = tg.create_task(pch, make_header_job(state, std::move(cmd), header, wrapper, pch, "pch"));
+		result.task->kind = task_kind::compile;
+		result.task->cost = db.expected_build_time(pch).count();
+		result.task->memory = db.expected_compile_memory(pch);
+	}
+
+	result.deps = db.previous_dependencies(pch);
+	result.deps.push_back(header);
+	return result;
+}
+
+// Quoted header units are looked for next to the importer first, like '#include "foo.h"'. A header found there is
+// named by its path, so the compiler finds it and headers with the same name in other directories stay apart.
+static std::string resolve_header_unit_name(fs::path const& importer, std::string const& name) {
+	if (name.size() < 3 || !name.starts_with('"'))
+		return name;
+
+	std::error_code ec;
+	fs::path const local = importer.parent_path() / name.substr(1, name.size() - 2);
+	if (!fs::is_regular_file(local, ec))
+		return name;
+	return std::format("\"{}\"", local.lexically_normal().generic_string());
+}
+
+// Build a header imported as a header unit, eg. 'import <vector>;', once for all its importers.
+// Returns the interface, or nothing if the import is not a header or the compiler can't build header units.
+static std::optional<fs::path> create_header_unit_task(context const& ctx, task_graph& tg, build_state& state, std::string const& name, module_map& modmap) {
+	if (name.size() < 3 || (!name.starts_with('<') && !name.starts_with('"')))
+		return std::nullopt;
+
+	std::string file = "hu_";
+	for (char const c : name.substr(1, name.size() - 2))
+		file += std::isalnum(static_cast<unsigned char>(c)) ? c : '_';
+	auto const bmi = ctx.bmi_path(ctx.output_dir() / (file + ".obj"), file);
+	auto const args = bmi ? ctx.header_unit_command(name, *bmi) : std::nullopt;
+	if (!args)
+		return std::nullopt;
+	if (modmap.contains(name))
+		return bmi;
+	modmap[name] = *bmi;
+	state.module_bmis[bmi->lexically_normal()] = *bmi;
+
+	// The compiler finds the header, so a file naming it stands in for the source in the build database
+	fs::path const source = fs::path{ *bmi }.replace_extension("hu");
+	write_if_changed(source, name);
+
+	build_db& db = state.db;
+	std::string cmd = make_compile_command(ctx, *args, {}) + ctx.build_depfile(get_depfile_path(*bmi));
+	std::uint64_t const cmd_hash = db.hash_command(cmd);
+	if (!db.is_up_to_date(*bmi, source, cmd_hash)) {
+		db.begin_object(*bmi, source, cmd_hash);
+		task_ptr const task = tg.create_task(*bmi, make_header_job(state, std::move(cmd), name, source, *bmi, "header unit"));
+		task->kind = task_kind::compile;
+		task->cost = db.expected_build_time(*bmi).count();
+		task->memory = db.expected_compile_memory(*bmi);
+	}
+	return bmi;
+}
+
+// Get the commands that build a source. The second one compiles the object of a module interface built in two
+// steps, and is empty otherwise.
+static std::pair<std::string, std::string> make_build_commands(context const& ctx, build_state const& state, fs::path const& path, fs::path const& obj, std::optional<fs::path> const& bmi, std::string_view defines) {
+	// Module interfaces can be written before their objects, so importers only wait for the interface
+	auto const precompile = (state.two_phase && bmi) ? ctx.precompile_command(path.generic_string(), *bmi) : std::nullopt;
+	if (!precompile)
+		return { make_build_command(ctx, path, obj, defines), std::string{} };
+
+	return {
+		make_compile_command(ctx, *precompile, defines) + ctx.build_depfile(get_depfile_path(obj)),
+		make_compile_command(ctx, ctx.bmi_object_command(*bmi, obj), defines)
+	};
+}
+
+static task_ptr create_build_task(context const& ctx, task_graph& tg, build_state& state, fs::path const& path, module_map& modmap, imports_map& impmap, std::string_view defines = "", precompiled_header const* pch = nullptr) {
 	if (!is_valid_sourcefile(path) || !should_include(path))
 		return {};
 
-	source_dependency const deps = extract_module_dependencies(path);
+	build_db& db = state.db;
+
+	auto const scan_start = std::chrono::steady_clock::now();
+	auto const compiler_scan = state.compiler_scans.find(path.lexically_normal());
+	source_dependency const deps = (compiler_scan != state.compiler_scans.end()) ? compiler_scan->second
+		: ctx.get_scan_cache() ? ctx.get_scan_cache()->get(path)
+		: db.module_dependencies(path);
+	if (state.trace && compiler_scan == state.compiler_scans.end())
+		state.trace->add_span("scan", path, scan_start, std::chrono::steady_clock::now());
 	if (deps.is_export())
 		modmap[deps.export_name] = path;
-	impmap[path] = deps.import_names;
+
+	std::set<std::string> imports;
+	for (std::string const& name : deps.import_names)
+		imports.insert(resolve_header_unit_name(path, name));
+	impmap[path] = imports;
 
 	fs::path const obj = get_object_filepath(path, ctx);
-	if (is_file_out_of_date(path, obj)) {
-		return tg.create_task(path, make_build_job(ctx, path, obj, defines));
+	auto const bmi = ctx.bmi_path(obj, deps.export_name);
+	auto [cmd, object_cmd] = make_build_commands(ctx, state, path, obj, bmi, defines);
+
+	// The precompiled header and the header units the source imports
+	std::string extra_args = pch ? ctx.use_pch_command(path.generic_string(), pch->header, pch->pch) : std::string{};
+	bool const uses_pch = !extra_args.empty();
+	for (std::string const& name : imports) {
+		if (auto const unit = create_header_unit_task(ctx, tg, state, name, modmap))
+			extra_args += ctx.use_header_unit_command(name, *unit);
 	}
-	return {};
+	cmd += extra_args;
+	if (!object_cmd.empty())
+		object_cmd += extra_args;
+
+	// Sources are rebuilt along with their precompiled header
+	std::uint64_t const cmd_hash = db.hash_command(cmd + object_cmd);
+	if (db.is_up_to_date(obj, path, cmd_hash) && !(uses_pch && pch->task))
+		return {};
+
+	db.begin_object(obj, path, cmd_hash);
+	if (state.cache)
+		state.cache->begin_object(db, obj, cmd + object_cmd);
+	if (uses_pch) {
+		for (fs::path const& dep : pch->deps)
+			db.add_dependency(obj, dep);
+	}
+	if (bmi)
+		state.module_bmis[path.lexically_normal()] = *bmi;
+	if (!object_cmd.empty())
+		return create_two_phase_tasks(state, tg, std::move(cmd), std::move(object_cmd), path, obj, *bmi, uses_pch ? pch->task : task_ptr{});
+
+	task_ptr task = tg.create_task(path, make_build_job(state, std::move(cmd), path, obj, bmi));
+	if (state.cache)
+		task->lookup = make_cache_lookup(state, path, obj, bmi);
+	task->kind = task_kind::compile;
+	task->cost = db.expected_build_time(obj).count();
+	task->memory = db.expected_compile_memory(obj);
+	if (uses_pch && pch->task)
+		tg.add_dependency(pch->task, task);
+	return task;
 }
 
-export bool cmd_build(context& ctx, std::string_view /*target*/) {
-	std::println("<gbs> Building...");
+// Combine the plain .cpp files of a target into unity files, balanced by how long each file took to compile on
+// its own. Module units, files using modules, and files declaring the same static names as another file are
+// compiled on their own. Returns the files to compile in place of 'sources'.
+static std::vector<fs::path> make_unity_sources(context const& ctx, build_state& state, std::string const& name, std::vector<fs::path> sources) {
+	if (state.unity_batch < 2)
+		return sources;
 
-	if (!init_build(ctx))
-		return false;
+	std::vector<fs::path> candidates;
+	std::vector<fs::path> result;
+	for (fs::path const& path : sources) {
+		source_dependency const deps = state.db.module_dependencies(path);
+		if (path.extension() == ".cpp" && should_include(path) && !deps.is_export() && deps.import_names.empty())
+			candidates.push_back(path);
+		else
+			result.push_back(path);
+	}
 
-	// Save paths to libraries and objects
-	std::set<fs::path> libs;
-	std::set<fs::path> objects;
+	// Statics with the same name in two files would clash in one unity file. Files whose internal names can't be
+	// found are compiled on their own.
+	std::unordered_map<std::string, std::size_t> name_counts;
+	std::unordered_map<fs::path, std::optional<std::set<std::string>>> static_names;
+	for (fs::path const& path : candidates) {
+		auto const& names = static_names[path] = find_static_names(path);
+		for (std::string const& static_name : names.value_or(std::set<std::string>{}))
+			name_counts[static_name] += 1;
+	}
 
-	// Containers for all source files, includes, defines and targets
-	std::unordered_set<fs::path> includes;
-	module_map modmap;
-	imports_map impmap;
-	task_graph graph;
+	std::vector<std::pair<fs::path, std::int64_t>> batched;
+	for (fs::path const& path : candidates) {
+		auto const& names = static_names[path];
+		bool const clashes = !names || std::ranges::any_of(*names, [&](std::string const& static_name) { return name_counts[static_name] > 1; });
+		if (clashes)
+			result.push_back(path);
+		else
+			batched.emplace_back(path, state.db.expected_build_time(get_object_filepath(path, ctx)).count());
+	}
 
-	// Add the std module to the build
-	fs::path const std_module_path = *ctx.get_selected_compiler().std_module;
-	create_build_task(ctx, graph, std_module_path, modmap, impmap);
+	if (batched.size() < 2) {
+		for (auto const& [path, cost] : batched)
+			result.push_back(path);
+		return result;
+	}
 
-	// 'lib' directory: process all libraries shared between all the projects
-	auto lib_task = graph.create_task("lib", []() {});
+	// The sources are included relative to the unity file, so it doesn't depend on where the project is
+	fs::path const unity_dir = ctx.output_dir() / "unity";
+	fs::create_directories(unity_dir);
+	fs::path const unity_root = fs::absolute(unity_dir).lexically_normal();
+	std::size_t const count = (batched.size() + state.unity_batch - 1) / state.unity_batch;
+	auto const batches = balance_batches(std::move(batched), count);
+	for (std::size_t k = 0; k < batches.size(); ++k) {
+		std::string content;
+		for (fs::path const& path : batches[k]) {
+			// Paths on another drive have no relative path
+			fs::path const source = fs::absolute(path).lexically_normal();
+			fs::path const relative = source.lexically_relative(unity_root);
+			content += std::format("#include \"{}\"\n", (relative.empty() ? source : relative).generic_string());
+		}
+
+		fs::path const unity_file = unity_dir / std::format("unity_{}_{}.cpp", name, k);
+		write_if_changed(unity_file, content);
+		result.push_back(unity_file);
+	}
+	return result;
+}
+
+// The kinds of directories a build takes sources from
+enum class source_dir_kind {
+	static_library,
+	dynamic_library,
+	project,
+};
+
+// A library in 'lib', or a project directory holding 'src' and 'unittest' directories
+struct source_dir {
+	source_dir_kind kind;
+	fs::path path;
+};
+
+// Find the libraries and projects of the build. The build tasks and the up-front scan are both made from this,
+// so they see the same sources. Returns nothing if the directory layout is invalid.
+static std::optional<std::vector<source_dir>> find_source_dirs() {
+	std::vector<source_dir> dirs;
 	for (auto dir_it : fs::directory_iterator(".", fs::directory_options::follow_directory_symlink | fs::directory_options::skip_permission_denied)) {
 		if (!dir_it.is_directory())
 			continue;
@@ -171,7 +785,7 @@ export bool cmd_build(context& ctx, std::string_view /*target*/) {
 		if ("src" == p) {
 			std::println(std::cerr, "<gbs> error: 'src' directory shall be inside a project directory, aborting...");
 			std::println(std::cerr, "             '{}'", fs::current_path().generic_string());
-			return false;
+			return std::nullopt;
 		}
 
 		if ("lib" == p) {
@@ -180,86 +794,378 @@ export bool cmd_build(context& ctx, std::string_view /*target*/) {
 					continue;
 
 				fs::path const lib = dir.path().lexically_normal();
-				if (fs::exists(lib / "src")) includes.insert(lib / "src");
-				if (fs::exists(lib / "inc")) includes.insert(lib / "inc");
-				if (fs::exists(lib / "include")) includes.insert(lib / "include");
-
-				if (!lib.has_extension()) {
-					includes.insert(lib);
+				if (!lib.has_extension())
 					continue;
+
+				if (lib.stem() == "s")
+					dirs.push_back({ source_dir_kind::static_library, lib });
+				else if (lib.stem() == "d")
+					dirs.push_back({ source_dir_kind::dynamic_library, lib });
+				else
+					std::println("<gbs> warning: skipping directory '{}' in 'lib' since it doesn't follow naming convention (s.* for static libs, d.* for dynamic libs)", lib.generic_string());
+			}
+		}
+		else {
+			dirs.push_back({ source_dir_kind::project, p });
+		}
+	}
+	return dirs;
+}
+
+// The define a dynamic library is built with, eg. 'FOO_EXPORTS' for 'lib/d.foo'
+static std::string get_export_define(fs::path const& lib) {
+	return to_upper(lib.extension().generic_string().substr(1)) + "_EXPORTS";
+}
+
+// A source file, and the defines it is compiled with
+struct source_unit {
+	fs::path path;
+	std::string defines;
+};
+
+// Collect the sources of the build, including the std module
+static std::vector<source_unit> collect_sources(context const& ctx, std::span<source_dir const> dirs) {
+	std::vector<source_unit> sources{ { *ctx.get_selected_compiler().std_module, {} } };
+	auto const add = [&](fs::path const& dir, std::string const& defines) {
+		for (fs::path const& path : get_source_files(dir)) {
+			if (is_valid_sourcefile(path) && should_include(path))
+				sources.push_back({ path, defines });
+		}
+	};
+
+	for (source_dir const& dir : dirs) {
+		switch (dir.kind) {
+		case source_dir_kind::static_library:
+			add(dir.path, {});
+			break;
+		case source_dir_kind::dynamic_library:
+			add(dir.path, get_export_define(dir.path));
+			break;
+		case source_dir_kind::project:
+			if (fs::exists(dir.path / "src"))
+				add(dir.path / "src", {});
+			if (fs::exists(dir.path / "unittest"))
+				add(dir.path / "unittest", {});
+			break;
+		}
+	}
+
+	return sources;
+}
+
+// Find the module dependencies of all sources with the compiler's scanner, in parallel. The results are kept in the
+// build database, so only changed files are scanned again. Files that can't be scanned use the built-in scanner.
+static void scan_with_compiler(context const& ctx, build_state& state, std::span<source_dir const> dirs, std::size_t const jobs) {
+	std::vector<source_unit> const sources = collect_sources(ctx, dirs);
+	std::println("<gbs> Scanning {} files for module dependencies...", sources.size());
+
+	std::mutex mtx;
+	thread_pool pool(jobs);
+	job_group scans(pool);
+	for (source_unit const& source : sources) {
+		scans.run([&ctx, &state, &mtx, source] {
+			// The scanners are pointed at scratch files, so they can't touch the real outputs
+			fs::path const obj = get_object_filepath(source.path, ctx);
+			fs::path const dep_file = fs::path{ obj }.replace_extension("ddi");
+			fs::path const scratch = fs::path{ obj }.replace_extension("scan");
+			auto const cmd = ctx.scan_command(make_compile_command(ctx, source.path, scratch, source.defines), obj, dep_file);
+			if (!cmd)
+				return;
+
+			auto const start = std::chrono::steady_clock::now();
+			auto deps = state.db.scan_dependencies(source.path, state.db.hash_command(*cmd), [&]() -> std::optional<source_dependency> {
+				std::error_code ec;
+				fs::remove(dep_file, ec);
+
+				process_result const result = run_process(*cmd);
+				std::optional<source_dependency> scanned;
+				if (result.succeeded()) {
+					if (std::ifstream in(dep_file, std::ios::binary); in)
+						scanned = parse_p1689(source.path, std::string{ std::istreambuf_iterator<char>(in), {} });
+					else
+						scanned = parse_p1689(source.path, result.output);
 				}
 
-				if (lib.stem() == "s") {
-					for (fs::path const& path : get_source_files(lib)) {
-						if (should_include(path)) {
-							auto task = create_build_task(ctx, graph, path, modmap, impmap);
-							if (task)
-								graph.add_dependency(task, lib_task);
-							objects.insert((ctx.output_dir() / path.filename()).replace_extension("obj"));
-						}
-					}
+				fs::remove(dep_file, ec);
+				fs::remove(scratch, ec);
+
+				if (!scanned) {
+					print_output(result.output);
+					print_output(std::format("<gbs> Warning: the compiler could not scan '{}', using the built-in scanner", source.path.generic_string()));
 				}
-				else if (lib.stem() == "d") {
-					std::string const export_define = to_upper(lib.extension().generic_string().substr(1)) + "_EXPORTS";
-					auto const vec = get_source_files(lib) | std::ranges::to<std::vector>();
-
-					// Create the object list file for the .lib file
-					std::string const name = lib.extension().generic_string().substr(1);
-					auto const objlist_name = create_object_file_list(ctx, name, vec);
-
-					// Add it to the library list
-					auto const lib_or_dll_name = (ctx.get_selected_compiler().name == "gcc") ? os_get_dynamic_library_name(ctx.get_target_os(), name) : os_get_static_library_name(ctx.get_target_os(), name);
-					fs::path const out_lib = ctx.output_dir() / lib_or_dll_name;// os_get_static_library_name(ctx.get_target_os(), name);
-					libs.insert(out_lib);
-
-					auto dll_task = graph.create_task(lib, [&ctx, name, objlist_name] {
-						std::string const lib_name = os_get_static_library_name(ctx.get_target_os(), name);
-						std::string const dll_name = os_get_dynamic_library_name(ctx.get_target_os(), name);
-
-						std::println("<gbs> Creating dynamic library '{}'...", dll_name);
-						std::string const obj_resp = std::format(" @{}", objlist_name.generic_string());
-						std::string const cmd = ctx.dynamic_library_command(dll_name, lib_name, ctx.output_dir().generic_string()) + obj_resp;
-						std::system(cmd.c_str());
-						});
+				return scanned;
+			});
 
-					graph.add_dependency(dll_task, lib_task);
-					for (fs::path const& path : vec) {
-						if (should_include(path)) {
-							auto src_task = create_build_task(ctx, graph, path, modmap, impmap, export_define);
-							if (src_task)
-								graph.add_dependency(src_task, dll_task);
-						}
-					}
+			if (state.trace)
+				state.trace->add_span("scan", source.path, start, std::chrono::steady_clock::now());
+			if (deps) {
+				std::scoped_lock lock(mtx);
+				state.compiler_scans[source.path.lexically_normal()] = std::move(*deps);
+			}
+		});
+	}
+	scans.wait();
+}
+
+// Identify the selected compiler in the object cache
+static std::uint64_t compiler_cache_key(context const& ctx) {
+	auto const& cl = ctx.get_selected_compiler();
+	std::error_code ec;
+	auto const size = fs::file_size(cl.executable, ec);
+	return hash_bytes(std::format("{}\n{}\n{}\n{}", cl.name_and_version, cl.executable.generic_string(), cl.wsl.value_or(""), size));
+}
+
+// Get the key of the std module in the shared store. The output directory, the project's include paths and the
+// warnings are left out, since they don't change what is built, so all configurations that only differ in those
+// share the module.
+static std::uint64_t std_module_key(context const& ctx, build_db& db, fs::path const& std_module, fs::path const& obj) {
+	std::string cmd = make_build_command(ctx, std_module, obj, {});
+	std::uint64_t hash = hash_bytes(hash_to_string(db.file_hash(std_module).value_or(0)), compiler_cache_key(ctx));
+
+	for (fs::path const& response_file : get_response_files(cmd)) {
+		if (response_file.filename() == "SRC_INCLUDES" || response_file.filename() == "warnings") {
+			std::string const arg = "@" + response_file.generic_string();
+			if (auto const pos = cmd.find(arg); pos != std::string::npos)
+				cmd.erase(pos, arg.size());
+		}
+		else {
+			hash = hash_bytes(hash_to_string(db.file_hash(response_file).value_or(0)), hash);
+		}
+	}
+
+	std::string const out = ctx.output_dir().generic_string();
+	for (auto pos = cmd.find(out); pos != std::string::npos; pos = cmd.find(out, pos + 1))
+		cmd.replace(pos, out.size(), "<out>");
+
+	return hash_bytes(cmd, hash);
+}
+
+// Print the chain of tasks that determined how long the build took
+static void print_critical_path(task_graph const& graph) {
+	auto const path = graph.critical_path();
+	if (path.empty())
+		return;
+
+	using std::chrono::duration_cast;
+	using std::chrono::milliseconds;
+
+	std::println("<gbs> Critical path ({} ms):", duration_cast<milliseconds>(path.back()->finished - path.front()->started).count());
+	for (task_ptr const& t : path) {
+		if (t->kind != task_kind::other)
+			std::println("<gbs>   {:>8} ms  {}", duration_cast<milliseconds>(t->finished - t->started).count(), t->name);
+	}
+}
+
+// Join the jobserver of a parent make, or create one that is shared with the compilers and linkers
+static std::unique_ptr<jobserver> make_jobserver(context const& ctx, std::size_t const jobs) {
+	auto const makeflags = ctx.get_env_value("MAKEFLAGS");
+	if (makeflags) {
+		if (auto js = jobserver::connect(*makeflags)) {
+			std::println("<gbs> Using jobserver from MAKEFLAGS");
+			return js;
+		}
+	}
+
+	return jobserver::create(jobs, makeflags);
+}
+
+export bool cmd_build(context& ctx, std::string_view args) {
+	std::println("<gbs> Building...");
+
+	auto const options = parse_build_options(args);
+	if (!options)
+		return false;
+
+	if (!init_build(ctx))
+		return false;
+
+	// Save paths to libraries and objects
+	std::set<fs::path> libs;
+	std::set<fs::path> objects;
+
+	// Containers for all source files, defines and targets
+	module_map modmap;
+	imports_map impmap;
+	build_db db(ctx.output_dir() / "BUILDDB");
+	auto const trace = options->trace ? std::make_unique<build_trace>(ctx.get_config()) : std::unique_ptr<build_trace>{};
+	std::unique_ptr<object_cache> cache;
+	if (options->cache) {
+		std::unique_ptr<cache_backend> remote;
+		if (!options->cache_url.empty()) {
+			remote = make_cache_backend(options->cache_url);
+			if (!remote)
+				return false;
+		}
+		cache = std::make_unique<object_cache>(ctx.get_home_dir() / ".gbs" / "cache", options->cache_size, compiler_cache_key(ctx), ctx.output_dir(), std::move(remote));
+	}
+
+	// Compiles run here, unless workers are given. Only processes started here take slots from the jobserver.
+	std::size_t const local_jobs = options->jobs ? options->jobs : std::max(1u, std::thread::hardware_concurrency());
+	std::unique_ptr<jobserver> const job_slots = make_jobserver(ctx, local_jobs);
+	local_executor local(local_jobs, job_slots.get());
+	std::unique_ptr<remote_executor> remote;
+	if (!options->workers.empty()) {
+		auto token = read_worker_token(ctx.get_home_dir());
+		if (!token) {
+			std::println(std::cerr, "<gbs> Error: no worker token in '{}', copy it from a machine running 'gbs worker'", worker_token_path(ctx.get_home_dir()).generic_string());
+			return false;
+		}
+		remote = std::make_unique<remote_executor>(options->workers, std::move(*token), local);
+	}
+	executor& exec = remote ? static_cast<executor&>(*remote) : local;
+
+	build_state state{ db, exec, local, trace.get(), cache.get() };
+	state.two_phase = options->two_phase;
+	state.unity_batch = options->unity_batch;
+	if (exec.remote_slots() > 0)
+		state.include_dirs = get_library_includes() | std::ranges::to<std::vector>();
+
+	// Remote slots are added to the local jobs, so there are enough threads to keep the workers busy.
+	// Processes started here are still limited to the local jobs by 'local'.
+	std::size_t const jobs = local_jobs + exec.remote_slots();
+	task_graph graph(jobs);
+
+	if (options->limit_memory || options->link_jobs > 0) {
+		std::uint64_t memory_budget = options->memory_budget;
+		if (options->limit_memory && memory_budget == 0)
+			memory_budget = available_system_memory().value_or(0);
+		if (memory_budget > 0)
+			std::println("<gbs> Limiting build memory to {} MiB", memory_budget >> 20);
+		graph.limit_resources(memory_budget, options->link_jobs);
+	}
+
+	// Create a response file for all include paths.
+	// This is done up front since it is part of every compile command.
+	{
+		std::ofstream includes_rsp(ctx.output_dir() / "SRC_INCLUDES");
+		for (fs::path const& include : get_library_includes())
+			includes_rsp << ctx.make_include_path(include.generic_string()) << ' ';
+		includes_rsp.close();
+	}
+
+	// The libraries and projects to build
+	auto const source_dirs = find_source_dirs();
+	if (!source_dirs)
+		return false;
+
+	// Scan all sources up front, so the compiler's scanner can run in parallel
+	if (options->compiler_scan)
+		scan_with_compiler(ctx, state, *source_dirs, local_jobs);
+
+	// Add the std module to the build. It is copied from the shared store if another configuration or project
+	// has built it with the same compiler and flags.
+	fs::path const std_module_path = *ctx.get_selected_compiler().std_module;
+	fs::path const std_obj = get_object_filepath(std_module_path, ctx);
+	auto const std_bmi = ctx.bmi_path(std_obj, "std");
+	auto const [std_cmd, std_object_cmd] = make_build_commands(ctx, state, std_module_path, std_obj, std_bmi, {});
+	std::uint64_t const std_cmd_hash = db.hash_command(std_cmd + std_object_cmd);
+	std::optional<std_module_store> std_store;
+	if (std_bmi) {
+		std::uint64_t const std_key = std_module_key(ctx, db, std_module_path, std_obj);
+		std_store.emplace(ctx.get_home_dir() / ".gbs" / "std", ctx.get_selected_compiler().name_and_version, std_key);
+		if (!db.is_up_to_date(std_obj, std_module_path, std_cmd_hash) && std_store->restore(std_obj, *std_bmi)) {
+			std::println("<gbs> Using prebuilt std module from '{}'", std_store->path().generic_string());
+			db.begin_object(std_obj, std_module_path, std_cmd_hash);
+			db.commit_object(std_obj, std::chrono::milliseconds{ 0 }, 0);
+
+			// The store key identifies the module, so sources importing it can still be cached
+			db.set_cache_key(std_obj, std_key);
+		}
+	}
+	create_build_task(ctx, graph, state, std_module_path, modmap, impmap);
+
+	// 'lib' directory: process all libraries shared between all the projects
+	auto lib_task = graph.create_task("lib", []() { return true; });
+	for (source_dir const& dir : *source_dirs) {
+		if (dir.kind == source_dir_kind::static_library) {
+			fs::path const& lib = dir.path;
+			auto const pch = create_pch_task(ctx, graph, state, lib);
+			for (fs::path const& path : make_unity_sources(ctx, state, lib.filename().generic_string(), get_source_files(lib) | std::ranges::to<std::vector>())) {
+				if (should_include(path)) {
+					auto task = create_build_task(ctx, graph, state, path, modmap, impmap, {}, pch ? &*pch : nullptr);
+					if (task)
+						graph.add_dependency(task, lib_task);
+					objects.insert((ctx.output_dir() / path.filename()).replace_extension("obj"));
 				}
-				else {
-					std::println("<gbs> warning: skipping directory '{}' in 'lib' since it doesn't follow naming convention (s.* for static libs, d.* for dynamic libs)", lib.generic_string());
+			}
+		}
+		else if (dir.kind == source_dir_kind::dynamic_library) {
+			fs::path const& lib = dir.path;
+			std::string const export_define = get_export_define(lib);
+			auto const vec = make_unity_sources(ctx, state, lib.filename().generic_string(), get_source_files(lib) | std::ranges::to<std::vector>());
+
+			// Create the object list file for the .lib file
+			std::string const name = lib.extension().generic_string().substr(1);
+			auto const objlist_name = create_object_file_list(ctx, name, vec);
+
+			// Add it to the library list
+			auto const lib_or_dll_name = (ctx.get_selected_compiler().name == "gcc") ? os_get_dynamic_library_name(ctx.get_target_os(), name) : os_get_static_library_name(ctx.get_target_os(), name);
+			fs::path const out_lib = ctx.output_dir() / lib_or_dll_name;// os_get_static_library_name(ctx.get_target_os(), name);
+			libs.insert(out_lib);
+
+			fs::path const dll_path = ctx.output_dir() / os_get_dynamic_library_name(ctx.get_target_os(), name);
+			auto dll_task = create_link_task(graph, db, lib, dll_path, [&ctx, &state, &objects, name, objlist_name, dll_path, vec] {
+				std::string const lib_name = os_get_static_library_name(ctx.get_target_os(), name);
+				std::string const dll_name = os_get_dynamic_library_name(ctx.get_target_os(), name);
+
+				std::string const obj_resp = std::format(" @{}", objlist_name.generic_string());
+				std::string const cmd = ctx.dynamic_library_command(dll_name, lib_name, ctx.output_dir().generic_string()) + obj_resp;
+				std::vector<fs::path> const inputs = collect_link_inputs(ctx, vec, objects, nullptr);
+				if (is_link_up_to_date(state, cmd, dll_path, inputs))
+					return true;
+
+				std::println("<gbs> Creating dynamic library '{}'...", dll_name);
+				return run_link_command(state, cmd, dll_path, inputs);
+				});
+
+			graph.add_dependency(dll_task, lib_task);
+			auto const pch = create_pch_task(ctx, graph, state, lib, export_define);
+			for (fs::path const& path : vec) {
+				if (should_include(path)) {
+					auto src_task = create_build_task(ctx, graph, state, path, modmap, impmap, export_define, pch ? &*pch : nullptr);
+					if (src_task)
+						graph.add_dependency(src_task, dll_task);
 				}
 			}
 		}
 		else {
+			fs::path const& p = dir.path;
+			auto const pch = create_pch_task(ctx, graph, state, p);
+
+			// The sources of the project, and the tasks that build them, so unittests can link its modules
+			std::vector<fs::path> project_sources;
+			std::unordered_map<fs::path, task_ptr> project_tasks;
+
 			if (fs::exists(p / "src")) {
-				auto const source_files = get_source_files(p / "src") | std::ranges::to<std::vector>();
+				std::string const name = p == "." ? fs::current_path().stem().generic_string() : p.stem().generic_string();
+				auto const source_files = make_unity_sources(ctx, state, name, get_source_files(p / "src") | std::ranges::to<std::vector>());
+				project_sources = source_files;
 
 				// Create the object list file for the .lib file
-				std::string const name = p == "." ? fs::current_path().stem().generic_string() : p.stem().generic_string();
 				auto const objlist_name = create_object_file_list(ctx, name, source_files);
 
-				auto exe_task = graph.create_task(p, [&ctx, name, objlist_name] {
+				fs::path const exe_path = ctx.output_dir() / os_get_executable_name(ctx.get_target_os(), name);
+				auto exe_task = create_link_task(graph, db, p, exe_path, [&ctx, &state, &objects, &libs, name, objlist_name, exe_path, source_files] {
 					std::string const exe_name = os_get_executable_name(ctx.get_target_os(), name);
 
-					std::println("<gbs> Linking executable '{}'...", exe_name);
 					std::string const obj_resp = std::format(" @{}", objlist_name.generic_string());
 					std::string const cmd = ctx.link_command(exe_name, ctx.output_dir().generic_string()) + obj_resp;
-					std::system(cmd.c_str());
+					std::vector<fs::path> const inputs = collect_link_inputs(ctx, source_files, objects, &libs);
+					if (is_link_up_to_date(state, cmd, exe_path, inputs))
+						return true;
+
+					std::println("<gbs> Linking executable '{}'...", exe_name);
+					return run_link_command(state, cmd, exe_path, inputs);
 					});
 
 				//graph.add_dependency(lib_task, exe_task);
 				for (fs::path const& path : source_files) {
 					if (should_include(path)) {
-						auto src_task = create_build_task(ctx, graph, path, modmap, impmap);
+						auto src_task = create_build_task(ctx, graph, state, path, modmap, impmap, {}, pch ? &*pch : nullptr);
 						if (src_task) {
 							graph.add_dependency(lib_task, src_task);
 							graph.add_dependency(src_task, exe_task);
+							project_tasks[path.lexically_normal()] = src_task;
 						}
 					}
 				}
@@ -276,12 +1182,13 @@ export bool cmd_build(context& ctx, std::string_view /*target*/) {
 
 				// Create the object list file for non-test files
 				fs::path objlist_name = create_object_file_list(ctx, "sup_" + name, supports);
+				std::vector<fs::path> const support_files(supports.begin(), supports.end());
 
 				// Create the build tasks for the support files
 				std::vector<task_ptr> support_tasks;
 				for (fs::path const& path : supports) {
 					if (should_include(path)) {
-						auto src_task = create_build_task(ctx, graph, path, modmap, impmap);
+						auto src_task = create_build_task(ctx, graph, state, path, modmap, impmap, {}, pch ? &*pch : nullptr);
 						if (src_task) {
 							support_tasks.push_back(std::move(src_task));
 						}
@@ -297,17 +1204,44 @@ export bool cmd_build(context& ctx, std::string_view /*target*/) {
 					// Save the unittest executable in the context
 					ctx.add_unittest(ctx.output_dir() / exe_name);
 
+					auto src_task = create_build_task(ctx, graph, state, test, modmap, impmap, {}, pch ? &*pch : nullptr);
+
+					// Unittests link the objects of the project modules they import, since the project itself is an executable
+					std::set<fs::path> imported_sources;
+					collect_module_sources(test, modmap, impmap, imported_sources);
+					std::vector<fs::path> module_sources;
+					for (fs::path const& source : project_sources) {
+						if (imported_sources.contains(source))
+							module_sources.push_back(source);
+					}
+
+					std::vector<fs::path> link_sources = support_files;
+					link_sources.append_range(module_sources);
+
 					// Create the unittest task
-					auto exe_task = graph.create_task(exe_name, [&ctx, test_name, exe_name, objlist_name] {
-						std::println("<gbs> Linking unittest '{}'...", exe_name);
-						std::string const obj_resp = std::format(" @{} {}/{}.obj", objlist_name.generic_string(), ctx.output_dir().generic_string(), test_name);
+					fs::path const exe_path = ctx.output_dir() / exe_name;
+					auto exe_task = create_link_task(graph, db, exe_name, exe_path, [&ctx, &state, &objects, &libs, test_name, exe_name, objlist_name, exe_path, link_sources, module_sources, test] {
+						std::string obj_resp = std::format(" @{} {}/{}.obj", objlist_name.generic_string(), ctx.output_dir().generic_string(), test_name);
+						for (fs::path const& source : module_sources)
+							obj_resp += ' ' + get_object_filepath(source, ctx).generic_string();
 						std::string const cmd = ctx.link_command(exe_name, ctx.output_dir().generic_string()) + obj_resp;
-						std::system(cmd.c_str());
+						std::vector<fs::path> inputs = collect_link_inputs(ctx, link_sources, objects, &libs);
+						inputs.push_back(get_object_filepath(test, ctx));
+						if (is_link_up_to_date(state, cmd, exe_path, inputs))
+							return true;
+
+						std::println("<gbs> Linking unittest '{}'...", exe_name);
+						return run_link_command(state, cmd, exe_path, inputs);
 						});
 
-					auto src_task = create_build_task(ctx, graph, test, modmap, impmap);
-					graph.add_dependency(lib_task, src_task);
-					graph.add_dependency(src_task, exe_task);
+					if (src_task) {
+						graph.add_dependency(lib_task, src_task);
+						graph.add_dependency(src_task, exe_task);
+					}
+					for (fs::path const& source : module_sources) {
+						if (auto const it = project_tasks.find(source.lexically_normal()); it != project_tasks.end())
+							graph.add_dependency(it->second, exe_task);
+					}
 					for (auto const& support_task : support_tasks) {
 						//graph.add_dependency(lib_task, support_task);
 						graph.add_dependency(support_task, exe_task);
@@ -319,35 +1253,29 @@ export bool cmd_build(context& ctx, std::string_view /*target*/) {
 
 	// Create the object list file
 	{
-		std::ofstream objlist(ctx.output_dir() / "OBJLIST");
+		std::string objlist;
 		for (fs::path const& obj : objects)
-			objlist << obj.generic_string() << ' ';
-		objlist.close();
+			objlist += obj.generic_string() + ' ';
+		write_if_changed(ctx.output_dir() / "OBJLIST", objlist);
 	}
 
-	// Create a response file for all include paths
+	// Create the library list file
 	{
-		std::ofstream includes_rsp(ctx.output_dir() / "SRC_INCLUDES");
-		for (fs::path const& include : includes)
-			includes_rsp << ctx.make_include_path(include.generic_string()) << ' ';
-		includes_rsp.close();
+		std::string liblist;
+		for (fs::path const& lib : libs)
+			liblist += lib.generic_string() + ' ';
+		write_if_changed(ctx.output_dir() / "LIBLIST", liblist);
 	}
 
-	// Create the library list file
-	std::ofstream liblist(ctx.output_dir() / "LIBLIST");
-	for (fs::path const& lib : libs)
-		liblist << lib.generic_string() << ' ';
-	liblist.close();
-
 	// Set up the task dependencies for modules
 	for (auto const& [path, impset] : impmap) {
-		task_ptr const& task = graph.find_task(path);
+		task_ptr const task = graph.find_task(path);
 		for (auto const& imp : impset)
 		{
 			if (modmap.contains(imp)) {
 				auto const& dep_path = modmap.at(imp);
 				auto dep_task = graph.find_task(dep_path);
-				if (dep_task) {
+				if (task && dep_task) {
 					//std::println("<gbs> linking '{}' -> '{}'", path.generic_string(), dep_path.generic_string());
 					graph.add_dependency(dep_task, task);
 				}
@@ -357,9 +1285,54 @@ export bool cmd_build(context& ctx, std::string_view /*target*/) {
 				//return false;
 			}
 		}
+
+		// Objects depend on the content of the module interfaces they import
+		if (task) {
+			std::set<fs::path> module_sources;
+			collect_module_sources(path, modmap, impmap, module_sources);
+
+			// The headers of the modules are only known once they are built, so they are added after the compile.
+			// Header units are recorded under their interface.
+			fs::path const obj = get_object_filepath(path, ctx);
+			std::vector<fs::path>& module_objects = state.imported_modules[obj.lexically_normal()];
+			for (fs::path const& module_source : module_sources) {
+				db.add_dependency(obj, module_source);
+				module_objects.push_back(is_valid_sourcefile(module_source) ? get_object_filepath(module_source, ctx) : module_source);
+			}
+		}
+	}
+
+	bool const succeeded = graph.run(options->keep_going);
+
+	// Share a std module built by this build
+	if (std_store && db.is_up_to_date(std_obj, std_module_path, std_cmd_hash))
+		std_store->add(std_obj, *std_bmi);
+
+	db.save();
+
+	if (trace) {
+		fs::path const trace_path = ctx.output_dir() / "trace.json";
+		if (trace->write(trace_path))
+			std::println("<gbs> Build trace written to '{}'", trace_path.generic_string());
+		else
+			std::println(std::cerr, "<gbs> Error: could not write build trace to '{}'", trace_path.generic_string());
+
+		trace->print_slowest("compile", 10);
+		print_critical_path(graph);
 	}
 
-	graph.run();
+	if (cache) {
+		if (options->cache_url.empty())
+			std::println("<gbs> Object cache: {} hits, {} misses", cache->get_hits(), cache->get_misses());
+		else
+			std::println("<gbs> Object cache: {} hits, {} remote hits, {} misses", cache->get_hits(), cache->get_remote_hits(), cache->get_misses());
+		cache->evict();
+	}
+
+	if (!succeeded) {
+		std::println(std::cerr, "<gbs> Build failed.");
+		return false;
+	}
 
 	return true;
 }
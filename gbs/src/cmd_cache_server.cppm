@@ -0,0 +1,38 @@
+module;
+#include <charconv>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <print>
+#include <string>
+#include <string_view>
+export module cmd_cache_server;
+import context;
+import cache_backend;
+
+// Serve a shared build cache over HTTP, eg. 'cache_server=8080', 'cache_server=8080,/srv/gbs-cache' or
+// 'cache_server=0.0.0.0:8080'. Builds use it with 'build=cache=http://host:8080'. Runs until the process is stopped.
+export bool cmd_cache_server(context& ctx, std::string_view args) {
+	std::string_view const address_arg = args.substr(0, args.find(','));
+
+	// Only the local machine can connect unless an address is given
+	std::string_view port_arg = address_arg;
+	std::string address;
+	if (auto const colon = address_arg.rfind(':'); colon != std::string_view::npos) {
+		address = address_arg.substr(0, colon);
+		port_arg = address_arg.substr(colon + 1);
+	}
+
+	std::uint16_t port = 0;
+	auto const [ptr, ec] = std::from_chars(port_arg.data(), port_arg.data() + port_arg.size(), port);
+	if (ec != std::errc{} || ptr != port_arg.data() + port_arg.size() || port == 0) {
+		std::println(std::cerr, "<gbs> Error: cache_server needs a port, eg. 'cache_server=8080'");
+		return false;
+	}
+
+	std::filesystem::path dir = ctx.get_home_dir() / ".gbs" / "cache_server";
+	if (address_arg.size() < args.size())
+		dir = args.substr(address_arg.size() + 1);
+
+	return run_cache_server(address, port, dir);
+}
@@ -7,12 +7,12 @@ export module cmd_cl;
 import context;
 
 export bool cmd_cl(context& ctx, std::string_view args) {
-	if (ctx.get_compiler_collection().empty()) {
-		ctx.fill_compiler_collection();
-		if (ctx.get_compiler_collection().empty()) {
-			std::println(std::cerr, "<gbs> Error: no compilers found while looking for '{}'.", args);
-			return false;
-		}
+	// Only the requested family is searched for
+	std::string_view const family = args.substr(0, args.find(':'));
+	ctx.fill_compiler_family(family);
+	if (!ctx.get_compiler_collection().contains(family)) {
+		std::println(std::cerr, "<gbs> Error: no compilers found while looking for '{}'.", args);
+		return false;
 	}
 
 	if (ctx.set_compiler(args)) {
@@ -0,0 +1,414 @@
+module;
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <print>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#endif
+export module cmd_daemon;
+import context;
+import dep_scan;
+import file_watch;
+import hash;
+import net;
+
+namespace fs = std::filesystem;
+
+// The daemon protocol is line based. Lines giving a size are followed by that many bytes of data.
+//
+//   client                     daemon
+//   gbs.daemon 2
+//   token <token>
+//   env <name>=<value>   *
+//   arg <command>        *
+//   end                        ok, or 'env <name>' if the client has another value for it
+//                              out <size>     *
+//                              exit <code>
+constexpr std::string_view protocol_header = "gbs.daemon 2";
+
+// Commands the daemon can run. Anything else runs in the client.
+constexpr std::array<std::string_view, 5> daemon_commands{ "cl", "config", "build", "clean", "unittest" };
+
+// Environment variables that change what the compilers and linkers do, or how many jobs run.
+// Builds run with the environment of the daemon, so clients with other values build themselves.
+constexpr std::array<std::string_view, 8> build_environment{ "PATH", "MAKEFLAGS", "INCLUDE", "LIB", "CPATH", "C_INCLUDE_PATH", "CPLUS_INCLUDE_PATH", "LIBRARY_PATH" };
+
+static std::optional<std::string_view> get_env(std::string_view const name) {
+	char const* const value = std::getenv(std::string{ name }.c_str());
+	if (value == nullptr)
+		return std::nullopt;
+	return value;
+}
+
+// The file a running daemon is announced in, holding its port and token
+static fs::path daemon_file(context const& ctx) {
+	return ctx.get_gbs_internal() / "daemon";
+}
+
+static std::string_view command_name(std::string_view const arg) {
+	return arg.substr(0, arg.find('='));
+}
+
+// Sends everything written to stdout and stderr to a client while it exists
+class output_redirect {
+	tcp_socket& socket;
+	int saved_stdout = -1;
+	int saved_stderr = -1;
+	int read_fd = -1;
+	std::thread reader;
+
+public:
+	explicit output_redirect(tcp_socket& client) : socket(client) {
+		std::fflush(stdout);
+		std::fflush(stderr);
+
+		int fds[2];
+#ifdef _WIN32
+		if (0 != _pipe(fds, 64 * 1024, _O_BINARY))
+			return;
+		saved_stdout = _dup(_fileno(stdout));
+		saved_stderr = _dup(_fileno(stderr));
+		_dup2(fds[1], _fileno(stdout));
+		_dup2(fds[1], _fileno(stderr));
+		_close(fds[1]);
+#else
+		if (0 != pipe(fds))
+			return;
+		saved_stdout = dup(STDOUT_FILENO);
+		saved_stderr = dup(STDERR_FILENO);
+		dup2(fds[1], STDOUT_FILENO);
+		dup2(fds[1], STDERR_FILENO);
+		close(fds[1]);
+#endif
+		read_fd = fds[0];
+
+		reader = std::thread([this] {
+			char buffer[4096];
+			for (;;) {
+#ifdef _WIN32
+				int const n = _read(read_fd, buffer, sizeof(buffer));
+#else
+				ssize_t const n = read(read_fd, buffer, sizeof(buffer));
+#endif
+				if (n <= 0)
+					break;
+				socket.send_all(std::format("out {}\n", n));
+				socket.send_all(std::string_view{ buffer, static_cast<std::size_t>(n) });
+			}
+		});
+	}
+
+	output_redirect(output_redirect const&) = delete;
+	output_redirect& operator=(output_redirect const&) = delete;
+
+	~output_redirect() {
+		if (read_fd == -1)
+			return;
+
+		std::cout.flush();
+		std::cerr.flush();
+		std::fflush(stdout);
+		std::fflush(stderr);
+
+		// Restoring the original descriptors closes the last write end of the pipe, which ends the reader
+#ifdef _WIN32
+		_dup2(saved_stdout, _fileno(stdout));
+		_dup2(saved_stderr, _fileno(stderr));
+		_close(saved_stdout);
+		_close(saved_stderr);
+		reader.join();
+		_close(read_fd);
+#else
+		dup2(saved_stdout, STDOUT_FILENO);
+		dup2(saved_stderr, STDERR_FILENO);
+		close(saved_stdout);
+		close(saved_stderr);
+		reader.join();
+		close(read_fd);
+#endif
+	}
+};
+
+// What the daemon keeps between requests
+struct daemon_state {
+	context const& base;
+	scan_cache scans;
+	file_watcher watcher;
+
+	// Incremented whenever a watched file changes
+	std::uint64_t generation = 0;
+
+	// The last successful build, the generation of the tree it saw, and the state of its outputs
+	struct build_record {
+		std::string key;
+		std::uint64_t generation = 0;
+		std::uint64_t outputs = 0;
+		std::vector<fs::path> unittests;
+	};
+	std::optional<build_record> last_build;
+
+	daemon_state(context const& ctx)
+		: base(ctx), watcher(".", { ctx.get_gbs_out(), ".git" }) {}
+
+	// Apply the changes made since the last call. inotify queues events before a write returns,
+	// so everything saved before the request was sent is seen here.
+	void apply_changes() {
+		std::vector<fs::path> const changed = watcher.wait_for_changes(std::chrono::milliseconds{ 0 });
+		if (changed.empty())
+			return;
+
+		generation += 1;
+		for (fs::path const& path : changed) {
+			if (path == fs::path{ "." })
+				scans.clear();
+			else
+				scans.invalidate(path);
+		}
+	}
+};
+
+// Hash the names, sizes and timestamps of the files in an output directory. The tree watcher skips 'gbs.out',
+// so this is how outputs that were deleted or touched since the last build are noticed.
+static std::uint64_t hash_outputs(fs::path const& dir) {
+	std::vector<std::string> entries;
+	std::error_code ec;
+	for (auto it = fs::recursive_directory_iterator(dir, fs::directory_options::skip_permission_denied, ec); it != fs::recursive_directory_iterator(); it.increment(ec)) {
+		if (ec)
+			break;
+		if (!it->is_regular_file(ec))
+			continue;
+
+		auto const size = it->file_size(ec);
+		auto const mtime = it->last_write_time(ec).time_since_epoch().count();
+		entries.push_back(std::format("{}\t{}\t{}", it->path().generic_string(), size, mtime));
+	}
+
+	std::ranges::sort(entries);
+	std::uint64_t hash = 0;
+	for (std::string const& entry : entries)
+		hash = hash_bytes(entry, hash);
+	return hash;
+}
+
+// Run the commands of a request. Builds of an unchanged tree are answered without building.
+static bool run_request(daemon_state& state, std::span<std::string const> args, bool (*run_arg)(context&, std::string_view)) {
+	context ctx = state.base;
+	ctx.set_scan_cache(&state.scans);
+
+	for (std::string_view const arg : args) {
+		if (command_name(arg) != "build") {
+			if (!run_arg(ctx, arg))
+				return false;
+			continue;
+		}
+
+		state.apply_changes();
+
+		std::string const key = std::format("{}\n{}\n{}", ctx.get_selected_compiler().name_and_version, ctx.get_config(), arg);
+		bool const up_to_date = state.last_build && state.last_build->key == key && state.last_build->generation == state.generation
+			&& state.last_build->outputs == hash_outputs(ctx.output_dir());
+		if (up_to_date) {
+			std::println("<gbs> Up to date");
+			for (fs::path const& test : state.last_build->unittests)
+				ctx.add_unittest(test);
+			continue;
+		}
+
+		std::uint64_t const generation = state.generation;
+		state.last_build.reset();
+		if (!run_arg(ctx, arg))
+			return false;
+		state.last_build = daemon_state::build_record{ key, generation, hash_outputs(ctx.output_dir()), ctx.get_unittests() };
+	}
+
+	return true;
+}
+
+// Read a request and answer it
+static void serve_client(tcp_socket socket, daemon_state& state, std::string_view const token, bool (*run_arg)(context&, std::string_view)) {
+	socket.set_timeout(std::chrono::seconds{ 10 });
+
+	auto const header = socket.read_line();
+	auto const token_line = socket.read_line();
+	if (!header || *header != protocol_header || !token_line || *token_line != std::format("token {}", token))
+		return;
+
+	std::vector<std::string> args;
+	std::vector<std::pair<std::string, std::string>> env;
+	for (;;) {
+		auto line = socket.read_line();
+		if (!line)
+			return;
+		if (*line == "end")
+			break;
+
+		if (line->starts_with("arg ")) {
+			args.push_back(line->substr(4));
+		}
+		else if (auto const eq = line->find('='); line->starts_with("env ") && eq != std::string::npos) {
+			env.emplace_back(line->substr(4, eq - 4), line->substr(eq + 1));
+		}
+		else {
+			return;
+		}
+	}
+
+	// Builds would not see the environment of the client
+	for (std::string_view const name : build_environment) {
+		auto const it = std::ranges::find(env, name, &std::pair<std::string, std::string>::first);
+		auto const client_value = it != env.end() ? std::optional<std::string_view>{ it->second } : std::nullopt;
+		if (client_value != get_env(name)) {
+			socket.send_all(std::format("env {}\n", name));
+			return;
+		}
+	}
+
+	if (!socket.send_all("ok\n"))
+		return;
+
+	socket.set_timeout(std::chrono::milliseconds{ 0 });
+	bool succeeded = false;
+	{
+		output_redirect const redirect(socket);
+		succeeded = run_request(state, args, run_arg);
+	}
+	socket.send_all(std::format("exit {}\n", succeeded ? 0 : 1));
+}
+
+// Keep the compilers, source scans and the state of the tree in memory, and run the builds of clients
+// in the current directory. Never returns unless it fails to start.
+export bool run_daemon(context& ctx, bool (*run_arg)(context&, std::string_view)) {
+	if (!ctx.is_compiler_selected())
+		ctx.select_first_compiler();
+
+	tcp_listener listener(0, true);
+	if (!listener.is_open()) {
+		std::println(std::cerr, "<gbs> Error: daemon could not listen on a local port");
+		return false;
+	}
+
+	// The token keeps clients from talking to an unrelated program that got the port of a dead daemon
+	std::random_device rd;
+	std::string const token = hash_to_string((std::uint64_t{ rd() } << 32) | rd());
+
+	fs::path const file = daemon_file(ctx);
+	std::error_code ec;
+	fs::create_directories(file.parent_path(), ec);
+	{
+		std::ofstream out(file);
+		out << listener.port() << ' ' << token << '\n';
+		if (!out) {
+			std::println(std::cerr, "<gbs> Error: could not write '{}'", file.generic_string());
+			return false;
+		}
+	}
+
+	daemon_state state(ctx);
+	std::println("<gbs> Daemon serving '{}' on port {}", fs::current_path().generic_string(), listener.port());
+
+	// Requests are served one at a time, in the order they arrive
+	for (;;) {
+		tcp_socket socket = listener.accept();
+		if (socket.is_open())
+			serve_client(std::move(socket), state, token, run_arg);
+	}
+}
+
+// Send the commands to the daemon of the current directory, if one is running and can run all of them.
+// Returns the exit code, or nothing if the commands have to run here.
+export std::optional<int> forward_to_daemon(context const& ctx, std::span<std::string_view const> args) {
+	if (!std::ranges::all_of(args, [](std::string_view const arg) { return std::ranges::contains(daemon_commands, command_name(arg)); }))
+		return std::nullopt;
+
+	fs::path const file = daemon_file(ctx);
+	std::uint16_t port = 0;
+	std::string token;
+	{
+		std::ifstream in(file);
+		if (!(in >> port >> token))
+			return std::nullopt;
+	}
+
+	tcp_socket socket = connect_tcp("127.0.0.1", port);
+	if (socket.is_open()) {
+		socket.set_timeout(std::chrono::seconds{ 10 });
+
+		std::string request = std::format("{}\ntoken {}\n", protocol_header, token);
+		for (std::string_view const name : build_environment) {
+			auto const value = get_env(name);
+			if (value && value->contains('\n'))
+				return std::nullopt;
+			if (value)
+				request += std::format("env {}={}\n", name, *value);
+		}
+		for (std::string_view const arg : args)
+			request += std::format("arg {}\n", arg);
+		request += "end\n";
+
+		auto const answer = socket.send_all(request) ? socket.read_line() : std::nullopt;
+		if (answer && answer->starts_with("env ")) {
+			std::println("<gbs> The daemon has another {}, running here instead", answer->substr(4));
+			return std::nullopt;
+		}
+
+		if (answer == "ok")
+			socket.set_timeout(std::chrono::milliseconds{ 0 });
+		else
+			socket.close();
+	}
+
+	// The daemon is gone
+	if (!socket.is_open()) {
+		std::error_code ec;
+		fs::remove(file, ec);
+		return std::nullopt;
+	}
+
+	for (;;) {
+		auto const line = socket.read_line();
+		if (!line)
+			break;
+
+		std::string_view const sv = *line;
+		if (sv.starts_with("out ")) {
+			std::size_t size = 0;
+			std::from_chars(sv.data() + 4, sv.data() + sv.size(), size);
+			auto const data = socket.read_exact(size);
+			if (!data)
+				break;
+			std::fwrite(data->data(), 1, data->size(), stdout);
+			std::fflush(stdout);
+		}
+		else if (sv.starts_with("exit ")) {
+			int code = 1;
+			std::from_chars(sv.data() + 5, sv.data() + sv.size(), code);
+			return code;
+		}
+		else {
+			break;
+		}
+	}
+
+	std::println(std::cerr, "<gbs> Error: lost connection to the daemon");
+	return 1;
+}
@@ -7,7 +7,7 @@ import context;
 export bool cmd_enum_cl(context& ctx, std::string_view /*args*/) {
 	std::println("<gbs> Enumerating compilers:");
 
-	ctx.fill_compiler_collection();
+	ctx.fill_compiler_collection(true);
 
 	//[[gsl::suppress("gsl.view")]]
 	for (auto const& [name, compilers] : ctx.get_compiler_collection()) {
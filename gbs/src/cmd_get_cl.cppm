@@ -38,6 +38,7 @@ std::string clang_get_download_url(std::string_view const version) {
 export bool cmd_get_cl(context& ctx, std::string_view args) {
 	std::println("<gbs> '{}' - Searching remotely for newest version...", args);
 
+	ctx.fill_compiler_family(args.substr(0, args.find(':')));
 	if (ctx.set_compiler(args)) {
 		return true;
 	}
@@ -198,7 +199,7 @@ export bool cmd_get_cl(context& ctx, std::string_view args) {
 	}
 
 	// Refill compiler collection
-	ctx.fill_compiler_collection();
+	ctx.fill_compiler_family(cl.name, true);
 	ctx.set_compiler(args);
 
 	std::println("<gbs> Download successful");
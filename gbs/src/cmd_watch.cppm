@@ -0,0 +1,110 @@
+module;
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iterator>
+#include <print>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+export module cmd_watch;
+import context;
+import cmd_build;
+import cmd_unittest;
+import dep_scan;
+import file_watch;
+
+namespace fs = std::filesystem;
+
+// How long the tree has to be quiet before a burst of changes is built
+constexpr std::chrono::milliseconds quiet_period{ 200 };
+
+// Only changes to files in these directories are built
+static bool is_source_change(fs::path const& path) {
+	if (path == fs::path{ "." })
+		return true;
+
+	return std::ranges::any_of(path, [](fs::path const& part) {
+		return part == "src" || part == "lib" || part == "unittest";
+	});
+}
+
+// Build, then run the unittests whose executables were linked by the build
+static void build_and_test(context& ctx, std::string_view args) {
+	std::unordered_map<fs::path, fs::file_time_type> previous;
+	for (fs::path const& test : ctx.get_unittests()) {
+		std::error_code ec;
+		previous[test] = fs::last_write_time(test, ec);
+	}
+
+	ctx.clear_unittests();
+	if (!cmd_build(ctx, args))
+		return;
+
+	std::vector<fs::path> const all_tests = ctx.get_unittests();
+	std::vector<fs::path> affected;
+	for (fs::path const& test : all_tests) {
+		std::error_code ec;
+		auto const it = previous.find(test);
+		if (it == previous.end() || it->second != fs::last_write_time(test, ec))
+			affected.push_back(test);
+	}
+
+	if (!affected.empty()) {
+		ctx.clear_unittests();
+		for (fs::path const& test : affected)
+			ctx.add_unittest(test);
+		cmd_unittest(ctx, {});
+
+		ctx.clear_unittests();
+		for (fs::path const& test : all_tests)
+			ctx.add_unittest(test);
+	}
+}
+
+// Build and test, then rebuild and retest whenever a source file changes. Never returns.
+export bool cmd_watch(context& ctx, std::string_view args) {
+	if (!ctx.is_compiler_selected())
+		ctx.select_first_compiler();
+
+	// Source scans are kept between builds, and only redone for changed files
+	scan_cache scans;
+	ctx.set_scan_cache(&scans);
+
+	// Start watching before the first build, so changes made while it runs are not missed
+	file_watcher watcher(".", { ctx.get_gbs_out(), ".git" });
+	build_and_test(ctx, args);
+
+	for (;;) {
+		std::println("<gbs> Watching for changes...");
+
+		std::vector<fs::path> changed;
+		while (changed.empty()) {
+			for (fs::path const& path : watcher.wait_for_changes(std::chrono::hours{ 1 }))
+				if (is_source_change(path))
+					changed.push_back(path);
+		}
+
+		// Editors often save several files at once, so wait for the changes to settle
+		for (;;) {
+			auto const more = watcher.wait_for_changes(quiet_period);
+			if (more.empty())
+				break;
+			std::ranges::copy_if(more, std::back_inserter(changed), is_source_change);
+		}
+
+		std::ranges::sort(changed);
+		auto const dupes = std::ranges::unique(changed);
+		changed.erase(dupes.begin(), dupes.end());
+
+		for (fs::path const& path : changed) {
+			if (path == fs::path{ "." })
+				scans.clear();
+			else
+				scans.invalidate(path);
+		}
+
+		std::println("<gbs> {} file(s) changed, rebuilding...", changed.size());
+		build_and_test(ctx, args);
+	}
+}
@@ -0,0 +1,62 @@
+module;
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <iostream>
+#include <print>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+export module cmd_worker;
+import context;
+import executor;
+import process;
+
+// Port used by 'worker' when none is given
+constexpr std::uint16_t default_worker_port = 9900;
+
+// Run compiles sent by other builds, eg. 'worker', 'worker=9901', 'worker=9901,16' or 'worker=0.0.0.0:9901'.
+// Builds use it with 'build=worker=host:9901'. Runs until the process is stopped.
+export bool cmd_worker(context& ctx, std::string_view args) {
+	std::string_view const address_arg = args.substr(0, args.find(','));
+	std::string_view const jobs_arg = address_arg.size() < args.size() ? args.substr(address_arg.size() + 1) : std::string_view{};
+
+	// Only the local machine can connect unless an address is given
+	std::string_view port_arg = address_arg;
+	std::string address;
+	if (auto const colon = address_arg.rfind(':'); colon != std::string_view::npos) {
+		address = address_arg.substr(0, colon);
+		port_arg = address_arg.substr(colon + 1);
+	}
+
+	std::uint16_t port = default_worker_port;
+	if (!port_arg.empty()) {
+		auto const [ptr, ec] = std::from_chars(port_arg.data(), port_arg.data() + port_arg.size(), port);
+		if (ec != std::errc{} || ptr != port_arg.data() + port_arg.size()) {
+			std::println(std::cerr, "<gbs> Error: invalid worker port '{}'", port_arg);
+			return false;
+		}
+	}
+
+	std::size_t jobs = std::max(1u, std::thread::hardware_concurrency());
+	if (!jobs_arg.empty()) {
+		auto const [ptr, ec] = std::from_chars(jobs_arg.data(), jobs_arg.data() + jobs_arg.size(), jobs);
+		if (ec != std::errc{} || ptr != jobs_arg.data() + jobs_arg.size() || jobs == 0) {
+			std::println(std::cerr, "<gbs> Error: invalid worker job count '{}'", jobs_arg);
+			return false;
+		}
+	}
+
+	// Only the selected compiler is run. Compilers in WSL are run through 'wsl -d <distro>'.
+	if (!ctx.is_compiler_selected())
+		ctx.select_first_compiler();
+	auto const& cl = ctx.get_selected_compiler();
+	std::vector<std::string> compiler_cmd;
+	if (cl.wsl)
+		compiler_cmd = split_command_line(cl.executable.generic_string());
+	else if (!cl.executable.empty())
+		compiler_cmd.push_back(cl.executable.generic_string());
+
+	return run_worker(ctx.get_home_dir(), address, port, jobs, std::move(compiler_cmd));
+}
@@ -18,6 +18,28 @@ export struct compiler {
 	std::string_view define;
 	std::string_view include;
 	std::string_view module_path;
+	std::string_view depfile;
+	std::string_view bmi_file;
+
+	// Writes the module dependencies of a file in the P1689 format, to stdout or to a file.
+	// {0} is the compile command, writing to a scratch file, {1} the object file, {2} the dependency file, {3} the scanner.
+	std::string_view scan_command;
+
+	// Builds a module in two steps: the interface only, then the object from the interface. Empty if not supported.
+	// {0} is the source or interface, {1} the interface or object.
+	std::string_view precompile_module;
+	std::string_view build_bmi_object;
+
+	// Precompiled headers. Empty if not supported.
+	// {0} is the header, {1} the precompiled header, which is named by 'pch_file' from the header.
+	std::string_view build_pch;
+	std::string_view pch_file;
+	std::string_view use_pch;
+
+	// Header units. Empty if not supported.
+	// {0} is the header as named in the import, {1} the interface, {2} 'user' or 'system'.
+	std::string_view build_header_unit;
+	std::string_view use_header_unit;
 
 	std::filesystem::path dir;
 	std::filesystem::path executable;
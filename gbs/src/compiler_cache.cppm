@@ -0,0 +1,239 @@
+module;
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+export module compiler_cache;
+import compiler;
+import env;
+import enumerate_compilers_clang;
+import enumerate_compilers_gcc;
+import enumerate_compilers_msvc;
+import process;
+
+namespace fs = std::filesystem;
+
+// Version of the on-disk format. Caches with a different header are discarded.
+constexpr std::string_view cache_header = "gbs.compilers 3";
+
+// The compiler families that have been searched for, and the compilers found
+struct cache_contents {
+	std::vector<std::string> families;
+	std::vector<compiler> compilers;
+};
+
+static fs::path cache_path(environment const& env) {
+	return env.get_home_dir() / ".gbs" / "compilers.cache";
+}
+
+static std::string_view get_path_var(environment const& env) {
+	return env.get("PATH").value_or(env.get("Path").value_or(""));
+}
+
+// Find an executable in the directories of PATH. Returns the name if it is not found.
+static fs::path find_in_path(environment const& env, fs::path const& name) {
+#ifdef _WIN32
+	constexpr char separator = ';';
+	fs::path const file = fs::path{ name }.replace_extension(".exe");
+#else
+	constexpr char separator = ':';
+	fs::path const file = name;
+#endif
+
+	for (auto const dir : get_path_var(env) | std::views::split(separator)) {
+		std::error_code ec;
+		fs::path const candidate = fs::path{ std::string_view{ dir.begin(), dir.end() } } / file;
+		if (!candidate.parent_path().empty() && fs::is_regular_file(candidate, ec))
+			return candidate;
+	}
+	return name;
+}
+
+// The size and timestamp of a file or directory, or zeros if it doesn't exist
+static std::string get_stamp(fs::path const& path) {
+	std::error_code ec;
+	auto const mtime = fs::last_write_time(path, ec);
+	if (ec)
+		return "0\t0";
+
+	std::uintmax_t const size = fs::is_regular_file(path, ec) ? fs::file_size(path, ec) : 0;
+	return std::format("{}\t{}", ec ? 0 : size, mtime.time_since_epoch().count());
+}
+
+// The files and directories that change when compilers are installed, updated or removed
+static std::vector<fs::path> get_stamped_paths(environment const& env, std::span<compiler const> compilers) {
+	std::vector<fs::path> paths{
+		env.get_home_dir() / ".gbs" / "clang",
+		env.get_home_dir() / ".gbs" / "gcc",
+		find_in_path(env, "clang"),
+	};
+
+	for (compiler const& comp : compilers) {
+		// Compilers in WSL can't be checked without starting WSL
+		if (comp.wsl)
+			continue;
+
+		// New versions are installed next to the existing ones
+		paths.push_back(comp.dir.parent_path());
+		paths.push_back(comp.executable.has_parent_path() ? comp.executable : find_in_path(env, comp.executable));
+	}
+
+	std::ranges::sort(paths);
+	auto const dupes = std::ranges::unique(paths);
+	paths.erase(dupes.begin(), dupes.end());
+	return paths;
+}
+
+static std::vector<std::string_view> split_fields(std::string_view const line) {
+	std::vector<std::string_view> fields;
+	for (auto const field : line | std::views::split('\t'))
+		fields.emplace_back(field.begin(), field.end());
+	return fields;
+}
+
+// Read the cache. Returns nothing if there is no cache, if it is incomplete, or if PATH or any of the compilers have
+// changed since it was written.
+static std::optional<cache_contents> read_cache(environment const& env) {
+	std::ifstream in(cache_path(env), std::ios::binary);
+	if (!in)
+		return std::nullopt;
+
+	std::string line;
+	if (!std::getline(in, line) || line != cache_header)
+		return std::nullopt;
+	if (!std::getline(in, line) || line != std::format("path\t{}", get_path_var(env)))
+		return std::nullopt;
+
+	cache_contents contents;
+	std::vector<compiler>& compilers = contents.compilers;
+	while (std::getline(in, line)) {
+		auto const fields = split_fields(line);
+		if (fields.empty())
+			return std::nullopt;
+
+		// The last line, so a cache cut short by a crash or a full disk is never used
+		if (fields[0] == "end" && fields.size() == 1)
+			return contents;
+
+		if (fields[0] == "stamp" && fields.size() == 4) {
+			if (get_stamp(fields[3]) != std::format("{}\t{}", fields[1], fields[2]))
+				return std::nullopt;
+		}
+		else if (fields[0] == "family" && fields.size() == 2) {
+			contents.families.emplace_back(fields[1]);
+		}
+		else if (fields[0] == "compiler" && fields.size() == 6) {
+			compiler& comp = compilers.emplace_back();
+			if (fields[1] == "clang")
+				init_clang_commands(comp);
+			else if (fields[1] == "gcc")
+				init_gcc_commands(comp);
+			else if (fields[1] == "msvc")
+				init_msvc_commands(comp);
+			else
+				return std::nullopt;
+
+			std::from_chars(fields[2].data(), fields[2].data() + fields[2].size(), comp.major);
+			std::from_chars(fields[3].data(), fields[3].data() + fields[3].size(), comp.minor);
+			std::from_chars(fields[4].data(), fields[4].data() + fields[4].size(), comp.patch);
+			comp.name_and_version = fields[5];
+		}
+		else if (fields.size() == 2 && !compilers.empty()) {
+			compiler& comp = compilers.back();
+			if (fields[0] == "dir")
+				comp.dir = fields[1];
+			else if (fields[0] == "executable")
+				comp.executable = fields[1];
+			else if (fields[0] == "linker")
+				comp.linker = fields[1];
+			else if (fields[0] == "slib")
+				comp.slib = fields[1];
+			else if (fields[0] == "dlib")
+				comp.dlib = fields[1];
+			else if (fields[0] == "std_module")
+				comp.std_module = fields[1];
+			else if (fields[0] == "wsl")
+				comp.wsl = std::string{ fields[1] };
+			else
+				return std::nullopt;
+		}
+		else {
+			return std::nullopt;
+		}
+	}
+
+	return std::nullopt;
+}
+
+// Load the compilers of a family found by an earlier enumeration. Returns nothing if the family hasn't been
+// searched for, or if the cache is out of date.
+export std::optional<std::vector<compiler>> load_compiler_cache(environment const& env, std::string_view const family) {
+	auto contents = read_cache(env);
+	if (!contents || !std::ranges::contains(contents->families, family))
+		return std::nullopt;
+
+	std::vector<compiler> compilers;
+	for (compiler& comp : contents->compilers) {
+		if (comp.name == family)
+			compilers.push_back(std::move(comp));
+	}
+	return compilers;
+}
+
+// Save the compilers found by an enumeration of some families, along with the state of the files that tell when
+// it is out of date. Compilers of other families already in the cache are kept.
+export void save_compiler_cache(environment const& env, std::span<std::string_view const> families, std::span<compiler const> found) {
+	cache_contents contents = read_cache(env).value_or(cache_contents{});
+	std::erase_if(contents.families, [&](std::string const& family) { return std::ranges::contains(families, family); });
+	std::erase_if(contents.compilers, [&](compiler const& comp) { return std::ranges::contains(families, comp.name); });
+	contents.families.insert(contents.families.end(), families.begin(), families.end());
+	contents.compilers.insert(contents.compilers.end(), found.begin(), found.end());
+	std::vector<compiler> const& compilers = contents.compilers;
+
+	fs::path const path = cache_path(env);
+	std::error_code ec;
+	fs::create_directories(path.parent_path(), ec);
+
+	// Other gbs processes may be saving at the same time, so each writes its own temp file
+	fs::path const tmp_path = unique_temp_path(path);
+	bool written = false;
+	{
+		std::ofstream out(tmp_path, std::ios::binary);
+		out << cache_header << '\n';
+		out << "path\t" << get_path_var(env) << '\n';
+		for (std::string const& family : contents.families)
+			out << "family\t" << family << '\n';
+		for (fs::path const& stamped : get_stamped_paths(env, compilers))
+			out << "stamp\t" << get_stamp(stamped) << '\t' << stamped.generic_string() << '\n';
+
+		for (compiler const& comp : compilers) {
+			out << "compiler\t" << comp.name << '\t' << comp.major << '\t' << comp.minor << '\t' << comp.patch << '\t' << comp.name_and_version << '\n';
+			out << "dir\t" << comp.dir.generic_string() << '\n';
+			out << "executable\t" << comp.executable.generic_string() << '\n';
+			out << "linker\t" << comp.linker.generic_string() << '\n';
+			out << "slib\t" << comp.slib.generic_string() << '\n';
+			out << "dlib\t" << comp.dlib.generic_string() << '\n';
+			if (comp.std_module)
+				out << "std_module\t" << comp.std_module->generic_string() << '\n';
+			if (comp.wsl)
+				out << "wsl\t" << *comp.wsl << '\n';
+		}
+
+		out << "end\n";
+		written = static_cast<bool>(out);
+	}
+
+	if (written)
+		fs::rename(tmp_path, path, ec);
+	if (!written || ec)
+		fs::remove(tmp_path, ec);
+}
@@ -7,13 +7,23 @@ module;
 #include <fstream>
 #include <set>
 #include <ranges>
+#include <algorithm>
+#include <optional>
+#include <span>
 export module context;
 import env;
 import compiler;
 import enumerate_compilers;
+import compiler_cache;
 import os;
 import task;
 import task_graph;
+import dep_scan;
+
+// Sources that are compiled as module interfaces
+static bool is_module_file(std::string_view const file) {
+	return file.ends_with(".cppm") || file.ends_with(".ixx") || file.ends_with(".cc");
+}
 
 export class context {
 	using compiler_collection = std::unordered_map<std::string_view, std::vector<compiler>>;
@@ -32,6 +42,9 @@ export class context {
 	// All available compilers
 	compiler_collection all_compilers{};
 
+	// The compiler families that have been searched for
+	std::set<std::string_view> searched_families{};
+
 	// The currently selected compiler
 	compiler selected_cl;
 
@@ -50,6 +63,9 @@ export class context {
 	// Environment variables
 	environment env;
 
+	// Source scans kept between builds. Only set in the daemon.
+	scan_cache* scans = nullptr;
+
 public:
 	explicit context(char const** envp) : env(envp) {
 		// Default response files
@@ -169,6 +185,14 @@ public:
 		return target_os;
 	}
 
+	void set_scan_cache(scan_cache* cache) noexcept {
+		scans = cache;
+	}
+
+	[[nodiscard]] scan_cache* get_scan_cache() const noexcept {
+		return scans;
+	}
+
 	// Get an environment variable
 	[[nodiscard]] std::optional<std::string_view> get_env_value(const std::string_view var) const {
 		return env.get(var);
@@ -245,10 +269,16 @@ public:
 			return {};
 	}
 
-	// Selects the first compiler in the list
-	void select_first_compiler() noexcept {
-		if (!all_compilers.empty())
-			selected_cl = all_compilers.begin()->second.front();
+	// Selects the newest compiler of the first family, in the order of 'compiler_families', that is installed.
+	// Families are only searched for until a compiler is found.
+	void select_first_compiler() {
+		for (std::string_view const family : compiler_families) {
+			fill_compiler_family(family);
+			if (auto const it = all_compilers.find(family); it != all_compilers.end() && !it->second.empty()) {
+				selected_cl = it->second.front();
+				return;
+			}
+		}
 	}
 
 	[[nodiscard]] bool is_compiler_selected() const noexcept {
@@ -281,7 +311,7 @@ public:
 
 	// Create build args for a single file
 	[[nodiscard]] std::string build_command(std::string_view file, std::filesystem::path const& obj_file) const {
-		std::string_view const build_cmd = (file.ends_with(".cppm") || file.ends_with(".ixx") || file.ends_with(".cc"))
+		std::string_view const build_cmd = is_module_file(file)
 			? selected_cl.build_module
 			: selected_cl.build_source;
 
@@ -289,6 +319,67 @@ public:
 		return std::vformat(build_cmd, std::make_format_args(file, str));
 	}
 
+	// Create build args that only write the interface of a module. Returns nothing if the compiler can't build
+	// modules in two steps.
+	[[nodiscard]] std::optional<std::string> precompile_command(std::string_view file, std::filesystem::path const& bmi_file) const {
+		if (selected_cl.precompile_module.empty() || !is_module_file(file))
+			return std::nullopt;
+
+		auto const str = bmi_file.generic_string();
+		return std::vformat(selected_cl.precompile_module, std::make_format_args(file, str));
+	}
+
+	// Get the precompiled header the compiler writes for a header
+	[[nodiscard]] std::filesystem::path pch_path(std::filesystem::path const& header) const {
+		auto const str = header.generic_string();
+		return std::vformat(selected_cl.pch_file, std::make_format_args(str));
+	}
+
+	// Create build args that precompile a header. Returns nothing if the compiler has no precompiled headers.
+	[[nodiscard]] std::optional<std::string> pch_command(std::filesystem::path const& header, std::filesystem::path const& pch_file) const {
+		if (selected_cl.build_pch.empty())
+			return std::nullopt;
+
+		auto const hdr = header.generic_string();
+		auto const pch = pch_file.generic_string();
+		return std::vformat(selected_cl.build_pch, std::make_format_args(hdr, pch));
+	}
+
+	// Create the args that make a file use a precompiled header. Module units and C files can't use it.
+	[[nodiscard]] std::string use_pch_command(std::string_view file, std::filesystem::path const& header, std::filesystem::path const& pch_file) const {
+		if (selected_cl.use_pch.empty() || is_module_file(file) || file.ends_with(".c"))
+			return std::string{};
+
+		auto const hdr = header.generic_string();
+		auto const pch = pch_file.generic_string();
+		return std::vformat(selected_cl.use_pch, std::make_format_args(hdr, pch));
+	}
+
+	// Create build args that compile a header to a header unit. The name is as written in the import,
+	// eg. '<vector>' or '"foo.h"'. Returns nothing if the compiler can't build header units.
+	[[nodiscard]] std::optional<std::string> header_unit_command(std::string_view const name, std::filesystem::path const& bmi_file) const {
+		if (selected_cl.build_header_unit.empty() || name.size() < 2)
+			return std::nullopt;
+
+		std::string_view const header = name.substr(1, name.size() - 2);
+		std::string_view const kind = name.starts_with('<') ? "system" : "user";
+		auto const bmi = bmi_file.generic_string();
+		return std::vformat(selected_cl.build_header_unit, std::make_format_args(header, bmi, kind));
+	}
+
+	// Create the args that make a header unit available to an importer
+	[[nodiscard]] std::string use_header_unit_command(std::string_view const name, std::filesystem::path const& bmi_file) const {
+		auto const bmi = bmi_file.generic_string();
+		return std::vformat(selected_cl.use_header_unit, std::make_format_args(name, bmi));
+	}
+
+	// Create build args that compile the interface written by 'precompile_command' to an object
+	[[nodiscard]] std::string bmi_object_command(std::filesystem::path const& bmi_file, std::filesystem::path const& obj_file) const {
+		auto const bmi = bmi_file.generic_string();
+		auto const obj = obj_file.generic_string();
+		return std::vformat(selected_cl.build_bmi_object, std::make_format_args(bmi, obj));
+	}
+
 	// Create link command for the currently selected compiler
 	[[nodiscard]] std::string link_command(std::string_view exe_name, std::string_view const out_dir) const {
 		auto const linker = selected_cl.linker.generic_string();
@@ -316,15 +407,95 @@ public:
 		return std::string{};
 	}
 
+	// Create the argument that makes the compiler write a dependency file
+	[[nodiscard]] std::string build_depfile(std::filesystem::path const& depfile) const {
+		if (selected_cl.depfile.empty())
+			return std::string{};
+		auto const str = depfile.generic_string();
+		return std::vformat(selected_cl.depfile, std::make_format_args(str));
+	}
+
+	// Get the module interface file the compiler writes for a module.
+	// Partitions use '-' in place of ':', eg. 'mod:part' -> 'mod-part'.
+	[[nodiscard]] std::optional<std::filesystem::path> bmi_path(std::filesystem::path const& obj_file, std::string_view const module_name) const {
+		if (selected_cl.bmi_file.empty() || module_name.empty())
+			return std::nullopt;
+
+		auto const out = obj_file.parent_path().generic_string();
+		auto const stem = obj_file.stem().generic_string();
+		std::string name{ module_name };
+		std::replace(name.begin(), name.end(), ':', '-');
+		return std::vformat(selected_cl.bmi_file, std::make_format_args(out, stem, name));
+	}
+
+	// Create a command that scans a file for module dependencies, from the command that compiles it.
+	// The dependencies are written in the P1689 format to 'dep_file', or to stdout if the scanner doesn't write files.
+	[[nodiscard]] std::optional<std::string> scan_command(std::string_view const compile_cmd, std::filesystem::path const& obj_file, std::filesystem::path const& dep_file) const {
+		if (selected_cl.scan_command.empty())
+			return std::nullopt;
+
+		// clang has a separate scanner next to the compiler, eg. 'clang++-18' -> 'clang-scan-deps-18'
+		std::string scanner = selected_cl.executable.generic_string();
+		if (selected_cl.name == "clang") {
+			if (auto const pos = scanner.rfind("clang"); pos != std::string::npos) {
+				std::string_view suffix = std::string_view{ scanner }.substr(pos + 5);
+				if (suffix.starts_with("++"))
+					suffix.remove_prefix(2);
+				scanner = scanner.substr(0, pos) + "clang-scan-deps" + std::string{ suffix };
+			}
+		}
+
+		auto const obj = obj_file.generic_string();
+		auto const dep = dep_file.generic_string();
+		return std::vformat(selected_cl.scan_command, std::make_format_args(compile_cmd, obj, dep, scanner));
+	}
+
 	[[nodiscard]] std::string build_define(std::string_view const def) const {
 		return std::format(" {}{}", selected_cl.define, def);
 	}
 
-	void fill_compiler_collection() {
-		all_compilers.clear();
-		enumerate_compilers(env, [&](compiler&& c) {
-			all_compilers[c.name].push_back(std::forward<compiler>(c));
-			});
+	// Find the installed compilers of all families. The result of the last search is reused unless 'refresh' is set,
+	// or the compilers or PATH have changed since.
+	void fill_compiler_collection(bool const refresh = false) {
+		fill_compiler_families(compiler_families, refresh);
+	}
+
+	// Find the installed compilers of one family, eg. 'clang', unless it has been searched for already
+	void fill_compiler_family(std::string_view const family, bool const refresh = false) {
+		auto const known = std::ranges::find(compiler_families, family);
+		if (known == compiler_families.end() || (!refresh && searched_families.contains(family)))
+			return;
+
+		fill_compiler_families(std::span{ known, 1 }, refresh);
+	}
+
+	void fill_compiler_families(std::span<std::string_view const> const families, bool const refresh) {
+		// Families that are not in the cache are enumerated together
+		std::vector<std::string_view> missing;
+		for (std::string_view const family : families) {
+			all_compilers.erase(family);
+			searched_families.insert(family);
+
+			auto cached = refresh ? std::nullopt : load_compiler_cache(env, family);
+			if (!cached) {
+				missing.push_back(family);
+				continue;
+			}
+
+			for (compiler& c : *cached)
+				all_compilers[c.name].push_back(std::move(c));
+		}
+
+		if (!missing.empty()) {
+			std::vector<compiler> found;
+			enumerate_compilers(env, missing, [&](compiler&& c) {
+				found.push_back(std::forward<compiler>(c));
+				});
+			save_compiler_cache(env, missing, found);
+
+			for (compiler& c : found)
+				all_compilers[c.name].push_back(std::move(c));
+		}
 
 		// Sort compilers from the highest version to lowest
 		for (auto& [name, compilers] : all_compilers) {
@@ -0,0 +1,118 @@
+module;
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+export module dep_file;
+import json;
+
+namespace fs = std::filesystem;
+
+// Parse a make-style depfile, as written by clang/gcc '-MD'.
+// Targets are dropped, prerequisites are returned. Handles line continuations and escaped spaces.
+static std::vector<fs::path> parse_make_depfile(std::string_view const text) {
+	std::vector<fs::path> deps;
+	std::string token;
+	bool after_colon = false;
+
+	auto const flush = [&] {
+		if (!token.empty()) {
+			if (after_colon && token != "|")
+				deps.emplace_back(token);
+			token.clear();
+		}
+	};
+
+	for (std::size_t i = 0; i < text.size(); ++i) {
+		char const c = text[i];
+		char const next = (i + 1 < text.size()) ? text[i + 1] : '\0';
+
+		if (c == '\\') {
+			if (next == '\n') {
+				// Line continuation
+				flush();
+				i += 1;
+				continue;
+			}
+			if (next == '\r' && i + 2 < text.size() && text[i + 2] == '\n') {
+				flush();
+				i += 2;
+				continue;
+			}
+			if (next == ' ' || next == '#') {
+				// Escaped character
+				token += next;
+				i += 1;
+				continue;
+			}
+			token += c;
+		}
+		else if (c == '$' && next == '$') {
+			token += '$';
+			i += 1;
+		}
+		else if (c == ' ' || c == '\t' || c == '\r') {
+			flush();
+		}
+		else if (c == '\n') {
+			flush();
+			after_colon = false;
+		}
+		else if (c == ':' && !after_colon && (next == '\0' || next == ' ' || next == '\t' || next == '\r' || next == '\n')) {
+			// End of the targets. Drop them.
+			token.clear();
+			after_colon = true;
+		}
+		else {
+			token += c;
+		}
+	}
+	flush();
+
+	return deps;
+}
+
+// Parse a json dependency file, as written by msvc '/sourceDependencies'
+static std::vector<fs::path> parse_json_depfile(std::string_view const text) {
+	std::vector<fs::path> deps;
+
+	auto const doc = parse_json(text);
+	if (!doc)
+		return deps;
+
+	json_value const* const data = doc->find("Data");
+	if (data == nullptr)
+		return deps;
+
+	if (json_value const* const includes = data->find("Includes"); includes != nullptr && includes->is_array()) {
+		for (json_value const& include : includes->values) {
+			if (include.is_string())
+				deps.emplace_back(include.string);
+		}
+	}
+
+	return deps;
+}
+
+// Get the path of the dependency file generated alongside an object file
+export fs::path get_depfile_path(fs::path const& obj) {
+	return fs::path{ obj }.replace_extension("d");
+}
+
+// Read the dependencies listed in a compiler generated dependency file.
+// Returns an empty list if the file does not exist.
+export std::vector<fs::path> read_dependency_file(fs::path const& path) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		return {};
+
+	std::string const text{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+
+	auto const first = text.find_first_not_of(" \t\r\n");
+	if (first != std::string::npos && text[first] == '{')
+		return parse_json_depfile(text);
+	else
+		return parse_make_depfile(text);
+}
@@ -1,13 +1,40 @@
 module;
+#include <algorithm>
+#include <bit>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <filesystem>
 #include <set>
 #include <fstream>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define GBS_SCAN_SSE2
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define GBS_SCAN_NEON
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 export module dep_scan;
+import json;
 
 export struct source_dependency {
 	std::filesystem::path path;
-	std::string export_name{};
+	std::string export_name{}; // the module or partition the file can be imported as
 	std::set<std::string> import_names{};
 
 	bool is_export() const noexcept {
@@ -15,58 +42,484 @@ export struct source_dependency {
 	}
 };
 
+// A read-only view of a file's content. The file is memory mapped if possible, and read otherwise.
+class mapped_file {
+	char const* data = nullptr;
+	std::size_t size = 0;
+	std::string buffer;
+
+public:
+	explicit mapped_file(std::filesystem::path const& path) {
+#ifdef _WIN32
+		HANDLE const file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file != INVALID_HANDLE_VALUE) {
+			LARGE_INTEGER file_size{};
+			if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0) {
+				HANDLE const mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+				if (mapping != nullptr) {
+					data = static_cast<char const*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+					size = data ? static_cast<std::size_t>(file_size.QuadPart) : 0;
+					CloseHandle(mapping);
+				}
+			}
+			CloseHandle(file);
+		}
+#else
+		int const fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd != -1) {
+			struct stat st {};
+			if (fstat(fd, &st) == 0 && st.st_size > 0) {
+				void* const view = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+				if (view != MAP_FAILED) {
+					data = static_cast<char const*>(view);
+					size = static_cast<std::size_t>(st.st_size);
+				}
+			}
+			close(fd);
+		}
+#endif
+
+		// Files that can't be mapped, like pipes, are read instead
+		if (data == nullptr) {
+			std::ifstream in(path, std::ios::binary);
+			buffer.assign(std::istreambuf_iterator<char>(in), {});
+		}
+	}
+
+	mapped_file(mapped_file const&) = delete;
+	mapped_file& operator=(mapped_file const&) = delete;
+
+	~mapped_file() {
+		if (data == nullptr)
+			return;
+#ifdef _WIN32
+		UnmapViewOfFile(data);
+#else
+		munmap(const_cast<char*>(data), size);
+#endif
+	}
+
+	std::string_view view() const noexcept {
+		return data ? std::string_view{ data, size } : std::string_view{ buffer };
+	}
+};
+
+static bool is_blank(char const c) noexcept {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+}
+
+static bool is_identifier_char(char const c) noexcept {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || static_cast<unsigned char>(c) >= 0x80;
+}
+
+// Characters that can change what the following text means: newlines, comments, and string and character literals
+static bool is_special(char const c) noexcept {
+	return c == '\n' || c == '/' || c == '"' || c == '\'';
+}
+
+// Find the next special character, 16 bytes at a time where possible
+static char const* find_special(char const* p, char const* const end) noexcept {
+#if defined(GBS_SCAN_SSE2)
+	__m128i const newline = _mm_set1_epi8('\n');
+	__m128i const slash = _mm_set1_epi8('/');
+	__m128i const quote = _mm_set1_epi8('"');
+	__m128i const apostrophe = _mm_set1_epi8('\'');
+	while (end - p >= 16) {
+		__m128i const chunk = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p));
+		__m128i const hits = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(chunk, newline), _mm_cmpeq_epi8(chunk, slash)),
+			_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, apostrophe)));
+		int const mask = _mm_movemask_epi8(hits);
+		if (mask != 0)
+			return p + std::countr_zero(static_cast<unsigned>(mask));
+		p += 16;
+	}
+#elif defined(GBS_SCAN_NEON)
+	uint8x16_t const newline = vdupq_n_u8('\n');
+	uint8x16_t const slash = vdupq_n_u8('/');
+	uint8x16_t const quote = vdupq_n_u8('"');
+	uint8x16_t const apostrophe = vdupq_n_u8('\'');
+	while (end - p >= 16) {
+		uint8x16_t const chunk = vld1q_u8(reinterpret_cast<std::uint8_t const*>(p));
+		uint8x16_t const hits = vorrq_u8(
+			vorrq_u8(vceqq_u8(chunk, newline), vceqq_u8(chunk, slash)),
+			vorrq_u8(vceqq_u8(chunk, quote), vceqq_u8(chunk, apostrophe)));
+		if (vmaxvq_u8(hits) != 0)
+			break;
+		p += 16;
+	}
+#endif
+
+	while (p != end && !is_special(*p))
+		++p;
+	return p;
+}
+
+static char const* skip_blanks(char const* p, char const* const end) noexcept {
+	while (p != end && is_blank(*p))
+		++p;
+	return p;
+}
+
+// Returns true if the newline at 'p' is escaped by a backslash, joining the lines
+static bool is_spliced(char const* const begin, char const* p) noexcept {
+	if (p != begin && p[-1] == '\r')
+		--p;
+	return p != begin && p[-1] == '\\';
+}
+
+// Skip a '//' comment. Returns the newline that ends it.
+static char const* skip_line_comment(char const* const begin, char const* p, char const* const end) noexcept {
+	for (;;) {
+		p = static_cast<char const*>(std::char_traits<char>::find(p, static_cast<std::size_t>(end - p), '\n'));
+		if (p == nullptr)
+			return end;
+		if (!is_spliced(begin, p))
+			return p;
+		++p;
+	}
+}
+
+// Skip a '/* */' comment starting at 'p'
+static char const* skip_block_comment(char const* p, char const* const end) noexcept {
+	std::string_view const rest{ p + 2, static_cast<std::size_t>(end - p - 2) };
+	auto const close = rest.find("*/");
+	return close == std::string_view::npos ? end : rest.data() + close + 2;
+}
+
+// Skip a string literal starting at the quote 'p', including raw strings like 'R"x(...)x"'
+static char const* skip_string(char const* const begin, char const* const p, char const* const end) noexcept {
+	// Look at the prefix for an 'R'
+	char const* prefix = p;
+	while (prefix != begin && is_identifier_char(prefix[-1]))
+		--prefix;
+	std::string_view const encoding{ prefix, static_cast<std::size_t>(p - prefix) };
+
+	if (encoding == "R" || encoding == "u8R" || encoding == "uR" || encoding == "UR" || encoding == "LR") {
+		std::string_view const rest{ p + 1, static_cast<std::size_t>(end - p - 1) };
+		auto const open = rest.find('(');
+		if (open == std::string_view::npos || open > 16)
+			return end;
+
+		std::string closing = ")";
+		closing += rest.substr(0, open);
+		closing += '"';
+		auto const close = rest.find(closing, open + 1);
+		return close == std::string_view::npos ? end : rest.data() + close + closing.size();
+	}
+
+	// A string can't span lines, so an unterminated one ends at the newline
+	for (char const* q = p + 1; q != end; ++q) {
+		if (*q == '\\' && q + 1 != end)
+			++q;
+		else if (*q == '"')
+			return q + 1;
+		else if (*q == '\n')
+			return q;
+	}
+	return end;
+}
+
+// Skip a character literal starting at the apostrophe 'p'. Apostrophes in numbers, like 1'000, are digit separators.
+static char const* skip_char_literal(char const* const begin, char const* const p, char const* const end) noexcept {
+	char const* token = p;
+	while (token != begin && is_identifier_char(token[-1]))
+		--token;
+	if (token != p && *token >= '0' && *token <= '9')
+		return p + 1;
+
+	for (char const* q = p + 1; q != end; ++q) {
+		if (*q == '\\' && q + 1 != end)
+			++q;
+		else if (*q == '\'')
+			return q + 1;
+		else if (*q == '\n')
+			return q;
+	}
+	return end;
+}
+
+static std::string_view read_identifier(char const*& p, char const* const end) noexcept {
+	char const* const start = p;
+	while (p != end && is_identifier_char(*p))
+		++p;
+	return { start, static_cast<std::size_t>(p - start) };
+}
+
+// Read a module name, eg. 'foo.bar' or 'foo:part'
+static std::string_view read_module_name(char const*& p, char const* const end) noexcept {
+	char const* const start = p;
+	while (p != end && (is_identifier_char(*p) || *p == '.' || *p == ':'))
+		++p;
+	return { start, static_cast<std::size_t>(p - start) };
+}
+
+// Read the name of an import: a module name, a partition like ':part', or a header like '<vector>' or '"foo.h"'
+static std::string_view read_import_name(char const*& p, char const* const end) noexcept {
+	if (p == end)
+		return {};
+
+	if (*p == '<' || *p == '"') {
+		char const close = (*p == '<') ? '>' : '"';
+		char const* q = p + 1;
+		while (q != end && *q != close && *q != '\n')
+			++q;
+		if (q == end || *q != close)
+			return {};
+
+		std::string_view const name{ p, static_cast<std::size_t>(q + 1 - p) };
+		p = q + 1;
+		return name;
+	}
+
+	return read_module_name(p, end);
+}
+
+// Module and import declarations are directives, so they start a line. Only lines are looked at, and only until
+// the end of the preamble of a module unit, since imports can't follow other declarations there.
+// Files that are not module units can import anywhere, so they are scanned to the end.
+static void scan_module_declarations(std::string_view const text, source_dependency& deps) {
+	char const* const begin = text.data();
+	char const* const end = begin + text.size();
+	char const* p = begin;
+
+	// Skip a UTF-8 byte order mark
+	if (text.starts_with("\xEF\xBB\xBF"))
+		p += 3;
+
+	enum class unit_kind { unknown, module_unit, plain };
+	unit_kind kind = unit_kind::unknown;
+
+	// The module this file belongs to, once its module declaration has been seen
+	std::string module_name;
+	bool module_declared = false;
+
+	bool at_line_start = true;
+	while (p != end) {
+		if (at_line_start) {
+			at_line_start = false;
+
+			// Block comments before a declaration count as whitespace
+			p = skip_blanks(p, end);
+			while (end - p >= 2 && p[0] == '/' && p[1] == '*')
+				p = skip_blanks(skip_block_comment(p, end), end);
+			if (p == end)
+				break;
+
+			char const first = *p;
+			if (first == 'i' || first == 'e' || first == 'm') {
+				char const* q = p;
+				std::string_view word = read_identifier(q, end);
+				bool exported = false;
+				if (word == "export") {
+					exported = true;
+					q = skip_blanks(q, end);
+					word = read_identifier(q, end);
+				}
+
+				if (word == "import") {
+					q = skip_blanks(q, end);
+					std::string_view const name = read_import_name(q, end);
+					char const* const after = skip_blanks(q, end);
+					if (!name.empty() && after != end && (*after == ';' || *after == '[')) {
+						if (kind == unit_kind::unknown)
+							kind = unit_kind::plain;
+
+						// Partitions are imported by their name in the module, eg. 'import :part;' in 'foo' imports 'foo:part'
+						if (name.front() == ':')
+							deps.import_names.emplace(module_name.substr(0, module_name.find(':')) + std::string{ name });
+						else
+							deps.import_names.emplace(name);
+						p = after;
+						continue;
+					}
+				}
+				else if (word == "module") {
+					q = skip_blanks(q, end);
+					if (q != end && *q == ';') {
+						// The global module fragment, 'module;'
+						if (kind == unit_kind::unknown)
+							kind = unit_kind::module_unit;
+						p = q;
+						continue;
+					}
+
+					if (q != end && *q == ':') {
+						// The private module fragment, 'module :private;'
+						p = q;
+						continue;
+					}
+
+					std::string_view const name = read_module_name(q, end);
+					char const* const after = skip_blanks(q, end);
+					if (!name.empty() && after != end && (*after == ';' || *after == '[')) {
+						kind = unit_kind::module_unit;
+						module_declared = true;
+						module_name = name;
+
+						// Implementation units implicitly import their module's interface. Partitions are imported by
+						// name, so implementation partitions like 'module foo:part;' produce 'foo:part' too.
+						if (exported || name.contains(':'))
+							deps.export_name = name;
+						else
+							deps.import_names.emplace(name);
+						p = after;
+						continue;
+					}
+				}
+			}
+
+			// Any other declaration ends the preamble of a module unit
+			if (first != '#' && first != '\n' && first != '/') {
+				if (kind == unit_kind::module_unit && module_declared)
+					return;
+				if (kind == unit_kind::unknown)
+					kind = unit_kind::plain;
+			}
+		}
+
+		p = find_special(p, end);
+		if (p == end)
+			break;
+
+		switch (*p) {
+		case '\n':
+			at_line_start = !is_spliced(begin, p);
+			++p;
+			break;
+
+		case '/':
+			if (end - p >= 2 && p[1] == '/')
+				p = skip_line_comment(begin, p, end);
+			else if (end - p >= 2 && p[1] == '*')
+				p = skip_block_comment(p, end);
+			else
+				++p;
+			break;
+
+		case '"':
+			p = skip_string(begin, p, end);
+			break;
+
+		default:
+			p = skip_char_literal(begin, p, end);
+			break;
+		}
+	}
+}
+
 // Returns a source files module dependencies.
 export auto extract_module_dependencies(std::filesystem::path path) -> source_dependency {
 	source_dependency dependencies{ path };
 
-	std::string line;
-	auto file = std::ifstream(path);
-	while (std::getline(file, line)) {
-		if (line.empty())
-			continue;
-
-		// TODO test for {}
+	mapped_file const file(path);
+	scan_module_declarations(file.view(), dependencies);
 
-		// Simple pattern: look for "\b(import|export module)\s+<module-name>;"
-		std::string_view const sv = line;
+	return dependencies;
+	};
 
-		// Skip initial whitespaces
-		auto const text_start = sv.find_first_not_of(" \t", 0);
-		if (text_start == std::string_view::npos)
-			continue;
+// Get the headers a file includes, as written, eg. '<vector>' or '"foo.h"'. Includes in comments and in inactive
+// preprocessor branches are found too, so there can be more than the compiler reads. Macro includes are not found.
+export std::vector<std::string> extract_includes(std::filesystem::path const& path) {
+	std::vector<std::string> includes;
 
-		// Find the start of the module name
-		bool is_export = false;
-		auto module_name = sv.substr(text_start);
-		if (module_name.starts_with("import ")) {
-			module_name = module_name.substr(7);
+	mapped_file const file(path);
+	std::string_view const text = file.view();
+	char const* p = text.data();
+	char const* const end = p + text.size();
+	while (p != end) {
+		p = skip_blanks(p, end);
+		if (p != end && *p == '#') {
+			char const* q = skip_blanks(p + 1, end);
+			if (read_identifier(q, end) == "include") {
+				q = skip_blanks(q, end);
+				std::string_view const name = read_import_name(q, end);
+				if (!name.empty() && (name.front() == '<' || name.front() == '"'))
+					includes.emplace_back(name);
+			}
 		}
-		else if (module_name.starts_with("export module ")) {
-			is_export = true;
-			module_name = module_name.substr(14);
+
+		p = std::find(p, end, '\n');
+		if (p != end)
+			++p;
+	}
+	return includes;
+}
+
+// Read the module dependencies of a source file from P1689 json, as written by the dependency scanners of the
+// compilers. Anything around the outermost object, like warnings, is ignored. Returns nothing if it can't be read.
+export std::optional<source_dependency> parse_p1689(std::filesystem::path path, std::string_view text) {
+	auto const first = text.find('{');
+	auto const last = text.rfind('}');
+	if (first == std::string_view::npos || last == std::string_view::npos || last < first)
+		return std::nullopt;
+
+	auto const doc = parse_json(text.substr(first, last - first + 1));
+	json_value const* const rules = doc ? doc->find("rules") : nullptr;
+	if (!rules || !rules->is_array() || rules->values.empty())
+		return std::nullopt;
+
+	source_dependency dependencies{ std::move(path) };
+	json_value const& rule = rules->values.front();
+
+	if (json_value const* provides = rule.find("provides"); provides && provides->is_array()) {
+		for (json_value const& provided : provides->values) {
+			// Implementation partitions are not interfaces, but are still imported by name
+			json_value const* const name = provided.find("logical-name");
+			json_value const* const is_interface = provided.find("is-interface");
+			if (name && name->is_string() && (!is_interface || is_interface->boolean || name->string.contains(':')))
+				dependencies.export_name = name->string;
 		}
-		else {
-			continue;
+	}
+
+	if (json_value const* requires_ = rule.find("requires"); requires_ && requires_->is_array()) {
+		for (json_value const& required : requires_->values) {
+			json_value const* const name = required.find("logical-name");
+			if (!name || !name->is_string())
+				continue;
+
+			// Header units are named like they are in the source, eg. '<vector>'
+			json_value const* const lookup = required.find("lookup-method");
+			std::string_view const method = (lookup && lookup->is_string()) ? std::string_view{ lookup->string } : "by-name";
+			if (method == "include-angle" && !name->string.starts_with('<'))
+				dependencies.import_names.insert("<" + name->string + ">");
+			else if (method == "include-quote" && !name->string.starts_with('"'))
+				dependencies.import_names.insert("\"" + name->string + "\"");
+			else
+				dependencies.import_names.insert(name->string);
 		}
+	}
 
-		// Skip whitespace
-		auto const whitespaces = module_name.find_first_not_of(" \t");
-		if (whitespaces != std::string_view::npos)
-			module_name = module_name.substr(whitespaces);
+	return dependencies;
+}
 
-		// Find end of module name (until ';' or whitespace)
-		auto const end = module_name.find_first_of(" ;\t");
-		if (end == std::string_view::npos)
-			continue;
+// Scans kept in memory between builds by the daemon. Entries are dropped when their files change.
+export class scan_cache {
+	std::mutex mtx;
+	std::unordered_map<std::filesystem::path, source_dependency> scans;
 
-		// The full module name
-		module_name = module_name.substr(0, end);
+public:
+	source_dependency get(std::filesystem::path const& path) {
+		std::filesystem::path const key = path.lexically_normal();
+		{
+			std::scoped_lock lock(mtx);
+			if (auto const it = scans.find(key); it != scans.end())
+				return it->second;
+		}
 
-		if (is_export)
-			dependencies.export_name.assign(module_name);
-		else
-			dependencies.import_names.emplace(module_name);
+		source_dependency deps = extract_module_dependencies(path);
+		std::scoped_lock lock(mtx);
+		scans[key] = deps;
+		return deps;
 	}
 
-	return dependencies;
-	};
+	void invalidate(std::filesystem::path const& path) {
+		std::scoped_lock lock(mtx);
+		scans.erase(path.lexically_normal());
+	}
+
+	void clear() {
+		std::scoped_lock lock(mtx);
+		scans.clear();
+	}
+};
@@ -1,12 +1,48 @@
+module;
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <mutex>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
 export module enumerate_compilers;
 import compiler;
 import env;
 import enumerate_compilers_clang;
 import enumerate_compilers_gcc;
 import enumerate_compilers_msvc;
+import thread_pool;
 
-export void enumerate_compilers(environment const& env, auto&& callback) {
-	enumerate_compilers_msvc(env, callback);
-	enumerate_compilers_clang(env, callback);
-	enumerate_compilers_gcc(env, callback);
+// Probes mostly wait for the compilers they run, so more of them run at once than there are cores
+constexpr std::size_t max_parallel_probes = 16;
+
+// The compiler families, in the order they are tried when no compiler is requested
+export constexpr std::array<std::string_view, 3> compiler_families{ "msvc", "clang", "gcc" };
+
+// Find the installed compilers of the given families. The probes run in parallel, and the compilers are passed
+// to 'callback' once all are done.
+export void enumerate_compilers(environment const& env, std::span<std::string_view const> families, auto&& callback) {
+	std::mutex mtx;
+	std::vector<compiler> found;
+	auto const collect = [&](compiler&& c) {
+		std::scoped_lock lock(mtx);
+		found.push_back(std::move(c));
+		};
+
+	{
+		thread_pool pool(max_parallel_probes);
+		job_group probes(pool);
+		if (std::ranges::contains(families, "msvc"))
+			enumerate_compilers_msvc(env, probes, collect);
+		if (std::ranges::contains(families, "clang"))
+			enumerate_compilers_clang(env, probes, collect);
+		if (std::ranges::contains(families, "gcc"))
+			enumerate_compilers_gcc(env, collect);
+		probes.wait();
+	}
+
+	for (compiler& c : found)
+		callback(std::move(c));
 }
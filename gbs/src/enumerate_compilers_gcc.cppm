@@ -6,6 +6,40 @@ export module enumerate_compilers_gcc;
 import env;
 import compiler;
 
+// Set the name and command templates of a gcc compiler
+export void init_gcc_commands(compiler& comp) {
+	comp.name = "gcc";
+	comp.build_source = " {0:?} -o {1:?} ";
+	comp.build_module = " -xc++ {0:?} -o {1:?} ";
+	comp.build_command_prefix = "{0:?} @{1}/SRC_INCLUDES -c -fPIC "
+		// Fixes/hacks for pthread in gcc
+		"-DWINPTHREAD_CLOCK_DECL=WINPTHREADS_ALWAYS_INLINE "
+		"-DWINPTHREAD_COND_DECL=WINPTHREADS_ALWAYS_INLINE "
+		"-DWINPTHREAD_MUTEX_DECL=WINPTHREADS_ALWAYS_INLINE "
+		"-DWINPTHREAD_NANOSLEEP_DECL=WINPTHREADS_ALWAYS_INLINE "
+		"-DWINPTHREAD_RWLOCK_DECL=WINPTHREADS_ALWAYS_INLINE "
+		"-DWINPTHREAD_SEM_DECL=WINPTHREADS_ALWAYS_INLINE "
+		"-DWINPTHREAD_THREAD_DECL=WINPTHREADS_ALWAYS_INLINE "
+		;
+#ifdef _MSC_VER
+	comp.link_command = "{0:?} -static -Wl,--allow-multiple-definition -lstdc++exp  @{1}/OBJLIST @{1}/LIBLIST -o {1}/{2}";
+	comp.dlib_command = "{0:?} -shared -Wl,--out-implib,{1}/{3} -lstdc++exp @{1}/OBJLIST -o {1}/{2}";
+#else
+	comp.link_command = "{0:?} -static -o {1}/{2} @{1}/OBJLIST @{1}/LIBLIST";
+	comp.dlib_command = "{0:?} -shared -o {1}/{2} @{1}/OBJLIST";
+#endif
+	comp.slib_command = "{0:?} rcs {1}/{2} @{1}/OBJLIST";
+	comp.define = "-D";
+	comp.include = "-I{0}";
+	comp.module_path = " -fmodule-mapper=\"|@g++-mapper-server --root {}\"";
+	comp.depfile = " -MD -MF {0:?}";
+	comp.bmi_file = "{0}/{2}.gcm";
+	comp.scan_command = "{0} -M -fdeps-format=p1689r5 -fdeps-file={2:?} -fdeps-target={1:?}";
+	comp.build_pch = " -x c++-header {0:?} -o {1:?} ";
+	comp.pch_file = "{0}.gch";
+	comp.use_pch = " -include {0:?}";
+}
+
 export void enumerate_compilers_gcc(environment const& env, auto&& callback) {
 	// Find compilers in ~/.gbs/*
 	auto const download_dir = env.get_home_dir() / ".gbs" / "gcc";
@@ -32,7 +66,6 @@ export void enumerate_compilers_gcc(environment const& env, auto&& callback) {
 
 			auto const& actual_path = dir.path();
 
-			comp.name = "gcc";
 			comp.dir = dir;
 			comp.executable = actual_path / "bin" / "g++";
 			comp.linker = comp.executable;
@@ -48,29 +81,7 @@ export void enumerate_compilers_gcc(environment const& env, auto&& callback) {
 				}
 			}
 
-			comp.build_source = " {0:?} -o {1:?} ";
-			comp.build_module = " -xc++ {0:?} -o {1:?} ";
-			comp.build_command_prefix = "call {0:?} @{1}/SRC_INCLUDES -c -fPIC "
-				// Fixes/hacks for pthread in gcc
-				"-DWINPTHREAD_CLOCK_DECL=WINPTHREADS_ALWAYS_INLINE "
-				"-DWINPTHREAD_COND_DECL=WINPTHREADS_ALWAYS_INLINE "
-				"-DWINPTHREAD_MUTEX_DECL=WINPTHREADS_ALWAYS_INLINE "
-				"-DWINPTHREAD_NANOSLEEP_DECL=WINPTHREADS_ALWAYS_INLINE "
-				"-DWINPTHREAD_RWLOCK_DECL=WINPTHREADS_ALWAYS_INLINE "
-				"-DWINPTHREAD_SEM_DECL=WINPTHREADS_ALWAYS_INLINE "
-				"-DWINPTHREAD_THREAD_DECL=WINPTHREADS_ALWAYS_INLINE "
-				;
-#ifdef _MSC_VER
-			comp.link_command = "call {0:?} -static -Wl,--allow-multiple-definition -lstdc++exp  @{1}/OBJLIST @{1}/LIBLIST -o {1}/{2}";
-			comp.dlib_command = "call {0:?} -shared -Wl,--out-implib,{1}/{3} -lstdc++exp @{1}/OBJLIST -o {1}/{2}";
-#else
-			comp.link_command = "call {0:?} -static -o {1}/{2} @{1}/OBJLIST @{1}/LIBLIST";
-			comp.dlib_command = "call {0:?} -shared -o {1}/{2} @{1}/OBJLIST";
-#endif
-			comp.slib_command = "call {0:?} rcs {1}/{2} @{1}/OBJLIST";
-			comp.define = "-D";
-			comp.include = "-I{0}";
-			comp.module_path = " -fmodule-mapper=\"|@g++-mapper-server --root {}\"";
+			init_gcc_commands(comp);
 			callback(std::move(comp));
 		}
 	}
@@ -1,20 +1,42 @@
 module;
 #include <filesystem>
-#include <fstream>
+#include <format>
+#include <sstream>
+#include <string>
+#include <string_view>
 export module enumerate_compilers_msvc;
 import env;
 import compiler;
+import process;
+import thread_pool;
+
+// Set the name and command templates of a msvc compiler
+export void init_msvc_commands(compiler& comp) {
+	comp.name = "msvc";
+	comp.build_source = " {0:?} ";
+	comp.build_module = " {0:?} ";
+	comp.build_command_prefix = "{0:?} @{1}/INCLUDE @{1}/SRC_INCLUDES /c /interface /TP /ifcOutput {1}/ /Fo:{1}/ ";
+	comp.link_command = "{0:?} /NOLOGO /OUT:{1}/{2} @{1}/LIBPATH @{1}/OBJLIST @{1}/LIBLIST";
+	comp.slib_command = "{0:?} /NOLOGO /OUT:{1}/{2} @{1}/LIBPATH @{1}/OBJLIST";
+	comp.dlib_command = "{0:?} /NOLOGO /DLL /OUT:{1}/{2} @{1}/LIBPATH @{1}/OBJLIST";
+	comp.define = "/D";
+	comp.include = "/I{0}";
+	comp.module_path = " /ifcSearchDir {}";
+	comp.depfile = " /sourceDependencies {0:?}";
+	comp.bmi_file = "{0}/{2}.ifc";
+	comp.scan_command = "{0} /scanDependencies {2:?}";
+}
 
 #ifndef _MSC_VER
-export void enumerate_compilers_msvc(environment const&, auto&&) {}
+export void enumerate_compilers_msvc(environment const&, job_group&, auto&&) {}
 #else
-static void enumerate_compiler_msvc(std::filesystem::path msvc_path, auto&& callback) {
+static void enumerate_compiler_msvc(std::filesystem::path msvc_path, job_group& probes, auto&& callback) {
 	if (!std::filesystem::exists(msvc_path))
 		return;
 
 	for (auto const& dir : std::filesystem::directory_iterator(msvc_path)) {
 		compiler comp;
-		comp.name = "msvc";
+		init_msvc_commands(comp);
 		comp.name_and_version = "msvc_" + dir.path().filename().generic_string();
 		comp.dir = dir;
 		comp.executable = comp.dir / "bin" / "HostX64" / "x64" / "cl.exe";
@@ -23,50 +45,53 @@ static void enumerate_compiler_msvc(std::filesystem::path msvc_path, auto&& call
 		comp.dlib = comp.linker;
 		comp.std_module = comp.dir / "modules" / "std.ixx";
 
-		comp.build_source = " {0:?} ";
-		comp.build_module = " {0:?} ";
-		comp.build_command_prefix = "call {0:?} @{1}/INCLUDE @{1}/SRC_INCLUDES /c /interface /TP /ifcOutput {1}/ /Fo:{1}/ ";
-		comp.link_command = "call {0:?} /NOLOGO /OUT:{1}/{2} @{1}/LIBPATH @{1}/OBJLIST @{1}/LIBLIST";
-		comp.slib_command = "call {0:?} /NOLOGO /OUT:{1}/{2} @{1}/LIBPATH @{1}/OBJLIST";
-		comp.dlib_command = "call {0:?} /NOLOGO /DLL /OUT:{1}/{2} @{1}/LIBPATH @{1}/OBJLIST";
-		comp.define = "/D";
-		comp.include = "/I{0}";
-		comp.module_path = " /ifcSearchDir {}";
-
 		if (!std::filesystem::exists(comp.executable))
 			continue;
 
-		std::string const cmd = std::format(R"("{}" 1>nul 2>version)", comp.executable.generic_string());
-		if (0 == std::system(cmd.c_str())) {
+		probes.run([&callback, comp = std::move(comp)]() mutable {
+			// cl.exe prints its version in the banner
+			process_result const result = run_process(std::format(R"("{}")", comp.executable.generic_string()));
+			if (result.exit_code != 0)
+				return;
+
+			std::istringstream output(result.output);
 			std::string version;
-			std::getline(std::ifstream("version"), version);
+			while (std::getline(output, version) && version.find_first_of("0123456789") == std::string::npos) {}
 
 			std::string_view sv(version);
-			sv.remove_prefix(sv.find_first_of("0123456789", 0));
+			auto const digit = sv.find_first_of("0123456789");
+			if (digit == std::string_view::npos)
+				return;
+			sv.remove_prefix(digit);
 			sv = sv.substr(0, sv.find_first_of(' '));
 
 			extract_compiler_version(sv, comp.major, comp.minor, comp.patch);
 			callback(std::move(comp));
-
-			std::filesystem::remove("version");
-		}
+			});
 	}
 }
 
-export void enumerate_compilers_msvc(environment const& env, auto&& callback) {
+// Runs the probes on 'probes'. 'callback' is called from the probe threads.
+export void enumerate_compilers_msvc(environment const& env, job_group& probes, auto&& callback) {
 	// Look for installations of Visual Studio
-	std::string msvc_std_module{};
-	if (0 == std::system("\">instpath.txt \"%ProgramFiles(x86)%/Microsoft Visual Studio/Installer/vswhere.exe\" -prerelease -property installationPath 2>nul\"")) {
-		std::string line;
-		std::ifstream file("instpath.txt");
+	if (auto const prg_86 = env.get("ProgramFiles(x86)"); prg_86) {
+		probes.run([&probes, &callback, vswhere = std::filesystem::path(*prg_86) / "Microsoft Visual Studio" / "Installer" / "vswhere.exe"] {
+			process_result const result = run_process(std::format(R"("{}" -prerelease -property installationPath)", vswhere.generic_string()));
+			if (result.exit_code != 0)
+				return;
 
-		while (std::getline(file, line)) {
-			std::filesystem::path const msvc_path(line);
-			enumerate_compiler_msvc(msvc_path / "VC" / "Tools" / "MSVC", callback);
-		}
-		file.close();
-		std::error_code ec;
-		std::filesystem::remove("instpath.txt", ec);
+			std::istringstream output(result.output);
+			std::string line;
+			while (std::getline(output, line)) {
+				if (!line.empty() && line.back() == '\r')
+					line.pop_back();
+				if (line.empty())
+					continue;
+
+				std::filesystem::path const msvc_path(line);
+				enumerate_compiler_msvc(msvc_path / "VC" / "Tools" / "MSVC", probes, callback);
+			}
+			});
 	}
 
 	// Look for user installations of Microsoft Build Tools
@@ -76,7 +101,7 @@ export void enumerate_compilers_msvc(environment const& env, auto&& callback) {
 			// Find msvc compilers
 			auto const msvc_path = build_tools_dir / "VC" / "Tools" / "MSVC";
 			if (std::filesystem::exists(msvc_path)) {
-				enumerate_compiler_msvc(msvc_path, callback);
+				enumerate_compiler_msvc(msvc_path, probes, callback);
 			}
 		}
 	}
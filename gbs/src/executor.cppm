@@ -0,0 +1,642 @@
+module;
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <print>
+#include <random>
+#include <semaphore>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+export module executor;
+import hash;
+import jobserver;
+import net;
+import process;
+
+namespace fs = std::filesystem;
+
+// A file read by a compile, and the hash of its content
+export struct job_input {
+	fs::path path;
+	std::uint64_t hash = 0;
+};
+
+// A compile, with everything needed to run it on another machine
+export struct compile_job {
+	std::string command;
+
+	// Files the compile reads, relative to the build directory. Files with absolute paths,
+	// like the compiler and the system headers, must exist at the same place on every machine.
+	std::vector<job_input> inputs;
+
+	// Files the compile writes, relative to the build directory
+	std::vector<fs::path> outputs;
+
+	// The dependency file among the outputs
+	fs::path depfile;
+};
+
+// Runs the compiles of a build
+export class executor {
+public:
+	virtual ~executor() = default;
+
+	virtual process_result run(compile_job const& job) = 0;
+
+	// The number of compiles that can run elsewhere, in addition to the local jobs.
+	// Jobs only need their inputs filled in if this is not 0.
+	[[nodiscard]] virtual std::size_t remote_slots() const {
+		return 0;
+	}
+};
+
+// Runs compiles on this machine, at most 'jobs' at a time
+export class local_executor final : public executor {
+	std::counting_semaphore<> slots;
+
+	// Optional; shared with the other processes of a parent make and with the children
+	jobserver* job_slots = nullptr;
+
+public:
+	explicit local_executor(std::size_t const jobs, jobserver* job_slots = nullptr)
+		: slots(static_cast<std::ptrdiff_t>(jobs)), job_slots(job_slots) {}
+
+	process_result run(compile_job const& job) override {
+		return run(job.command);
+	}
+
+	// Run any command on this machine, like a link. Waits while 'jobs' commands are running,
+	// since a build with workers has more threads than local jobs, and takes a job slot from the jobserver.
+	// Tasks that start no process, like cache lookups, never hold a slot.
+	process_result run(std::string_view const command) {
+		slots.acquire();
+		bool const has_slot = job_slots && job_slots->acquire();
+		process_result result = run_process(command);
+		if (has_slot)
+			job_slots->release();
+		slots.release();
+		return result;
+	}
+};
+
+// The worker protocol is line based. Lines giving a size are followed by that many bytes of data.
+//
+//   client                     worker
+//   gbs.worker 2
+//   token <token>
+//   slots                      slots <n>
+//
+//   gbs.worker 2
+//   token <token>
+//   job
+//   cmd <size>
+//   in <hash> <path>     *
+//   out <path>           *
+//   dep <path>
+//   end                        need <hash>     *
+//                              end
+//   blob <hash> <size>   *
+//   end                        exit <code> <peak memory>
+//                              log <size>
+//                              file <size> <path>     *
+//                              end
+//
+// Workers keep the inputs they have been sent, so headers and module interfaces are only sent once.
+// Connections without the token of the worker are closed.
+constexpr std::string_view protocol_header = "gbs.worker 2";
+
+// The file holding the token shared by workers and the builds using them
+export fs::path worker_token_path(fs::path const& home_dir) {
+	return home_dir / ".gbs" / "worker_token";
+}
+
+// Read the worker token of this machine. Returns nothing if there is none.
+export std::optional<std::string> read_worker_token(fs::path const& home_dir) {
+	std::ifstream in(worker_token_path(home_dir));
+	std::string token;
+	if (!(in >> token))
+		return std::nullopt;
+	return token;
+}
+
+static std::optional<std::string> read_file(fs::path const& path) {
+	std::ifstream in(path, std::ios::binary);
+	if (!in)
+		return std::nullopt;
+	return std::string{ std::istreambuf_iterator<char>(in), {} };
+}
+
+static bool write_file(fs::path const& path, std::string_view const data) {
+	std::error_code ec;
+	if (path.has_parent_path())
+		fs::create_directories(path.parent_path(), ec);
+
+	std::ofstream out(path, std::ios::binary);
+	out.write(data.data(), static_cast<std::streamsize>(data.size()));
+	return static_cast<bool>(out);
+}
+
+// Parse a number at the start of 'str', and remove it and the following space
+template<typename T>
+static std::optional<T> take_number(std::string_view& str) {
+	T value{};
+	auto const [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+	if (ec != std::errc{})
+		return std::nullopt;
+	str.remove_prefix(static_cast<std::size_t>(ptr - str.data()));
+	if (str.starts_with(' '))
+		str.remove_prefix(1);
+	return value;
+}
+
+// Paths from the other side must stay inside the build directory
+static bool is_safe_path(fs::path const& path) {
+	if (path.empty() || path.is_absolute() || path.has_root_name() || path.has_root_directory())
+		return false;
+	for (fs::path const& part : path) {
+		if (part == "..")
+			return false;
+	}
+	return true;
+}
+
+// Compiler errors about a file that can't be found, from clang, gcc and msvc
+static bool is_missing_input(std::string_view const output) {
+	return output.contains("file not found") || output.contains("No such file or directory") || output.contains("C1083");
+}
+
+// Sends compiles to worker processes, started with 'gbs worker', over TCP.
+// Compiles run locally when all workers are busy, when a worker fails, and when a file is missing on the worker.
+export class remote_executor final : public executor {
+	struct worker {
+		std::string host;
+		std::uint16_t port = 0;
+		std::size_t slots = 0;
+		std::size_t running = 0;
+		bool failed = false;
+	};
+
+	std::vector<worker> workers;
+	std::size_t total_slots = 0;
+	std::string token;
+	std::mutex mtx;
+	local_executor& local;
+
+public:
+	// Connect to workers given as 'host:port', which use 'token'. Workers that can't be reached are not used.
+	// Compiles that can't run on a worker run on 'local'.
+	remote_executor(std::span<std::string const> addresses, std::string token, local_executor& local)
+		: token(std::move(token)), local(local) {
+		for (std::string_view const address : addresses) {
+			auto const colon = address.rfind(':');
+			std::string_view port_str = colon == std::string_view::npos ? std::string_view{} : address.substr(colon + 1);
+			auto const port = take_number<std::uint16_t>(port_str);
+			if (!port || !port_str.empty()) {
+				std::println(std::cerr, "<gbs> Warning: invalid worker address '{}', expected 'host:port'", address);
+				continue;
+			}
+
+			worker w{ std::string{ address.substr(0, colon) }, *port };
+			w.slots = query_slots(w, this->token);
+			if (w.slots == 0) {
+				std::println(std::cerr, "<gbs> Warning: worker '{}' can't be reached", address);
+				continue;
+			}
+
+			std::println("<gbs> Using worker '{}' with {} slots", address, w.slots);
+			total_slots += w.slots;
+			workers.push_back(std::move(w));
+		}
+	}
+
+	[[nodiscard]] std::size_t remote_slots() const override {
+		return total_slots;
+	}
+
+	process_result run(compile_job const& job) override {
+		worker* const w = acquire_worker();
+		if (!w)
+			return local.run(job);
+
+		auto result = run_remote(*w, token, job);
+		release_worker(*w, result.has_value());
+
+		// The headers sent are the ones the source used last time, or the ones found by scanning it, so a remote
+		// compile can fail because of a header that wasn't sent. Only those are retried here; other errors are real.
+		if (!result || (!result->succeeded() && is_missing_input(result->output)))
+			return local.run(job);
+		return std::move(*result);
+	}
+
+private:
+	static std::size_t query_slots(worker const& w, std::string_view const token) {
+		tcp_socket socket = connect_tcp(w.host, w.port);
+		if (!socket.is_open())
+			return 0;
+		socket.set_timeout(std::chrono::seconds{ 10 });
+
+		if (!socket.send_all(std::format("{}\ntoken {}\nslots\n", protocol_header, token)))
+			return 0;
+
+		auto const line = socket.read_line();
+		if (!line || !line->starts_with("slots "))
+			return 0;
+		std::string_view rest = std::string_view{ *line }.substr(6);
+		return take_number<std::size_t>(rest).value_or(0);
+	}
+
+	// Take a slot on the least loaded worker. Returns null if they are all busy.
+	worker* acquire_worker() {
+		std::scoped_lock lock(mtx);
+		worker* best = nullptr;
+		for (worker& w : workers) {
+			if (w.failed || w.running >= w.slots)
+				continue;
+			if (!best || w.running * best->slots < best->running * w.slots)
+				best = &w;
+		}
+		if (best)
+			best->running += 1;
+		return best;
+	}
+
+	void release_worker(worker& w, bool const reachable) {
+		std::scoped_lock lock(mtx);
+		w.running -= 1;
+		if (!reachable && !w.failed) {
+			w.failed = true;
+			std::println(std::cerr, "<gbs> Warning: lost connection to worker '{}:{}', it will not be used for the rest of the build", w.host, w.port);
+		}
+	}
+
+	// Run a compile on a worker. Returns nothing if the worker could not be used.
+	static std::optional<process_result> run_remote(worker const& w, std::string_view const token, compile_job const& job) {
+		tcp_socket socket = connect_tcp(w.host, w.port);
+		if (!socket.is_open())
+			return std::nullopt;
+		socket.set_timeout(std::chrono::minutes{ 30 });
+
+		std::string request = std::format("{}\ntoken {}\njob\ncmd {}\n{}", protocol_header, token, job.command.size(), job.command);
+		for (job_input const& input : job.inputs)
+			request += std::format("in {} {}\n", hash_to_string(input.hash), input.path.generic_string());
+		for (fs::path const& output : job.outputs)
+			request += std::format("out {}\n", output.generic_string());
+		if (!job.depfile.empty())
+			request += std::format("dep {}\n", job.depfile.generic_string());
+		request += "end\n";
+		if (!socket.send_all(request))
+			return std::nullopt;
+
+		// Send the inputs the worker doesn't have yet
+		for (;;) {
+			auto const line = socket.read_line();
+			if (!line)
+				return std::nullopt;
+			if (*line == "end")
+				break;
+			if (!line->starts_with("need "))
+				return std::nullopt;
+
+			auto const hash = hash_from_string(std::string_view{ *line }.substr(5));
+			auto const input = std::ranges::find(job.inputs, hash, &job_input::hash);
+			if (!hash || input == job.inputs.end())
+				return std::nullopt;
+
+			// A file that changed since it was hashed can't be sent
+			auto const data = read_file(input->path);
+			if (!data || hash_bytes(*data) != input->hash)
+				return std::nullopt;
+			if (!socket.send_all(std::format("blob {} {}\n", hash_to_string(input->hash), data->size())) || !socket.send_all(*data))
+				return std::nullopt;
+		}
+		if (!socket.send_all("end\n"))
+			return std::nullopt;
+
+		process_result result;
+		auto const exit_line = socket.read_line();
+		if (!exit_line || !exit_line->starts_with("exit "))
+			return std::nullopt;
+		std::string_view exit_str = std::string_view{ *exit_line }.substr(5);
+		auto const exit_code = take_number<int>(exit_str);
+		auto const peak_memory = take_number<std::uint64_t>(exit_str);
+		if (!exit_code || !peak_memory)
+			return std::nullopt;
+		result.exit_code = *exit_code;
+		result.peak_memory = *peak_memory;
+
+		auto const log_line = socket.read_line();
+		if (!log_line || !log_line->starts_with("log "))
+			return std::nullopt;
+		std::string_view log_str = std::string_view{ *log_line }.substr(4);
+		auto const log_size = take_number<std::size_t>(log_str);
+		auto log = log_size ? socket.read_exact(*log_size) : std::nullopt;
+		if (!log)
+			return std::nullopt;
+		result.output = std::move(*log);
+
+		for (;;) {
+			auto const line = socket.read_line();
+			if (!line)
+				return std::nullopt;
+			if (*line == "end")
+				break;
+			if (!line->starts_with("file "))
+				return std::nullopt;
+
+			std::string_view rest = std::string_view{ *line }.substr(5);
+			auto const size = take_number<std::size_t>(rest);
+			fs::path const path{ rest };
+			if (!size || std::ranges::find(job.outputs, path) == job.outputs.end())
+				return std::nullopt;
+
+			auto const data = socket.read_exact(*size);
+			if (!data || !write_file(path, *data))
+				return std::nullopt;
+		}
+
+		return result;
+	}
+};
+
+// Remove all occurrences of 'what' from 'text'
+static void erase_all(std::string& text, std::string_view const what) {
+	for (auto pos = text.find(what); pos != std::string::npos; pos = text.find(what, pos))
+		text.erase(pos, what.size());
+}
+
+// Make the paths to a job directory in compiler output relative, so they match the paths on the client
+static std::string strip_job_dir(std::string text, fs::path const& dir) {
+	erase_all(text, dir.generic_string() + '/');
+#ifdef _WIN32
+	std::string const native = dir.string() + '\\';
+	erase_all(text, native);
+
+	// Json dependency files escape the backslashes
+	std::string escaped;
+	for (char const c : native) {
+		escaped += c;
+		if (c == '\\')
+			escaped += '\\';
+	}
+	erase_all(text, escaped);
+#endif
+	return text;
+}
+
+// State shared by the connections of a worker
+struct worker_state {
+	fs::path blob_dir;
+	fs::path job_dir;
+	std::size_t slots;
+	std::string token;
+
+	// The words every command has to start with, eg. the path of the compiler
+	std::vector<std::string> compiler;
+
+	std::counting_semaphore<> running;
+	std::atomic<std::uint64_t> next_job{ 0 };
+
+	worker_state(fs::path dir, std::size_t const slots, std::string token, std::vector<std::string> compiler)
+		: blob_dir(dir / "blobs"), job_dir(dir / "jobs"), slots(slots), token(std::move(token)), compiler(std::move(compiler)), running(static_cast<std::ptrdiff_t>(slots)) {}
+};
+
+// Returns true if a command runs the compiler of the worker, and not some other program
+static bool runs_compiler(std::string_view const command, std::span<std::string const> compiler) {
+	std::vector<std::string> const args = split_command_line(command);
+	if (compiler.empty() || args.size() < compiler.size())
+		return false;
+
+	for (std::size_t i = 0; i < compiler.size(); ++i) {
+		if (fs::path{ args[i] }.lexically_normal() != fs::path{ compiler[i] }.lexically_normal())
+			return false;
+	}
+	return true;
+}
+
+// Receive a job, run it, and send back the results
+static void serve_job(tcp_socket& socket, worker_state& state) {
+	std::string command;
+	std::vector<job_input> inputs;
+	std::vector<fs::path> outputs;
+	fs::path depfile;
+
+	for (;;) {
+		auto const line = socket.read_line();
+		if (!line)
+			return;
+
+		std::string_view const sv = *line;
+		if (sv == "end")
+			break;
+
+		if (sv.starts_with("cmd ")) {
+			std::string_view rest = sv.substr(4);
+			auto const size = take_number<std::size_t>(rest);
+			auto cmd = size ? socket.read_exact(*size) : std::nullopt;
+			if (!cmd)
+				return;
+			command = std::move(*cmd);
+		}
+		else if (sv.starts_with("in ") && sv.size() > 20 && sv[19] == ' ') {
+			auto const hash = hash_from_string(sv.substr(3, 16));
+			fs::path const path{ sv.substr(20) };
+			if (!hash || !is_safe_path(path))
+				return;
+			inputs.push_back({ path, *hash });
+		}
+		else if (sv.starts_with("out ") || sv.starts_with("dep ")) {
+			fs::path const path{ sv.substr(4) };
+			if (!is_safe_path(path))
+				return;
+			outputs.push_back(path);
+			if (sv.starts_with("dep "))
+				depfile = path;
+		}
+		else {
+			return;
+		}
+	}
+
+	// Nothing is asked for if the command is refused
+	bool const allowed = runs_compiler(command, state.compiler);
+
+	// Ask for the inputs not seen before
+	std::string needs;
+	for (job_input const& input : inputs) {
+		if (allowed && !fs::exists(state.blob_dir / hash_to_string(input.hash)))
+			needs += std::format("need {}\n", hash_to_string(input.hash));
+	}
+	if (!socket.send_all(needs + "end\n"))
+		return;
+
+	for (;;) {
+		auto const line = socket.read_line();
+		if (!line)
+			return;
+		if (*line == "end")
+			break;
+		if (!line->starts_with("blob ") || line->size() < 22)
+			return;
+
+		auto const hash = hash_from_string(std::string_view{ *line }.substr(5, 16));
+		std::string_view rest = std::string_view{ *line }.substr(22);
+		auto const size = take_number<std::size_t>(rest);
+		auto const data = size ? socket.read_exact(*size) : std::nullopt;
+		if (!hash || !data || hash_bytes(*data) != *hash)
+			return;
+
+		// Write to a temporary file first, so other jobs never see a partial blob
+		fs::path const blob = state.blob_dir / hash_to_string(*hash);
+		fs::path const tmp = unique_temp_path(blob);
+		std::error_code ec;
+		if (write_file(tmp, *data))
+			fs::rename(tmp, blob, ec);
+		fs::remove(tmp, ec);
+	}
+
+	if (!allowed) {
+		std::string const log = std::format("<gbs> Error: worker only runs '{}'\n", state.compiler.back());
+		socket.send_all(std::format("exit 1 0\nlog {}\n{}end\n", log.size(), log));
+		return;
+	}
+
+	state.running.acquire();
+
+	// Lay out the inputs in a directory of their own, and run the command there
+	std::error_code ec;
+	fs::path job_dir = state.job_dir / std::to_string(state.next_job.fetch_add(1));
+	fs::create_directories(job_dir, ec);
+	job_dir = fs::canonical(job_dir, ec);
+
+	process_result result;
+	bool prepared = !ec;
+	for (job_input const& input : inputs) {
+		fs::create_directories((job_dir / input.path).parent_path(), ec);
+		fs::copy_file(state.blob_dir / hash_to_string(input.hash), job_dir / input.path, fs::copy_options::overwrite_existing, ec);
+		prepared = prepared && !ec;
+	}
+	for (fs::path const& output : outputs)
+		fs::create_directories((job_dir / output).parent_path(), ec);
+
+	if (prepared)
+		result = run_process(command, job_dir);
+	else
+		result.output = "<gbs> Error: worker could not set up the job directory\n";
+
+	state.running.release();
+
+	std::string response = std::format("exit {} {}\n", result.exit_code, result.peak_memory);
+	std::string const log = strip_job_dir(std::move(result.output), job_dir);
+	response += std::format("log {}\n{}", log.size(), log);
+	for (fs::path const& output : outputs) {
+		auto data = read_file(job_dir / output);
+		if (!data)
+			continue;
+		if (output == depfile)
+			data = strip_job_dir(std::move(*data), job_dir);
+		response += std::format("file {} {}\n{}", data->size(), output.generic_string(), *data);
+	}
+	response += "end\n";
+	socket.send_all(response);
+
+	fs::remove_all(job_dir, ec);
+}
+
+static void serve_worker_connection(tcp_socket socket, worker_state& state) {
+	socket.set_timeout(std::chrono::minutes{ 5 });
+
+	auto const header = socket.read_line();
+	auto const token_line = socket.read_line();
+	if (!header || *header != protocol_header || !token_line || *token_line != std::format("token {}", state.token))
+		return;
+
+	auto const request = socket.read_line();
+	if (!request)
+		return;
+
+	if (*request == "slots")
+		socket.send_all(std::format("slots {}\n", state.slots));
+	else if (*request == "job")
+		serve_job(socket, state);
+}
+
+// Get the worker token of this machine, and create one if there is none
+static std::optional<std::string> get_or_create_worker_token(fs::path const& home_dir) {
+	if (auto token = read_worker_token(home_dir))
+		return token;
+
+	std::random_device rd;
+	std::string const token = hash_to_string((std::uint64_t{ rd() } << 32) | rd()) + hash_to_string((std::uint64_t{ rd() } << 32) | rd());
+
+	fs::path const path = worker_token_path(home_dir);
+	std::error_code ec;
+	fs::create_directories(path.parent_path(), ec);
+	{
+		std::ofstream out(path);
+		out << token << '\n';
+		if (!out)
+			return std::nullopt;
+	}
+	fs::permissions(path, fs::perms::owner_read | fs::perms::owner_write, ec);
+	return token;
+}
+
+// Run compiles for other machines, at most 'slots' at a time. Only commands running 'compiler' are accepted, from
+// builds that have the token in '~/.gbs/worker_token'. Listens on 'address', which is the loopback interface unless
+// another one is given. Never returns unless it fails to start.
+export bool run_worker(fs::path const& home_dir, std::string const& address, std::uint16_t const port, std::size_t const slots, std::vector<std::string> compiler) {
+	if (compiler.empty()) {
+		std::println(std::cerr, "<gbs> Error: worker has no compiler to run");
+		return false;
+	}
+
+	auto token = get_or_create_worker_token(home_dir);
+	if (!token) {
+		std::println(std::cerr, "<gbs> Error: could not write '{}'", worker_token_path(home_dir).generic_string());
+		return false;
+	}
+
+	std::string const host = address.empty() ? std::string{ "127.0.0.1" } : address;
+	tcp_listener listener(port, host);
+	if (!listener.is_open()) {
+		std::println(std::cerr, "<gbs> Error: could not listen on {}:{}", host, port);
+		return false;
+	}
+
+	fs::path const dir = fs::temp_directory_path() / std::format("gbs-worker-{}", listener.port());
+	worker_state state(dir, slots, std::move(*token), std::move(compiler));
+
+	// Job directories left behind by an earlier run are of no use
+	std::error_code ec;
+	fs::remove_all(state.job_dir, ec);
+	fs::create_directories(state.job_dir, ec);
+	fs::create_directories(state.blob_dir, ec);
+	if (ec) {
+		std::println(std::cerr, "<gbs> Error: could not create worker directory '{}': {}", dir.generic_string(), ec.message());
+		return false;
+	}
+
+	std::println("<gbs> Worker running {} jobs of '{}' on {}:{}", slots, state.compiler.back(), host, listener.port());
+	std::println("<gbs> Builds using it need a copy of '{}'", worker_token_path(home_dir).generic_string());
+	for (;;) {
+		tcp_socket socket = listener.accept();
+		if (!socket.is_open())
+			continue;
+
+		std::thread([socket = std::move(socket), &state]() mutable {
+			serve_worker_connection(std::move(socket), state);
+		}).detach();
+	}
+}
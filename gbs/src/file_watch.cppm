@@ -0,0 +1,201 @@
+module;
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#ifdef __linux__
+#include <cerrno>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+export module file_watch;
+
+namespace fs = std::filesystem;
+
+// Reports changes to the files in a directory tree.
+// On Linux inotify is used. Elsewhere the tree is polled for changed timestamps and sizes.
+export class file_watcher {
+	fs::path root;
+
+	// Directories that are not watched, relative to the root
+	std::vector<fs::path> ignored;
+
+#ifdef __linux__
+	int fd = -1;
+
+	// Maps watch descriptors to the directories they watch
+	std::unordered_map<int, fs::path> watches;
+#else
+	struct file_state {
+		fs::file_time_type mtime;
+		std::uintmax_t size = 0;
+	};
+
+	std::unordered_map<fs::path, file_state> snapshot;
+#endif
+
+public:
+	file_watcher(fs::path root_dir, std::vector<fs::path> ignored_dirs) : root(std::move(root_dir)), ignored(std::move(ignored_dirs)) {
+		for (fs::path& dir : ignored)
+			dir = (root / dir).lexically_normal();
+
+#ifdef __linux__
+		fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (fd != -1)
+			watch_tree(root, nullptr);
+#else
+		snapshot = take_snapshot();
+#endif
+	}
+
+	file_watcher(file_watcher const&) = delete;
+	file_watcher& operator=(file_watcher const&) = delete;
+
+	~file_watcher() {
+#ifdef __linux__
+		if (fd != -1)
+			close(fd);
+#endif
+	}
+
+	// Wait at most 'timeout' for files to change. Returns the changed files, or nothing if the timeout expired.
+	// The root itself is returned if changes were lost, in which case everything should be considered changed.
+	std::vector<fs::path> wait_for_changes(std::chrono::milliseconds const timeout) {
+#ifdef __linux__
+		if (fd == -1) {
+			std::this_thread::sleep_for(timeout);
+			return {};
+		}
+
+		pollfd pfd{ fd, POLLIN, 0 };
+		int const ready = poll(&pfd, 1, static_cast<int>(timeout.count()));
+		if (ready <= 0)
+			return {};
+
+		std::vector<fs::path> changed;
+		alignas(inotify_event) char buffer[64 * 1024];
+		for (;;) {
+			ssize_t const n = read(fd, buffer, sizeof(buffer));
+			if (n <= 0)
+				break;
+
+			for (ssize_t offset = 0; offset < n;) {
+				auto const* const event = reinterpret_cast<inotify_event const*>(buffer + offset);
+				offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+
+				if (event->mask & IN_Q_OVERFLOW) {
+					changed.push_back(root.lexically_normal());
+					continue;
+				}
+
+				auto const it = watches.find(event->wd);
+				if (it == watches.end())
+					continue;
+
+				if (event->mask & IN_IGNORED) {
+					watches.erase(it);
+					continue;
+				}
+
+				fs::path const path = event->len > 0 ? it->second / event->name : it->second;
+				if (is_ignored(path))
+					continue;
+
+				// New directories have to be watched as well, and may already contain files
+				if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO)))
+					watch_tree(path, &changed);
+				changed.push_back(path.lexically_normal());
+			}
+		}
+
+		std::ranges::sort(changed);
+		auto const dupes = std::ranges::unique(changed);
+		changed.erase(dupes.begin(), dupes.end());
+		return changed;
+#else
+		auto const deadline = std::chrono::steady_clock::now() + timeout;
+		for (;;) {
+			auto current = take_snapshot();
+
+			std::vector<fs::path> changed;
+			for (auto const& [path, state] : current) {
+				auto const it = snapshot.find(path);
+				if (it == snapshot.end() || it->second.mtime != state.mtime || it->second.size != state.size)
+					changed.push_back(path);
+			}
+			for (auto const& [path, state] : snapshot) {
+				if (!current.contains(path))
+					changed.push_back(path);
+			}
+
+			snapshot = std::move(current);
+			if (!changed.empty() || std::chrono::steady_clock::now() >= deadline)
+				return changed;
+
+			std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(std::chrono::milliseconds{ 500 }, deadline - std::chrono::steady_clock::now()));
+		}
+#endif
+	}
+
+private:
+	bool is_ignored(fs::path const& path) const {
+		fs::path const normal = path.lexically_normal();
+		return std::ranges::any_of(ignored, [&normal](fs::path const& dir) {
+			auto const [dir_end, path_end] = std::ranges::mismatch(dir, normal);
+			return dir_end == dir.end();
+		});
+	}
+
+#ifdef __linux__
+	// Watch a directory and everything below it. Files found are added to 'found', if given.
+	void watch_tree(fs::path const& dir, std::vector<fs::path>* found) {
+		add_watch(dir);
+
+		std::error_code ec;
+		for (auto it = fs::recursive_directory_iterator(dir, fs::directory_options::skip_permission_denied, ec); it != fs::recursive_directory_iterator(); it.increment(ec)) {
+			if (ec)
+				break;
+
+			if (is_ignored(it->path())) {
+				it.disable_recursion_pending();
+				continue;
+			}
+
+			if (it->is_directory(ec))
+				add_watch(it->path());
+			else if (found)
+				found->push_back(it->path().lexically_normal());
+		}
+	}
+
+	void add_watch(fs::path const& dir) {
+		constexpr std::uint32_t mask = IN_CREATE | IN_DELETE | IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | IN_ONLYDIR;
+		int const wd = inotify_add_watch(fd, dir.c_str(), mask);
+		if (wd != -1)
+			watches[wd] = dir;
+	}
+#else
+	std::unordered_map<fs::path, file_state> take_snapshot() const {
+		std::unordered_map<fs::path, file_state> files;
+
+		std::error_code ec;
+		for (auto it = fs::recursive_directory_iterator(root, fs::directory_options::skip_permission_denied, ec); it != fs::recursive_directory_iterator(); it.increment(ec)) {
+			if (ec)
+				break;
+
+			if (is_ignored(it->path())) {
+				it.disable_recursion_pending();
+				continue;
+			}
+
+			if (it->is_regular_file(ec))
+				files[it->path().lexically_normal()] = { it->last_write_time(ec), it->file_size(ec) };
+		}
+		return files;
+	}
+#endif
+};
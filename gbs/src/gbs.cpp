@@ -1,7 +1,8 @@
 ﻿#include <print>
 #include <ranges>
-#include <span>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
 
 import cmd_version;
 import cmd_build;
@@ -12,23 +13,18 @@ import cmd_cl;
 import cmd_ide;
 import cmd_config;
 import cmd_unittest;
+import cmd_cache_server;
+import cmd_worker;
+import cmd_daemon;
+import cmd_watch;
 
 import context;
 import compiler;
 
-int main(const int argc, char const* argv[], char const** envp) {
-	auto ctx = context{ envp };
+static bool run_arg(context& ctx, std::string_view arg);
 
-	if (argc == 1) {
-		ctx.fill_compiler_collection();
-		ctx.select_first_compiler();
-		if(cmd_config(ctx, "debug"))
-			if(cmd_build(ctx, ""))
-				cmd_unittest(ctx, "");
-		return 0;
-	}
-
-	auto const commands = std::unordered_map<std::string_view, bool(*)(context&, std::string_view)> {
+static auto const& get_commands() {
+	static auto const commands = std::unordered_map<std::string_view, bool(*)(context&, std::string_view)> {
 		{"version", cmd_version},
 		{"enum_cl", cmd_enum_cl},
 		{"get_cl", cmd_get_cl},
@@ -37,22 +33,56 @@ int main(const int argc, char const* argv[], char const** envp) {
 		{"clean", cmd_clean},
 		{"build", cmd_build},
 		{"ide", cmd_ide},
-		{"unittest", cmd_unittest}
+		{"unittest", cmd_unittest},
+		{"cache_server", cmd_cache_server},
+		{"worker", cmd_worker},
+		{"watch", cmd_watch},
+		{"daemon", [](context& ctx, std::string_view) { return run_daemon(ctx, run_arg); }}
 	};
+	return commands;
+}
 
-	for (auto const args = std::span(argv, static_cast<std::size_t>(argc)); std::string_view arg : args | std::views::drop(1)) {
-		std::string_view const cmd = arg.substr(0, arg.find('='));
-		if (!commands.contains(cmd)) {
-			std::println("<gbs> Unknown command '{}', aborting\n", cmd);
-			return 1;
-		}
+// Run a single 'command=args' argument
+static bool run_arg(context& ctx, std::string_view arg) {
+	auto const& commands = get_commands();
+	std::string_view const cmd = arg.substr(0, arg.find('='));
+	if (!commands.contains(cmd)) {
+		std::println("<gbs> Unknown command '{}', aborting\n", cmd);
+		return false;
+	}
+
+	arg.remove_prefix(cmd.size());
+	arg.remove_prefix(!arg.empty() && arg.front() == '=');
+	if (!commands.at(cmd)(ctx, arg)) {
+		std::println("<gbs> aborting due to command failure.");
+		return false;
+	}
+	return true;
+}
+
+int main(const int argc, char const* argv[], char const** envp) {
+	auto ctx = context{ envp };
+
+	if (argc == 1) {
+		// Let a running daemon do the default build
+		static constexpr std::string_view default_args[] = { "config=debug", "build", "unittest" };
+		if (auto const exit_code = forward_to_daemon(ctx, default_args))
+			return *exit_code;
+
+		ctx.select_first_compiler();
+		if(cmd_config(ctx, "debug"))
+			if(cmd_build(ctx, ""))
+				cmd_unittest(ctx, "");
+		return 0;
+	}
+
+	std::vector<std::string_view> const args(argv + 1, argv + argc);
+	if (auto const exit_code = forward_to_daemon(ctx, args))
+		return *exit_code;
 
-		arg.remove_prefix(cmd.size());
-		arg.remove_prefix(!arg.empty() && arg.front() == '=');
-		if (!commands.at(cmd)(ctx, arg)) {
-			std::println("<gbs> aborting due to command failure.");
+	for (std::string_view const arg : args) {
+		if (!run_arg(ctx, arg))
 			return 1;
-		}
 	}
 
 	return 0;
@@ -0,0 +1,221 @@
+module;
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <string_view>
+export module hash;
+
+// 64-bit xxHash (XXH64). Fast, non-cryptographic, and stable across platforms,
+// which is all that is needed to detect changes to files and command lines.
+namespace xxh64 {
+	constexpr std::uint64_t prime1 = 0x9E3779B185EBCA87ull;
+	constexpr std::uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+	constexpr std::uint64_t prime3 = 0x165667B19E3779F9ull;
+	constexpr std::uint64_t prime4 = 0x85EBCA77C2B2AE63ull;
+	constexpr std::uint64_t prime5 = 0x27D4EB2F165667C5ull;
+
+	static std::uint64_t read64(char const* p) {
+		std::uint64_t v;
+		std::memcpy(&v, p, sizeof(v));
+		if constexpr (std::endian::native == std::endian::big)
+			v = std::byteswap(v);
+		return v;
+	}
+
+	static std::uint32_t read32(char const* p) {
+		std::uint32_t v;
+		std::memcpy(&v, p, sizeof(v));
+		if constexpr (std::endian::native == std::endian::big)
+			v = std::byteswap(v);
+		return v;
+	}
+
+	static std::uint64_t round(std::uint64_t acc, std::uint64_t input) {
+		acc += input * prime2;
+		acc = std::rotl(acc, 31);
+		return acc * prime1;
+	}
+
+	static std::uint64_t merge_round(std::uint64_t acc, std::uint64_t val) {
+		acc ^= round(0, val);
+		return acc * prime1 + prime4;
+	}
+}
+
+// Hash a block of memory
+export std::uint64_t hash_bytes(std::string_view const data, std::uint64_t const seed = 0) {
+	using namespace xxh64;
+
+	char const* p = data.data();
+	char const* const end = p + data.size();
+	std::uint64_t h = 0;
+
+	if (data.size() >= 32) {
+		std::uint64_t v1 = seed + prime1 + prime2;
+		std::uint64_t v2 = seed + prime2;
+		std::uint64_t v3 = seed;
+		std::uint64_t v4 = seed - prime1;
+
+		char const* const limit = end - 32;
+		do {
+			v1 = round(v1, read64(p)); p += 8;
+			v2 = round(v2, read64(p)); p += 8;
+			v3 = round(v3, read64(p)); p += 8;
+			v4 = round(v4, read64(p)); p += 8;
+		} while (p <= limit);
+
+		h = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) + std::rotl(v4, 18);
+		h = merge_round(h, v1);
+		h = merge_round(h, v2);
+		h = merge_round(h, v3);
+		h = merge_round(h, v4);
+	}
+	else {
+		h = seed + prime5;
+	}
+
+	h += static_cast<std::uint64_t>(data.size());
+
+	for (; p + 8 <= end; p += 8) {
+		h ^= round(0, read64(p));
+		h = std::rotl(h, 27) * prime1 + prime4;
+	}
+
+	if (p + 4 <= end) {
+		h ^= static_cast<std::uint64_t>(read32(p)) * prime1;
+		h = std::rotl(h, 23) * prime2 + prime3;
+		p += 4;
+	}
+
+	for (; p < end; ++p) {
+		h ^= static_cast<std::uint64_t>(static_cast<unsigned char>(*p)) * prime5;
+		h = std::rotl(h, 11) * prime1;
+	}
+
+	h ^= h >> 33;
+	h *= prime2;
+	h ^= h >> 29;
+	h *= prime3;
+	h ^= h >> 32;
+	return h;
+}
+
+// Hash the contents of a file. Returns nothing if the file can't be read.
+export std::optional<std::uint64_t> hash_file(std::filesystem::path const& path) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		return std::nullopt;
+
+	std::error_code ec;
+	auto const size = std::filesystem::file_size(path, ec);
+	if (ec)
+		return std::nullopt;
+
+	std::string contents(static_cast<std::size_t>(size), '\0');
+	if (!file.read(contents.data(), static_cast<std::streamsize>(contents.size())))
+		return std::nullopt;
+
+	return hash_bytes(contents);
+}
+
+// Convert a hash to a fixed-width hex string
+export std::string hash_to_string(std::uint64_t const hash) {
+	constexpr std::string_view digits = "0123456789abcdef";
+	std::string str(16, '0');
+	for (std::size_t i = 0; i < 16; ++i)
+		str[15 - i] = digits[(hash >> (i * 4)) & 0xF];
+	return str;
+}
+
+// Convert a hex string back to a hash
+export std::optional<std::uint64_t> hash_from_string(std::string_view const str) {
+	if (str.empty() || str.size() > 16)
+		return std::nullopt;
+
+	std::uint64_t hash = 0;
+	for (char const c : str) {
+		hash <<= 4;
+		if (c >= '0' && c <= '9') hash |= static_cast<std::uint64_t>(c - '0');
+		else if (c >= 'a' && c <= 'f') hash |= static_cast<std::uint64_t>(c - 'a' + 10);
+		else if (c >= 'A' && c <= 'F') hash |= static_cast<std::uint64_t>(c - 'A' + 10);
+		else return std::nullopt;
+	}
+	return hash;
+}
+
+// SHA-256. Only used where other tools expect it, like the content keys of a remote cache.
+namespace sha256 {
+	constexpr std::array<std::uint32_t, 64> k{
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+	};
+
+	static void transform(std::array<std::uint32_t, 8>& state, unsigned char const* block) {
+		std::array<std::uint32_t, 64> w{};
+		for (std::size_t i = 0; i < 16; ++i)
+			w[i] = (std::uint32_t{ block[i * 4] } << 24) | (std::uint32_t{ block[i * 4 + 1] } << 16) | (std::uint32_t{ block[i * 4 + 2] } << 8) | std::uint32_t{ block[i * 4 + 3] };
+		for (std::size_t i = 16; i < 64; ++i) {
+			std::uint32_t const s0 = std::rotr(w[i - 15], 7) ^ std::rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			std::uint32_t const s1 = std::rotr(w[i - 2], 17) ^ std::rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+
+		auto [a, b, c, d, e, f, g, h] = state;
+		for (std::size_t i = 0; i < 64; ++i) {
+			std::uint32_t const s1 = std::rotr(e, 6) ^ std::rotr(e, 11) ^ std::rotr(e, 25);
+			std::uint32_t const ch = (e & f) ^ (~e & g);
+			std::uint32_t const t1 = h + s1 + ch + k[i] + w[i];
+			std::uint32_t const s0 = std::rotr(a, 2) ^ std::rotr(a, 13) ^ std::rotr(a, 22);
+			std::uint32_t const maj = (a & b) ^ (a & c) ^ (b & c);
+			std::uint32_t const t2 = s0 + maj;
+			h = g; g = f; f = e; e = d + t1;
+			d = c; c = b; b = a; a = t1 + t2;
+		}
+
+		state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+		state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+	}
+}
+
+// Get the SHA-256 of a block of memory as a 64 character hex string
+export std::string sha256_hex(std::string_view const data) {
+	std::array<std::uint32_t, 8> state{ 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+
+	auto const* bytes = reinterpret_cast<unsigned char const*>(data.data());
+	std::size_t const full_blocks = data.size() / 64;
+	for (std::size_t i = 0; i < full_blocks; ++i)
+		sha256::transform(state, bytes + i * 64);
+
+	// Pad the last block(s) with 0x80, zeros and the length in bits
+	std::array<unsigned char, 128> tail{};
+	std::size_t const rest = data.size() % 64;
+	std::memcpy(tail.data(), bytes + full_blocks * 64, rest);
+	tail[rest] = 0x80;
+	std::size_t const tail_size = rest < 56 ? 64 : 128;
+	std::uint64_t const bits = static_cast<std::uint64_t>(data.size()) * 8;
+	for (std::size_t i = 0; i < 8; ++i)
+		tail[tail_size - 1 - i] = static_cast<unsigned char>(bits >> (i * 8));
+
+	for (std::size_t i = 0; i < tail_size; i += 64)
+		sha256::transform(state, tail.data() + i);
+
+	constexpr std::string_view digits = "0123456789abcdef";
+	std::string str;
+	str.reserve(64);
+	for (std::uint32_t const word : state) {
+		for (int shift = 28; shift >= 0; shift -= 4)
+			str += digits[(word >> shift) & 0xF];
+	}
+	return str;
+}
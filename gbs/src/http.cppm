@@ -0,0 +1,192 @@
+module;
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+export module http;
+import net;
+
+// Minimal HTTP/1.1, enough for simple GET/PUT protocols like the one used by remote build caches
+
+// The largest body that is read. Larger messages are refused, so a bad Content-Length can't exhaust the memory.
+constexpr std::size_t max_body_size = std::size_t{ 1 } << 30;
+
+// The parts of an 'http://host:port/path' url
+export struct http_url {
+	std::string host;
+	std::uint16_t port = 80;
+
+	// Prefix for all request paths. Empty, or starting with '/' and without a trailing '/'.
+	std::string path;
+};
+
+export struct http_request {
+	std::string method;
+	std::string path;
+	std::string body;
+};
+
+export struct http_response {
+	int status = 0;
+	std::string body;
+};
+
+// Parse an 'http://host[:port][/path]' url. Returns nothing if it is malformed.
+export std::optional<http_url> parse_http_url(std::string_view url) {
+	if (!url.starts_with("http://"))
+		return std::nullopt;
+	url.remove_prefix(7);
+
+	http_url result;
+	auto const slash = url.find('/');
+	std::string_view const host_port = url.substr(0, slash);
+	if (slash != std::string_view::npos)
+		result.path = url.substr(slash);
+	while (result.path.ends_with('/'))
+		result.path.pop_back();
+
+	auto const colon = host_port.rfind(':');
+	result.host = host_port.substr(0, colon);
+	if (colon != std::string_view::npos) {
+		std::string_view const port = host_port.substr(colon + 1);
+		auto const [ptr, ec] = std::from_chars(port.data(), port.data() + port.size(), result.port);
+		if (ec != std::errc{} || ptr != port.data() + port.size())
+			return std::nullopt;
+	}
+
+	if (result.host.empty())
+		return std::nullopt;
+	return result;
+}
+
+// Read the headers and body of a request or response, after the first line has been read.
+// Returns nothing if the connection was closed, or the message is malformed or too large.
+static std::optional<std::string> read_message_body(tcp_socket& socket, bool& close_connection) {
+	std::size_t content_length = 0;
+	for (;;) {
+		auto const line = socket.read_line();
+		if (!line)
+			return std::nullopt;
+		if (line->empty())
+			break;
+
+		std::string_view const header = *line;
+		auto const colon = header.find(':');
+		if (colon == std::string_view::npos)
+			return std::nullopt;
+
+		std::string name{ header.substr(0, colon) };
+		for (char& c : name)
+			c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+
+		std::string_view value = header.substr(colon + 1);
+		while (value.starts_with(' '))
+			value.remove_prefix(1);
+
+		if (name == "content-length") {
+			auto const [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), content_length);
+			if (ec != std::errc{} || content_length > max_body_size)
+				return std::nullopt;
+		}
+		else if (name == "connection" && value == "close") {
+			close_connection = true;
+		}
+	}
+
+	return socket.read_exact(content_length);
+}
+
+// Send a request to a server. Returns nothing if the server could not be reached.
+export std::optional<http_response> send_http_request(http_url const& url, std::string_view const method, std::string_view const path, std::string_view const body = {}) {
+	tcp_socket socket = connect_tcp(url.host, url.port);
+	if (!socket.is_open())
+		return std::nullopt;
+	socket.set_timeout(std::chrono::seconds{ 30 });
+
+	std::string const request = std::format("{} {}{} HTTP/1.1\r\nHost: {}:{}\r\nContent-Length: {}\r\nConnection: close\r\n\r\n",
+		method, url.path, path, url.host, url.port, body.size());
+	if (!socket.send_all(request) || !socket.send_all(body))
+		return std::nullopt;
+
+	// 'HTTP/1.1 200 OK'
+	auto const status_line = socket.read_line();
+	if (!status_line || status_line->size() < 12 || !status_line->starts_with("HTTP/"))
+		return std::nullopt;
+
+	http_response response;
+	std::string_view const status = std::string_view{ *status_line }.substr(9, 3);
+	std::from_chars(status.data(), status.data() + status.size(), response.status);
+
+	bool close_connection = true;
+	auto response_body = read_message_body(socket, close_connection);
+	if (!response_body)
+		return std::nullopt;
+	response.body = std::move(*response_body);
+	return response;
+}
+
+static std::string_view status_text(int const status) {
+	switch (status) {
+	case 200: return "OK";
+	case 400: return "Bad Request";
+	case 404: return "Not Found";
+	case 405: return "Method Not Allowed";
+	default: return "Internal Server Error";
+	}
+}
+
+// Answer the requests of a connection until it is closed
+static void serve_connection(tcp_socket socket, std::function<http_response(http_request const&)> const& handler) {
+	socket.set_timeout(std::chrono::seconds{ 60 });
+
+	for (;;) {
+		// 'GET /path HTTP/1.1'
+		auto const request_line = socket.read_line();
+		if (!request_line)
+			return;
+
+		std::string_view const line = *request_line;
+		auto const first_space = line.find(' ');
+		auto const second_space = line.find(' ', first_space + 1);
+		if (first_space == std::string_view::npos || second_space == std::string_view::npos)
+			return;
+
+		http_request request;
+		request.method = line.substr(0, first_space);
+		request.path = line.substr(first_space + 1, second_space - first_space - 1);
+
+		bool close_connection = false;
+		auto body = read_message_body(socket, close_connection);
+		if (!body)
+			return;
+		request.body = std::move(*body);
+
+		http_response const response = handler(request);
+		std::string const header = std::format("HTTP/1.1 {} {}\r\nContent-Length: {}\r\n\r\n", response.status, status_text(response.status), response.body.size());
+		if (!socket.send_all(header) || (request.method != "HEAD" && !socket.send_all(response.body)))
+			return;
+
+		if (close_connection)
+			return;
+	}
+}
+
+// Serve requests on a listening socket. Each connection is handled on its own thread. Never returns.
+export void serve_http(tcp_listener& listener, std::function<http_response(http_request const&)> handler) {
+	for (;;) {
+		tcp_socket socket = listener.accept();
+		if (!socket.is_open())
+			continue;
+
+		std::thread([socket = std::move(socket), &handler]() mutable {
+			serve_connection(std::move(socket), handler);
+		}).detach();
+	}
+}
@@ -0,0 +1,295 @@
+module;
+#include <cstdint>
+#include <cstdlib>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+export module json;
+
+// A minimal json document, enough to read the dependency files produced by compilers
+export struct json_value {
+	enum class kind { null, boolean, number, string, array, object };
+
+	kind type = kind::null;
+	bool boolean = false;
+	double number = 0.0;
+	std::string string;
+
+	// Elements of an array, or values of an object
+	std::vector<json_value> values;
+
+	// Keys of an object. Matches the order of 'values'.
+	std::vector<std::string> keys;
+
+	[[nodiscard]] bool is_string() const noexcept { return type == kind::string; }
+	[[nodiscard]] bool is_array() const noexcept { return type == kind::array; }
+	[[nodiscard]] bool is_object() const noexcept { return type == kind::object; }
+
+	// Look up a member of an object. Returns nullptr if not found.
+	[[nodiscard]] json_value const* find(std::string_view const key) const {
+		if (type != kind::object)
+			return nullptr;
+		for (std::size_t i = 0; i < keys.size(); ++i) {
+			if (keys[i] == key)
+				return &values[i];
+		}
+		return nullptr;
+	}
+};
+
+class json_parser {
+	std::string_view text;
+	std::size_t pos = 0;
+
+public:
+	explicit json_parser(std::string_view const sv) : text(sv) {}
+
+	std::optional<json_value> parse_document() {
+		auto value = parse_value();
+		skip_whitespace();
+		if (!value || pos != text.size())
+			return std::nullopt;
+		return value;
+	}
+
+private:
+	void skip_whitespace() {
+		while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r'))
+			++pos;
+	}
+
+	bool consume(char const c) {
+		skip_whitespace();
+		if (pos < text.size() && text[pos] == c) {
+			++pos;
+			return true;
+		}
+		return false;
+	}
+
+	bool consume_literal(std::string_view const lit) {
+		if (text.substr(pos).starts_with(lit)) {
+			pos += lit.size();
+			return true;
+		}
+		return false;
+	}
+
+	std::optional<json_value> parse_value() {
+		skip_whitespace();
+		if (pos >= text.size())
+			return std::nullopt;
+
+		json_value value;
+		switch (text[pos]) {
+		case '{':
+			return parse_object();
+		case '[':
+			return parse_array();
+		case '"':
+			value.type = json_value::kind::string;
+			if (!parse_string(value.string))
+				return std::nullopt;
+			return value;
+		case 't':
+		case 'f':
+			value.type = json_value::kind::boolean;
+			value.boolean = text[pos] == 't';
+			if (!consume_literal(value.boolean ? "true" : "false"))
+				return std::nullopt;
+			return value;
+		case 'n':
+			if (!consume_literal("null"))
+				return std::nullopt;
+			return value;
+		default:
+			return parse_number();
+		}
+	}
+
+	std::optional<json_value> parse_object() {
+		json_value obj;
+		obj.type = json_value::kind::object;
+		++pos; // '{'
+
+		if (consume('}'))
+			return obj;
+
+		do {
+			skip_whitespace();
+			std::string key;
+			if (!parse_string(key) || !consume(':'))
+				return std::nullopt;
+
+			auto value = parse_value();
+			if (!value)
+				return std::nullopt;
+
+			obj.keys.push_back(std::move(key));
+			obj.values.push_back(std::move(*value));
+		} while (consume(','));
+
+		if (!consume('}'))
+			return std::nullopt;
+		return obj;
+	}
+
+	std::optional<json_value> parse_array() {
+		json_value arr;
+		arr.type = json_value::kind::array;
+		++pos; // '['
+
+		if (consume(']'))
+			return arr;
+
+		do {
+			auto value = parse_value();
+			if (!value)
+				return std::nullopt;
+			arr.values.push_back(std::move(*value));
+		} while (consume(','));
+
+		if (!consume(']'))
+			return std::nullopt;
+		return arr;
+	}
+
+	std::optional<json_value> parse_number() {
+		std::size_t const start = pos;
+		while (pos < text.size() && std::string_view{ "+-0123456789.eE" }.contains(text[pos]))
+			++pos;
+		if (start == pos)
+			return std::nullopt;
+
+		std::string const str{ text.substr(start, pos - start) };
+		char* end = nullptr;
+		json_value value;
+		value.type = json_value::kind::number;
+		value.number = std::strtod(str.c_str(), &end);
+		if (end != str.c_str() + str.size())
+			return std::nullopt;
+		return value;
+	}
+
+	std::optional<std::uint32_t> parse_hex4() {
+		if (pos + 4 > text.size())
+			return std::nullopt;
+
+		std::uint32_t cp = 0;
+		for (char const c : text.substr(pos, 4)) {
+			cp <<= 4;
+			if (c >= '0' && c <= '9') cp |= static_cast<std::uint32_t>(c - '0');
+			else if (c >= 'a' && c <= 'f') cp |= static_cast<std::uint32_t>(c - 'a' + 10);
+			else if (c >= 'A' && c <= 'F') cp |= static_cast<std::uint32_t>(c - 'A' + 10);
+			else return std::nullopt;
+		}
+		pos += 4;
+		return cp;
+	}
+
+	static void append_utf8(std::string& out, std::uint32_t const cp) {
+		if (cp < 0x80) {
+			out += static_cast<char>(cp);
+		}
+		else if (cp < 0x800) {
+			out += static_cast<char>(0xC0 | (cp >> 6));
+			out += static_cast<char>(0x80 | (cp & 0x3F));
+		}
+		else if (cp < 0x10000) {
+			out += static_cast<char>(0xE0 | (cp >> 12));
+			out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+			out += static_cast<char>(0x80 | (cp & 0x3F));
+		}
+		else {
+			out += static_cast<char>(0xF0 | (cp >> 18));
+			out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+			out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+			out += static_cast<char>(0x80 | (cp & 0x3F));
+		}
+	}
+
+	bool parse_string(std::string& out) {
+		if (pos >= text.size() || text[pos] != '"')
+			return false;
+		++pos;
+
+		while (pos < text.size()) {
+			char const c = text[pos++];
+			if (c == '"')
+				return true;
+			if (c != '\\') {
+				out += c;
+				continue;
+			}
+
+			if (pos >= text.size())
+				return false;
+
+			switch (text[pos++]) {
+			case '"': out += '"'; break;
+			case '\\': out += '\\'; break;
+			case '/': out += '/'; break;
+			case 'b': out += '\b'; break;
+			case 'f': out += '\f'; break;
+			case 'n': out += '\n'; break;
+			case 'r': out += '\r'; break;
+			case 't': out += '\t'; break;
+			case 'u': {
+				auto cp = parse_hex4();
+				if (!cp)
+					return false;
+
+				// Combine surrogate pairs
+				if (*cp >= 0xD800 && *cp <= 0xDBFF && text.substr(pos).starts_with("\\u")) {
+					pos += 2;
+					auto const low = parse_hex4();
+					if (!low)
+						return false;
+					cp = 0x10000 + ((*cp - 0xD800) << 10) + (*low - 0xDC00);
+				}
+				append_utf8(out, *cp);
+				break;
+			}
+			default:
+				return false;
+			}
+		}
+
+		return false;
+	}
+};
+
+// Parse a json document. Returns nothing if it is malformed.
+export std::optional<json_value> parse_json(std::string_view const text) {
+	return json_parser{ text }.parse_document();
+}
+
+// Quote a string for use in a json document
+export std::string json_quote(std::string_view const text) {
+	static constexpr char hex[] = "0123456789abcdef";
+
+	std::string out;
+	out.reserve(text.size() + 2);
+	out += '"';
+	for (char const c : text) {
+		switch (c) {
+		case '"': out += "\\\""; break;
+		case '\\': out += "\\\\"; break;
+		case '\n': out += "\\n"; break;
+		case '\r': out += "\\r"; break;
+		case '\t': out += "\\t"; break;
+		default:
+			if (static_cast<unsigned char>(c) < 0x20) {
+				out += "\\u00";
+				out += hex[(c >> 4) & 0xf];
+				out += hex[c & 0xf];
+			}
+			else {
+				out += c;
+			}
+		}
+	}
+	out += '"';
+	return out;
+}
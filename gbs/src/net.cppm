@@ -0,0 +1,297 @@
+module;
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <cerrno>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+export module net;
+
+#ifdef _WIN32
+using native_socket = SOCKET;
+constexpr native_socket invalid_socket = INVALID_SOCKET;
+
+static void close_socket(native_socket const s) {
+	closesocket(s);
+}
+#else
+using native_socket = int;
+constexpr native_socket invalid_socket = -1;
+
+static void close_socket(native_socket const s) {
+	close(s);
+}
+#endif
+
+// Winsock has to be started before any socket is created
+static bool init_sockets() {
+#ifdef _WIN32
+	static bool const started = [] {
+		WSADATA data{};
+		return 0 == WSAStartup(MAKEWORD(2, 2), &data);
+	}();
+	return started;
+#else
+	return true;
+#endif
+}
+
+// A connected TCP socket, with buffered reads. Closed when destroyed.
+export class tcp_socket {
+	native_socket sock = invalid_socket;
+
+	// Data received but not consumed yet
+	std::string buffer;
+
+public:
+	tcp_socket() = default;
+	explicit tcp_socket(native_socket const s) : sock(s) {}
+
+	tcp_socket(tcp_socket&& other) noexcept : sock(std::exchange(other.sock, invalid_socket)), buffer(std::move(other.buffer)) {}
+	tcp_socket& operator=(tcp_socket&& other) noexcept {
+		if (this != &other) {
+			close();
+			sock = std::exchange(other.sock, invalid_socket);
+			buffer = std::move(other.buffer);
+		}
+		return *this;
+	}
+
+	tcp_socket(tcp_socket const&) = delete;
+	tcp_socket& operator=(tcp_socket const&) = delete;
+
+	~tcp_socket() {
+		close();
+	}
+
+	[[nodiscard]] bool is_open() const noexcept {
+		return sock != invalid_socket;
+	}
+
+	void close() {
+		if (sock != invalid_socket)
+			close_socket(std::exchange(sock, invalid_socket));
+	}
+
+	// Fail reads and writes that take longer than 'timeout'
+	void set_timeout(std::chrono::milliseconds const timeout) {
+#ifdef _WIN32
+		DWORD const ms = static_cast<DWORD>(timeout.count());
+		setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<char const*>(&ms), sizeof(ms));
+		setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<char const*>(&ms), sizeof(ms));
+#else
+		timeval tv{};
+		tv.tv_sec = static_cast<decltype(tv.tv_sec)>(timeout.count() / 1000);
+		tv.tv_usec = static_cast<decltype(tv.tv_usec)>((timeout.count() % 1000) * 1000);
+		setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+#endif
+	}
+
+	// Send all of 'data'. Returns false if the connection failed.
+	bool send_all(std::string_view data) {
+		while (!data.empty()) {
+#ifdef _WIN32
+			int const n = ::send(sock, data.data(), static_cast<int>(std::min<std::size_t>(data.size(), 1 << 30)), 0);
+#else
+#ifdef MSG_NOSIGNAL
+			constexpr int flags = MSG_NOSIGNAL;
+#else
+			constexpr int flags = 0;
+#endif
+			ssize_t const n = ::send(sock, data.data(), data.size(), flags);
+			if (n < 0 && errno == EINTR)
+				continue;
+#endif
+			if (n <= 0)
+				return false;
+			data.remove_prefix(static_cast<std::size_t>(n));
+		}
+		return true;
+	}
+
+	// Read a line ending in '\n'. The line ending, including any '\r', is removed.
+	// Returns nothing if the connection is closed first.
+	std::optional<std::string> read_line() {
+		std::size_t start = 0;
+		for (;;) {
+			if (auto const pos = buffer.find('\n', start); pos != std::string::npos) {
+				std::string line = buffer.substr(0, pos);
+				buffer.erase(0, pos + 1);
+				if (line.ends_with('\r'))
+					line.pop_back();
+				return line;
+			}
+			start = buffer.size();
+			if (!fill())
+				return std::nullopt;
+		}
+	}
+
+	// Read exactly 'size' bytes. Returns nothing if the connection is closed first.
+	std::optional<std::string> read_exact(std::size_t const size) {
+		while (buffer.size() < size) {
+			if (!fill())
+				return std::nullopt;
+		}
+		std::string data = buffer.substr(0, size);
+		buffer.erase(0, size);
+		return data;
+	}
+
+	// Read until the other side closes the connection
+	std::string read_all() {
+		while (fill()) {}
+		return std::exchange(buffer, {});
+	}
+
+private:
+	// Receive more data into the buffer. Returns false on error or when the connection is closed.
+	bool fill() {
+		char chunk[16 * 1024];
+		for (;;) {
+#ifdef _WIN32
+			int const n = ::recv(sock, chunk, static_cast<int>(sizeof(chunk)), 0);
+#else
+			ssize_t const n = ::recv(sock, chunk, sizeof(chunk), 0);
+			if (n < 0 && errno == EINTR)
+				continue;
+#endif
+			if (n <= 0)
+				return false;
+			buffer.append(chunk, static_cast<std::size_t>(n));
+			return true;
+		}
+	}
+};
+
+// Connect to a TCP server. The returned socket is closed if the connection failed.
+export tcp_socket connect_tcp(std::string_view const host, std::uint16_t const port) {
+	if (!init_sockets())
+		return {};
+
+	addrinfo hints{};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	addrinfo* addresses = nullptr;
+	std::string const host_str{ host };
+	std::string const port_str = std::to_string(port);
+	if (0 != getaddrinfo(host_str.c_str(), port_str.c_str(), &hints, &addresses))
+		return {};
+
+	tcp_socket result;
+	for (addrinfo const* ai = addresses; ai != nullptr; ai = ai->ai_next) {
+		native_socket const s = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (s == invalid_socket)
+			continue;
+
+#ifdef _WIN32
+		int const addr_len = static_cast<int>(ai->ai_addrlen);
+#else
+		socklen_t const addr_len = ai->ai_addrlen;
+#endif
+		if (0 == ::connect(s, ai->ai_addr, addr_len)) {
+			// Requests are small and answered right away, so don't wait to fill packets
+			int const one = 1;
+			setsockopt(s, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<char const*>(&one), sizeof(one));
+			result = tcp_socket{ s };
+			break;
+		}
+		close_socket(s);
+	}
+
+	freeaddrinfo(addresses);
+	return result;
+}
+
+// A socket listening for TCP connections
+export class tcp_listener {
+	native_socket sock = invalid_socket;
+
+public:
+	// Listen on 'port' on all interfaces, or only on the loopback interface if 'local_only' is set
+	tcp_listener(std::uint16_t const port, bool const local_only) {
+		in_addr addr{};
+		addr.s_addr = htonl(local_only ? INADDR_LOOPBACK : INADDR_ANY);
+		listen_on(port, addr);
+	}
+
+	// Listen on 'port' on the interface with the IPv4 address 'address', eg. '0.0.0.0' for all of them
+	tcp_listener(std::uint16_t const port, std::string const& address) {
+		in_addr addr{};
+		if (init_sockets() && 1 == inet_pton(AF_INET, address.c_str(), &addr))
+			listen_on(port, addr);
+	}
+
+	tcp_listener(tcp_listener const&) = delete;
+	tcp_listener& operator=(tcp_listener const&) = delete;
+
+	~tcp_listener() {
+		if (sock != invalid_socket)
+			close_socket(sock);
+	}
+
+	[[nodiscard]] bool is_open() const noexcept {
+		return sock != invalid_socket;
+	}
+
+	// The port being listened on. Useful when listening on port 0.
+	[[nodiscard]] std::uint16_t port() const {
+		sockaddr_in addr{};
+		socklen_t len = sizeof(addr);
+		if (0 != getsockname(sock, reinterpret_cast<sockaddr*>(&addr), &len))
+			return 0;
+		return ntohs(addr.sin_port);
+	}
+
+	// Wait for the next connection
+	tcp_socket accept() {
+		for (;;) {
+			native_socket const s = ::accept(sock, nullptr, nullptr);
+#ifndef _WIN32
+			if (s == invalid_socket && errno == EINTR)
+				continue;
+#endif
+			return tcp_socket{ s };
+		}
+	}
+
+private:
+	void listen_on(std::uint16_t const port, in_addr const address) {
+		if (!init_sockets())
+			return;
+
+		sock = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (sock == invalid_socket)
+			return;
+
+		int const one = 1;
+		setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<char const*>(&one), sizeof(one));
+
+		sockaddr_in addr{};
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		addr.sin_addr = address;
+		if (0 != ::bind(sock, reinterpret_cast<sockaddr const*>(&addr), sizeof(addr)) || 0 != ::listen(sock, SOMAXCONN)) {
+			close_socket(std::exchange(sock, invalid_socket));
+		}
+	}
+};
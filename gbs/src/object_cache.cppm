@@ -0,0 +1,555 @@
+module;
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ranges>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+export module object_cache;
+import hash;
+import build_db;
+import cache_backend;
+import process;
+import thread_pool;
+
+namespace fs = std::filesystem;
+
+constexpr std::string_view manifest_header = "gbs.cache 2";
+
+// Number of dependency sets remembered per input key
+constexpr std::size_t max_manifest_entries = 8;
+
+// Temporary files older than this are left over from a build that was interrupted
+constexpr std::chrono::hours stale_temp_age{ 1 };
+
+// A set of dependencies that produced a cached result
+struct manifest_entry {
+	std::uint64_t result_key = 0;
+	std::vector<object_dependency> deps;
+};
+
+// The files of a cached result
+struct cached_result {
+	std::string obj;
+	std::optional<std::string> bmi;
+	std::int64_t build_ms = 0;
+	std::uint64_t peak_memory = 0;
+};
+
+// Module interfaces are covered by the result keys of the modules, which are the same
+// on every machine, unlike the module files themselves.
+static bool is_module_file(fs::path const& path) {
+	auto const ext = path.extension();
+	return ext == ".pcm" || ext == ".gcm" || ext == ".ifc";
+}
+
+static std::optional<std::string> read_file(fs::path const& path) {
+	std::ifstream in(path, std::ios::binary);
+	if (!in)
+		return std::nullopt;
+	return std::string{ std::istreambuf_iterator<char>(in), {} };
+}
+
+// Parse the entries of a manifest, most recent first
+static std::vector<manifest_entry> parse_manifest(std::string_view const text) {
+	std::vector<manifest_entry> entries;
+
+	std::istringstream in{ std::string{ text } };
+	std::string line;
+	if (!std::getline(in, line) || line != manifest_header)
+		return entries;
+
+	while (std::getline(in, line)) {
+		std::string_view const sv = line;
+		if (sv.starts_with("entry\t")) {
+			auto const result_key = hash_from_string(sv.substr(6));
+			if (!result_key)
+				return {};
+			entries.push_back({ *result_key, {} });
+		}
+		else if (sv.starts_with("dep\t") && !entries.empty() && sv.size() > 21 && sv[20] == '\t') {
+			auto const hash = hash_from_string(sv.substr(4, 16));
+			if (!hash)
+				return {};
+			entries.back().deps.push_back({ fs::path{ sv.substr(21) }, *hash });
+		}
+		else {
+			return {};
+		}
+	}
+
+	return entries;
+}
+
+static std::string format_manifest(std::vector<manifest_entry> const& entries) {
+	std::string text{ manifest_header };
+	text += '\n';
+	for (manifest_entry const& e : entries) {
+		text += std::format("entry\t{}\n", hash_to_string(e.result_key));
+		for (object_dependency const& dep : e.deps)
+			text += std::format("dep\t{}\t{}\n", hash_to_string(dep.hash), dep.path.generic_string());
+	}
+	return text;
+}
+
+// The key of a manifest or result in a remote cache
+static std::string remote_key(std::uint64_t const key) {
+	return sha256_hex(std::format("gbs-{}", hash_to_string(key)));
+}
+
+// Content-addressed cache of object files and module interfaces, shared by all builds of a user.
+//
+// Headers used by a source are only known after compiling it, so lookups go through a manifest:
+//   manifests/<input key>  lists the headers, and their hashes, seen for a command and source.
+//   objects/<result key>/  holds the object file and module interface built from them.
+//   tmp/                   holds results being written, which are renamed into 'objects' when complete.
+// The input key covers the compiler, the compile command and the source, and the result keys of the modules it imports.
+// The output directory is left out of the command, so configurations with the same flags share results.
+// The result key adds the content of all the headers, including those compiled into the imported modules.
+//
+// An optional remote cache is checked when the local cache misses, and new results are uploaded to it
+// in the background. It stores the manifests and results in its action cache, and the files in its content store.
+export class object_cache {
+	fs::path root;
+	std::uint64_t max_size;
+	std::uint64_t compiler_key;
+
+	// The output directory of the build, as it appears in compile commands
+	std::string out_dir;
+
+	std::mutex mtx;
+
+	// Result keys of the module interfaces built or restored in this run, or found in the build database
+	std::unordered_map<fs::path, std::uint64_t> module_keys;
+
+	// Hashes of the commands of the objects being built, without the output directory
+	std::unordered_map<fs::path, std::uint64_t> command_keys;
+
+	std::atomic<std::size_t> hits{ 0 };
+	std::atomic<std::size_t> remote_hits{ 0 };
+	std::atomic<std::size_t> misses{ 0 };
+
+	std::unique_ptr<cache_backend> remote;
+
+	// Uploads to the remote cache. Declared last, so it finishes the pending uploads before anything else is destroyed.
+	std::unique_ptr<thread_pool> uploads;
+
+public:
+	object_cache(fs::path root, std::uint64_t const max_size, std::uint64_t const compiler_key, fs::path const& out_dir, std::unique_ptr<cache_backend> remote_cache = {})
+		: root(std::move(root)), max_size(max_size), compiler_key(compiler_key), out_dir(out_dir.generic_string()), remote(std::move(remote_cache)) {
+		std::error_code ec;
+		fs::create_directories(this->root / "manifests", ec);
+		fs::create_directories(this->root / "objects", ec);
+		fs::create_directories(this->root / "tmp", ec);
+
+		if (remote)
+			uploads = std::make_unique<thread_pool>(2);
+	}
+
+	// Record the command an object is about to be built with. Called along with 'build_db::begin_object'.
+	// The response files are hashed by content, and the output directory is replaced, like for the shared std module.
+	void begin_object(build_db& db, fs::path const& obj, std::string_view const cmd) {
+		std::uint64_t hash = 0;
+		for (fs::path const& response_file : get_response_files(cmd))
+			hash = hash_bytes(hash_to_string(db.file_hash(response_file).value_or(0)), hash);
+
+		std::string command{ cmd };
+		for (auto pos = command.find(out_dir); !out_dir.empty() && pos != std::string::npos; pos = command.find(out_dir, pos + 1))
+			command.replace(pos, out_dir.size(), "<out>");
+		hash = hash_bytes(command, hash);
+
+		std::scoped_lock lock(mtx);
+		command_keys[obj.lexically_normal()] = hash;
+	}
+
+	// The key for an object about to be built. Must be called after 'begin_object'.
+	// Returns nothing if an imported module has no result key, eg. because it was built without the cache,
+	// in which case the object is not cached.
+	std::optional<std::uint64_t> input_key(build_db& db, fs::path const& obj) {
+		auto const record = db.pending_record(obj);
+		if (!record)
+			return std::nullopt;
+
+		std::uint64_t key = hash_bytes(hash_to_string(compiler_key));
+		{
+			std::scoped_lock lock(mtx);
+			auto const it = command_keys.find(obj.lexically_normal());
+			if (it == command_keys.end())
+				return std::nullopt;
+			key = hash_bytes(hash_to_string(it->second), key);
+		}
+		key = hash_bytes(hash_to_string(record->source_hash), key);
+
+		// The only dependencies known before compiling are the imported module interfaces
+		std::vector<fs::path> modules;
+		for (object_dependency const& dep : record->deps)
+			modules.push_back(dep.path);
+		std::ranges::sort(modules);
+
+		for (fs::path const& module : modules) {
+			auto const module_key = find_module_key(db, module);
+			if (!module_key)
+				return std::nullopt;
+			key = hash_bytes(hash_to_string(*module_key), key);
+		}
+		return key;
+	}
+
+	// Restore an object, and its module interface, from the local cache, or from the remote cache if that misses.
+	// On success the object is committed to the build database with the dependencies it was built from.
+	bool restore(build_db& db, std::uint64_t const key, fs::path const& source, fs::path const& obj, std::optional<fs::path> const& bmi) {
+		if (restore_local(db, key, source, obj, bmi)) {
+			hits += 1;
+			return true;
+		}
+
+		if (remote && fetch_remote(db, key) && restore_local(db, key, source, obj, bmi)) {
+			remote_hits += 1;
+			return true;
+		}
+
+		misses += 1;
+		return false;
+	}
+
+	// Store a freshly built object, and its module interface, in the cache
+	void store(build_db& db, std::uint64_t const key, fs::path const& source, fs::path const& obj, std::optional<fs::path> const& bmi,
+		std::vector<fs::path> const& deps, std::chrono::milliseconds const build_time, std::uint64_t const peak_memory) {
+		manifest_entry entry;
+		for (fs::path const& dep : deps) {
+			if (is_module_file(dep) || dep.lexically_normal() == source.lexically_normal())
+				continue;
+
+			// Objects using files that can't be read from here can't be verified later
+			auto const hash = db.file_hash(dep);
+			if (!hash)
+				return;
+			entry.deps.push_back({ dep.lexically_normal(), *hash });
+		}
+		std::ranges::sort(entry.deps, {}, &object_dependency::path);
+		auto const dupes = std::ranges::unique(entry.deps, {}, &object_dependency::path);
+		entry.deps.erase(dupes.begin(), dupes.end());
+
+		entry.result_key = key;
+		for (object_dependency const& dep : entry.deps)
+			entry.result_key = hash_bytes(hash_to_string(dep.hash), hash_bytes(dep.path.generic_string(), entry.result_key));
+
+		cached_result result{ {}, {}, build_time.count(), peak_memory };
+		auto obj_data = read_file(obj);
+		if (!obj_data)
+			return;
+		result.obj = std::move(*obj_data);
+		if (bmi) {
+			result.bmi = read_file(*bmi);
+			if (!result.bmi)
+				return;
+		}
+
+		if (!write_result(entry.result_key, result))
+			return;
+
+		db.set_cache_key(obj, entry.result_key);
+		if (bmi) {
+			std::scoped_lock lock(mtx);
+			module_keys[source.lexically_normal()] = entry.result_key;
+		}
+
+		std::uint64_t const result_key = entry.result_key;
+		std::string manifest = add_manifest_entry(key, std::move(entry));
+
+		if (uploads) {
+			uploads->enqueue([this, key, result_key, result = std::move(result), manifest = std::move(manifest)] {
+				upload(key, result_key, result, manifest);
+			});
+		}
+	}
+
+	[[nodiscard]] std::size_t get_hits() const noexcept {
+		return hits;
+	}
+
+	[[nodiscard]] std::size_t get_remote_hits() const noexcept {
+		return remote_hits;
+	}
+
+	[[nodiscard]] std::size_t get_misses() const noexcept {
+		return misses;
+	}
+
+	// Remove the least recently used entries until the cache fits in its size limit, then the manifests whose results
+	// are all gone. Other builds may be storing results at the same time, so only stale temporary files are removed.
+	void evict() {
+		struct object_dir {
+			fs::path path;
+			fs::file_time_type last_used;
+			std::uintmax_t size = 0;
+		};
+
+		std::vector<object_dir> dirs;
+		std::uintmax_t total = 0;
+
+		std::error_code ec;
+		remove_stale_temp_files(root / "tmp");
+		remove_stale_temp_files(root / "manifests");
+		remove_stale_temp_files(root / "objects");
+
+		for (fs::directory_entry const& dir : fs::directory_iterator(root / "objects", ec)) {
+			// Results are renamed into place complete, so every directory here has an 'info' file
+			object_dir od{ dir.path(), fs::last_write_time(dir.path() / "info", ec) };
+			if (ec)
+				continue;
+
+			for (fs::directory_entry const& file : fs::directory_iterator(dir.path(), ec))
+				od.size += file.file_size(ec);
+			total += od.size;
+			dirs.push_back(std::move(od));
+		}
+
+		if (total <= max_size)
+			return;
+
+		std::ranges::sort(dirs, {}, &object_dir::last_used);
+		for (object_dir const& od : dirs) {
+			if (total <= max_size)
+				break;
+			fs::remove_all(od.path, ec);
+			total -= od.size;
+		}
+
+		for (fs::directory_entry const& file : fs::directory_iterator(root / "manifests", ec)) {
+			if (file.path().extension() == ".tmp")
+				continue;
+
+			auto const text = read_file(file.path());
+			if (!text)
+				continue;
+			auto const entries = parse_manifest(*text);
+			bool const used = std::ranges::any_of(entries, [this](manifest_entry const& entry) {
+				std::error_code exists_ec;
+				return fs::exists(result_dir(entry.result_key), exists_ec);
+			});
+			if (!used)
+				fs::remove(file.path(), ec);
+		}
+	}
+
+private:
+	// Remove the temporary files and directories in 'dir' that are too old to belong to a build still running
+	static void remove_stale_temp_files(fs::path const& dir) {
+		auto const cutoff = fs::file_time_type::clock::now() - stale_temp_age;
+
+		std::error_code ec;
+		for (fs::directory_entry const& entry : fs::directory_iterator(dir, ec)) {
+			if (entry.path().extension() != ".tmp")
+				continue;
+			auto const mtime = fs::last_write_time(entry.path(), ec);
+			if (!ec && mtime < cutoff)
+				fs::remove_all(entry.path(), ec);
+		}
+	}
+
+	// Get the result key of an imported module. Modules that are up to date were not built or restored in this run,
+	// so their key is taken from the build database.
+	std::optional<std::uint64_t> find_module_key(build_db const& db, fs::path const& module) {
+		{
+			std::scoped_lock lock(mtx);
+			if (auto const it = module_keys.find(module); it != module_keys.end())
+				return it->second;
+		}
+
+		auto const key = db.source_cache_key(module);
+		if (key) {
+			std::scoped_lock lock(mtx);
+			module_keys.try_emplace(module, *key);
+		}
+		return key;
+	}
+
+	fs::path manifest_path(std::uint64_t const key) const {
+		return root / "manifests" / hash_to_string(key);
+	}
+
+	fs::path result_dir(std::uint64_t const result_key) const {
+		return root / "objects" / hash_to_string(result_key);
+	}
+
+	std::vector<manifest_entry> read_manifest(std::uint64_t const key) const {
+		auto const text = read_file(manifest_path(key));
+		return text ? parse_manifest(*text) : std::vector<manifest_entry>{};
+	}
+
+	static bool matches(build_db& db, manifest_entry const& entry) {
+		return std::ranges::all_of(entry.deps, [&db](object_dependency const& dep) {
+			return db.file_hash(dep.path) == dep.hash;
+		});
+	}
+
+	bool restore_local(build_db& db, std::uint64_t const key, fs::path const& source, fs::path const& obj, std::optional<fs::path> const& bmi) {
+		for (manifest_entry const& entry : read_manifest(key)) {
+			if (!matches(db, entry))
+				continue;
+
+			fs::path const dir = result_dir(entry.result_key);
+			std::ifstream info(dir / "info");
+			std::int64_t build_ms = 0;
+			std::uint64_t peak_memory = 0;
+			if (!(info >> build_ms >> peak_memory))
+				continue;
+
+			std::error_code ec;
+			fs::copy_file(dir / "obj", obj, fs::copy_options::overwrite_existing, ec);
+			if (!ec && bmi)
+				fs::copy_file(dir / "bmi", *bmi, fs::copy_options::overwrite_existing, ec);
+			if (ec)
+				continue;
+
+			// Mark the entry as recently used
+			fs::last_write_time(dir / "info", fs::file_time_type::clock::now(), ec);
+
+			for (object_dependency const& dep : entry.deps)
+				db.add_dependency(obj, dep.path);
+			db.commit_object(obj, std::chrono::milliseconds{ build_ms }, peak_memory);
+			db.set_cache_key(obj, entry.result_key);
+
+			if (bmi) {
+				std::scoped_lock lock(mtx);
+				module_keys[source.lexically_normal()] = entry.result_key;
+			}
+			return true;
+		}
+
+		return false;
+	}
+
+	// Write a result to the local cache. The files are written to a temporary directory outside 'objects' first,
+	// so other builds never see or evict a partial entry.
+	bool write_result(std::uint64_t const result_key, cached_result const& result) {
+		fs::path const dir = result_dir(result_key);
+		fs::path const tmp_dir = unique_temp_path(root / "tmp" / hash_to_string(result_key));
+
+		std::error_code ec;
+		fs::create_directories(tmp_dir, ec);
+
+		auto const write = [&tmp_dir](std::string_view const name, std::string_view const data) {
+			std::ofstream out(tmp_dir / name, std::ios::binary);
+			out.write(data.data(), static_cast<std::streamsize>(data.size()));
+			return static_cast<bool>(out);
+		};
+
+		bool const written = !ec
+			&& write("obj", result.obj)
+			&& (!result.bmi || write("bmi", *result.bmi))
+			&& write("info", std::format("{} {}\n", result.build_ms, result.peak_memory));
+		if (written)
+			fs::rename(tmp_dir, dir, ec);
+		fs::remove_all(tmp_dir, ec);
+
+		return fs::exists(dir / "info");
+	}
+
+	// Add an entry to the front of a manifest. Returns the new manifest.
+	std::string add_manifest_entry(std::uint64_t const key, manifest_entry&& entry) {
+		std::scoped_lock lock(mtx);
+
+		std::vector<manifest_entry> entries = read_manifest(key);
+		std::erase_if(entries, [&entry](manifest_entry const& e) { return e.result_key == entry.result_key; });
+		entries.insert(entries.begin(), std::move(entry));
+		if (entries.size() > max_manifest_entries)
+			entries.resize(max_manifest_entries);
+
+		std::string const text = format_manifest(entries);
+
+		fs::path const path = manifest_path(key);
+		fs::path const tmp_path = unique_temp_path(path);
+		bool written = false;
+		{
+			std::ofstream out(tmp_path, std::ios::binary);
+			out << text;
+			written = static_cast<bool>(out);
+		}
+
+		std::error_code ec;
+		if (written)
+			fs::rename(tmp_path, path, ec);
+		if (!written || ec)
+			fs::remove(tmp_path, ec);
+		return text;
+	}
+
+	// Look for a matching result in the remote cache, and copy it to the local cache
+	bool fetch_remote(build_db& db, std::uint64_t const key) {
+		auto const manifest = remote->get("ac", remote_key(key));
+		if (!manifest)
+			return false;
+
+		for (manifest_entry& entry : parse_manifest(*manifest)) {
+			if (!matches(db, entry))
+				continue;
+
+			// 'obj <sha256>', 'bmi <sha256>' and 'info <build ms> <peak memory>'
+			auto const record = remote->get("ac", remote_key(entry.result_key));
+			if (!record)
+				continue;
+
+			cached_result result;
+			bool valid = true;
+			std::istringstream in{ *record };
+			std::string field;
+			while (valid && in >> field) {
+				std::string hash;
+				if (field == "info") {
+					valid = static_cast<bool>(in >> result.build_ms >> result.peak_memory);
+				}
+				else if ((field == "obj" || field == "bmi") && in >> hash) {
+					auto blob = remote->get("cas", hash);
+					valid = blob && sha256_hex(*blob) == hash;
+					if (valid)
+						(field == "obj" ? result.obj : result.bmi.emplace()) = std::move(*blob);
+				}
+				else {
+					valid = false;
+				}
+			}
+
+			if (!valid || result.obj.empty() || !write_result(entry.result_key, result))
+				continue;
+
+			add_manifest_entry(key, std::move(entry));
+			return true;
+		}
+
+		return false;
+	}
+
+	// Upload a result to the remote cache. The files go first, so the manifest never refers to missing data.
+	void upload(std::uint64_t const key, std::uint64_t const result_key, cached_result const& result, std::string const& manifest) {
+		std::string record;
+
+		std::string const obj_hash = sha256_hex(result.obj);
+		if (!remote->put("cas", obj_hash, result.obj))
+			return;
+		record += std::format("obj {}\n", obj_hash);
+
+		if (result.bmi) {
+			std::string const bmi_hash = sha256_hex(*result.bmi);
+			if (!remote->put("cas", bmi_hash, *result.bmi))
+				return;
+			record += std::format("bmi {}\n", bmi_hash);
+		}
+
+		record += std::format("info {} {}\n", result.build_ms, result.peak_memory);
+		if (remote->put("ac", remote_key(result_key), record))
+			remote->put("ac", remote_key(key), manifest);
+	}
+};
@@ -0,0 +1,267 @@
+module;
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <format>
+#include <mutex>
+#include <print>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <crt_externs.h>
+#endif
+#endif
+export module process;
+
+// The result of running a process
+export struct process_result {
+	// The exit code of the process. -1 if it could not be started.
+	int exit_code = -1;
+
+	// Everything the process wrote to stdout and stderr
+	std::string output;
+
+	// Peak resident memory of the process in bytes. 0 if unknown.
+	std::uint64_t peak_memory = 0;
+
+	[[nodiscard]] bool succeeded() const noexcept {
+		return exit_code == 0;
+	}
+};
+
+// Split a command line into arguments.
+// Arguments are separated by whitespace. Double quotes group whitespace into a single argument,
+// and inside quotes a backslash escapes the next character, which matches the output of '{:?}'.
+export std::vector<std::string> split_command_line(std::string_view const cmd) {
+	std::vector<std::string> args;
+	std::string arg;
+	bool in_arg = false;
+	bool in_quotes = false;
+
+	for (std::size_t i = 0; i < cmd.size(); ++i) {
+		char const c = cmd[i];
+
+		if (in_quotes) {
+			if (c == '"')
+				in_quotes = false;
+			else if (c == '\\' && i + 1 < cmd.size())
+				arg += cmd[++i];
+			else
+				arg += c;
+		}
+		else if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+			if (in_arg) {
+				args.push_back(std::move(arg));
+				arg.clear();
+				in_arg = false;
+			}
+		}
+		else {
+			in_arg = true;
+			if (c == '"')
+				in_quotes = true;
+			else
+				arg += c;
+		}
+	}
+
+	if (in_arg)
+		args.push_back(std::move(arg));
+
+	return args;
+}
+
+#ifdef _WIN32
+// Windows: CreateProcess parses the command line itself, so it is passed along as-is.
+// Only the write end of the output pipe is inherited by the child.
+// The process runs in 'working_dir' if it is set, otherwise in the current directory.
+export process_result run_process(std::string_view const command_line, std::filesystem::path const& working_dir = {}) {
+	process_result result;
+
+	SECURITY_ATTRIBUTES sa{ sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE };
+	HANDLE read_pipe = nullptr;
+	HANDLE write_pipe = nullptr;
+	if (!CreatePipe(&read_pipe, &write_pipe, &sa, 0)) {
+		result.output = std::format("<gbs> Error: could not create pipe for '{}'\n", command_line);
+		return result;
+	}
+	SetHandleInformation(read_pipe, HANDLE_FLAG_INHERIT, 0);
+
+	SIZE_T attr_size = 0;
+	InitializeProcThreadAttributeList(nullptr, 1, 0, &attr_size);
+	std::vector<char> attr_buffer(attr_size);
+	auto const attr_list = reinterpret_cast<LPPROC_THREAD_ATTRIBUTE_LIST>(attr_buffer.data());
+	InitializeProcThreadAttributeList(attr_list, 1, 0, &attr_size);
+	UpdateProcThreadAttribute(attr_list, 0, PROC_THREAD_ATTRIBUTE_HANDLE_LIST, &write_pipe, sizeof(HANDLE), nullptr, nullptr);
+
+	STARTUPINFOEXA si{};
+	si.StartupInfo.cb = sizeof(STARTUPINFOEXA);
+	si.StartupInfo.dwFlags = STARTF_USESTDHANDLES;
+	si.StartupInfo.hStdInput = nullptr;
+	si.StartupInfo.hStdOutput = write_pipe;
+	si.StartupInfo.hStdError = write_pipe;
+	si.lpAttributeList = attr_list;
+
+	PROCESS_INFORMATION pi{};
+	std::string cmd{ command_line };
+	std::string const dir = working_dir.string();
+	BOOL const created = CreateProcessA(nullptr, cmd.data(), nullptr, nullptr, TRUE, EXTENDED_STARTUPINFO_PRESENT, nullptr,
+		dir.empty() ? nullptr : dir.c_str(), &si.StartupInfo, &pi);
+	DeleteProcThreadAttributeList(attr_list);
+	CloseHandle(write_pipe);
+
+	if (!created) {
+		CloseHandle(read_pipe);
+		result.output = std::format("<gbs> Error: could not start '{}' (error {})\n", command_line, GetLastError());
+		return result;
+	}
+
+	char buffer[4096];
+	DWORD bytes_read = 0;
+	while (ReadFile(read_pipe, buffer, sizeof(buffer), &bytes_read, nullptr) && bytes_read > 0)
+		result.output.append(buffer, bytes_read);
+	CloseHandle(read_pipe);
+
+	WaitForSingleObject(pi.hProcess, INFINITE);
+	DWORD exit_code = 0;
+	GetExitCodeProcess(pi.hProcess, &exit_code);
+	result.exit_code = static_cast<int>(exit_code);
+
+	PROCESS_MEMORY_COUNTERS counters{};
+	if (GetProcessMemoryInfo(pi.hProcess, &counters, sizeof(counters)))
+		result.peak_memory = counters.PeakWorkingSetSize;
+
+	CloseHandle(pi.hThread);
+	CloseHandle(pi.hProcess);
+	return result;
+}
+#else
+static char** get_environment() {
+#ifdef __APPLE__
+	return *_NSGetEnviron();
+#else
+	return environ;
+#endif
+}
+
+// Create a pipe whose ends are not inherited by other processes spawned in parallel
+static bool create_pipe(int (&fds)[2]) {
+#ifdef __linux__
+	return 0 == pipe2(fds, O_CLOEXEC);
+#else
+	if (0 != pipe(fds))
+		return false;
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	return true;
+#endif
+}
+
+// POSIX: the command line is split into arguments and the executable is spawned directly, without a shell.
+// The process runs in 'working_dir' if it is set, otherwise in the current directory.
+export process_result run_process(std::string_view const command_line, std::filesystem::path const& working_dir = {}) {
+	process_result result;
+
+	std::vector<std::string> args = split_command_line(command_line);
+	if (args.empty()) {
+		result.output = "<gbs> Error: empty command line\n";
+		return result;
+	}
+
+	std::vector<char*> argv;
+	for (std::string& arg : args)
+		argv.push_back(arg.data());
+	argv.push_back(nullptr);
+
+	int fds[2];
+	if (!create_pipe(fds)) {
+		result.output = std::format("<gbs> Error: could not create pipe for '{}'\n", command_line);
+		return result;
+	}
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, fds[1], STDERR_FILENO);
+	if (!working_dir.empty())
+		posix_spawn_file_actions_addchdir_np(&actions, working_dir.c_str());
+
+	pid_t pid = 0;
+	int const spawn_error = posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), get_environment());
+	posix_spawn_file_actions_destroy(&actions);
+	close(fds[1]);
+
+	if (spawn_error != 0) {
+		close(fds[0]);
+		result.output = std::format("<gbs> Error: could not start '{}' (error {})\n", args[0], spawn_error);
+		return result;
+	}
+
+	char buffer[4096];
+	for (;;) {
+		ssize_t const n = read(fds[0], buffer, sizeof(buffer));
+		if (n > 0)
+			result.output.append(buffer, static_cast<std::size_t>(n));
+		else if (n == 0 || errno != EINTR)
+			break;
+	}
+	close(fds[0]);
+
+	// The usage reported by wait4 also covers the children the process waited for,
+	// so the peak includes eg. 'cc1plus' spawned by the gcc driver.
+	int status = 0;
+	rusage usage{};
+	while (wait4(pid, &status, 0, &usage) == -1 && errno == EINTR) {}
+
+#ifdef __APPLE__
+	result.peak_memory = static_cast<std::uint64_t>(usage.ru_maxrss);
+#else
+	result.peak_memory = static_cast<std::uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+
+	if (WIFEXITED(status))
+		result.exit_code = WEXITSTATUS(status);
+	else if (WIFSIGNALED(status))
+		result.exit_code = 128 + WTERMSIG(status);
+	return result;
+}
+#endif
+
+// Print the output of a process in one go, so output from parallel jobs doesn't interleave
+export void print_output(std::string_view const output) {
+	if (output.empty())
+		return;
+
+	static std::mutex print_mtx;
+	std::scoped_lock lock(print_mtx);
+	std::print("{}", output);
+	if (!output.ends_with('\n'))
+		std::println();
+	std::fflush(stdout);
+}
+
+// Get a path next to 'path' for a file that is written and then renamed to 'path'.
+// The name holds the process id and a random number, so writers in other threads and processes never share it.
+export std::filesystem::path unique_temp_path(std::filesystem::path const& path) {
+#ifdef _WIN32
+	auto const pid = GetCurrentProcessId();
+#else
+	auto const pid = getpid();
+#endif
+	std::random_device rd;
+	return std::filesystem::path{ path }.concat(std::format(".{}.{:08x}{:08x}.tmp", pid, rd(), rd()));
+}
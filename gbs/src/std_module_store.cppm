@@ -0,0 +1,55 @@
+module;
+#include <cstdint>
+#include <filesystem>
+#include <random>
+#include <string_view>
+#include <system_error>
+export module std_module_store;
+import hash;
+
+namespace fs = std::filesystem;
+
+// Prebuilt std modules, shared by all configurations and projects on the machine.
+// Each is stored as '~/.gbs/std/<compiler>/<key>/', holding the object and the module interface.
+export class std_module_store {
+	fs::path dir;
+
+public:
+	std_module_store(fs::path const& root, std::string_view const compiler, std::uint64_t const key)
+		: dir(root / compiler / hash_to_string(key)) {}
+
+	[[nodiscard]] fs::path const& path() const noexcept {
+		return dir;
+	}
+
+	// Copy the prebuilt module to 'obj' and 'bmi'. Returns false if it hasn't been built yet.
+	bool restore(fs::path const& obj, fs::path const& bmi) const {
+		std::error_code ec;
+		fs::copy_file(dir / obj.filename(), obj, fs::copy_options::overwrite_existing, ec);
+		if (!ec)
+			fs::copy_file(dir / bmi.filename(), bmi, fs::copy_options::overwrite_existing, ec);
+		return !ec;
+	}
+
+	// Add a module that was built here. Does nothing if it is already in the store.
+	void add(fs::path const& obj, fs::path const& bmi) const {
+		std::error_code ec;
+		if (fs::exists(dir, ec))
+			return;
+
+		// Filled in a temporary directory and renamed, so other builds never see a partial module
+		std::random_device rd;
+		fs::path const tmp = fs::path{ dir }.concat(".tmp" + hash_to_string(rd()));
+		fs::create_directories(tmp, ec);
+		if (!ec)
+			fs::copy_file(obj, tmp / obj.filename(), ec);
+		if (!ec)
+			fs::copy_file(bmi, tmp / bmi.filename(), ec);
+		if (!ec)
+			fs::rename(tmp, dir, ec);
+
+		// Another build may have added it first
+		if (ec)
+			fs::remove_all(tmp, ec);
+	}
+};
@@ -0,0 +1,249 @@
+module;
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <vector>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+export module jobserver;
+
+namespace fs = std::filesystem;
+
+static void set_makeflags(std::optional<std::string> const& value) {
+#ifdef _WIN32
+	_putenv_s("MAKEFLAGS", value ? value->c_str() : "");
+#else
+	if (value)
+		setenv("MAKEFLAGS", value->c_str(), 1);
+	else
+		unsetenv("MAKEFLAGS");
+#endif
+}
+
+// Announce a jobserver in MAKEFLAGS, keeping the other flags of the parent. Job counts and jobservers of the parent
+// are replaced, since the children have to use this one. Variable overrides after ' -- ' are kept at the end.
+static std::string announce_jobserver(std::optional<std::string_view> const current, std::size_t const jobs, std::string_view const auth) {
+	std::string flags;
+	std::string overrides;
+	for (auto const word : current.value_or("") | std::views::split(' ')) {
+		std::string_view const sv{ word.begin(), word.end() };
+		if (!overrides.empty() || sv == "--") {
+			overrides += ' ';
+			overrides += sv;
+			continue;
+		}
+		if (sv.empty() || sv.starts_with("-j") || sv.starts_with("--jobserver-"))
+			continue;
+		flags += sv;
+		flags += ' ';
+	}
+	return flags + std::format("-j{} --jobserver-auth={}", jobs, auth) + overrides;
+}
+
+// GNU make compatible jobserver.
+// Every process owns one implicit job slot; additional slots are tokens that must be taken from
+// the jobserver before starting a job, and handed back when it is done.
+// gbs either joins the jobserver of a parent make/ninja, as announced in MAKEFLAGS, or creates
+// one so that child processes like 'ld -flto=jobserver' and nested builds share the same slots.
+export class jobserver {
+#ifdef _WIN32
+	HANDLE semaphore = nullptr;
+	std::size_t held_tokens = 0;
+#else
+	int read_fd = -1;
+	int write_fd = -1;
+	bool owns_fds = false;
+	fs::path fifo_path;
+
+	// The bytes read from the jobserver. They are written back on release.
+	std::vector<char> held_tokens;
+#endif
+	std::mutex mtx;
+	bool implicit_token_free = true;
+
+	// The value of MAKEFLAGS before it was changed, if it was
+	std::optional<std::optional<std::string>> old_makeflags;
+
+	jobserver() = default;
+
+public:
+	jobserver(jobserver const&) = delete;
+	jobserver& operator=(jobserver const&) = delete;
+
+	~jobserver() {
+#ifdef _WIN32
+		if (semaphore != nullptr)
+			CloseHandle(semaphore);
+#else
+		if (owns_fds) {
+			close(read_fd);
+			if (write_fd != read_fd)
+				close(write_fd);
+		}
+		if (!fifo_path.empty())
+			unlink(fifo_path.c_str());
+#endif
+		if (old_makeflags)
+			set_makeflags(*old_makeflags);
+	}
+
+	// Join the jobserver announced in MAKEFLAGS, if any
+	static std::unique_ptr<jobserver> connect(std::string_view const makeflags) {
+		std::string_view auth;
+		for (auto const subrange : makeflags | std::views::split(' ')) {
+			std::string_view const flag{ subrange.begin(), subrange.end() };
+			if (flag.starts_with("--jobserver-auth="))
+				auth = flag.substr(17);
+			else if (flag.starts_with("--jobserver-fds="))
+				auth = flag.substr(16);
+		}
+
+		if (auth.empty())
+			return {};
+
+		std::unique_ptr<jobserver> js{ new jobserver };
+#ifdef _WIN32
+		js->semaphore = OpenSemaphoreA(SYNCHRONIZE | SEMAPHORE_MODIFY_STATE, FALSE, std::string{ auth }.c_str());
+		if (js->semaphore == nullptr)
+			return {};
+#else
+		if (auth.starts_with("fifo:")) {
+			std::string const path{ auth.substr(5) };
+			js->read_fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+			js->write_fd = js->read_fd;
+			js->owns_fds = true;
+			if (js->read_fd == -1)
+				return {};
+		}
+		else {
+			// Inherited pipe, 'R,W'
+			auto const comma = auth.find(',');
+			if (comma == std::string_view::npos)
+				return {};
+
+			auto const parse_fd = [](std::string_view sv) {
+				int fd = -1;
+				std::from_chars(sv.data(), sv.data() + sv.size(), fd);
+				return fd;
+			};
+			js->read_fd = parse_fd(auth.substr(0, comma));
+			js->write_fd = parse_fd(auth.substr(comma + 1));
+
+			// make closes the pipe for recipes that aren't marked as recursive
+			if (js->read_fd < 0 || js->write_fd < 0 || fcntl(js->read_fd, F_GETFD) == -1 || fcntl(js->write_fd, F_GETFD) == -1)
+				return {};
+		}
+#endif
+		return js;
+	}
+
+	// Create a new jobserver with 'jobs' slots, and announce it to child processes through MAKEFLAGS
+	static std::unique_ptr<jobserver> create(std::size_t const jobs, std::optional<std::string_view> const current_makeflags) {
+		std::unique_ptr<jobserver> js{ new jobserver };
+#ifdef _WIN32
+		std::string const name = std::format("gbs_jobserver_{}", GetCurrentProcessId());
+		LONG const tokens = static_cast<LONG>(jobs > 1 ? jobs - 1 : 0);
+		js->semaphore = CreateSemaphoreA(nullptr, tokens, std::max<LONG>(tokens, 1), name.c_str());
+		if (js->semaphore == nullptr)
+			return {};
+		std::string const auth = name;
+#else
+		std::error_code ec;
+		js->fifo_path = fs::temp_directory_path(ec) / std::format("gbs-jobserver-{}", getpid());
+		if (ec || 0 != mkfifo(js->fifo_path.c_str(), 0600)) {
+			js->fifo_path.clear();
+			return {};
+		}
+
+		js->read_fd = open(js->fifo_path.c_str(), O_RDWR | O_CLOEXEC);
+		js->write_fd = js->read_fd;
+		js->owns_fds = true;
+		if (js->read_fd == -1)
+			return {};
+
+		for (std::size_t i = 1; i < jobs; ++i) {
+			char const token = '+';
+			if (1 != write(js->write_fd, &token, 1))
+				return {};
+		}
+		std::string const auth = "fifo:" + js->fifo_path.string();
+#endif
+
+		js->old_makeflags = current_makeflags ? std::optional<std::string>{ *current_makeflags } : std::nullopt;
+		set_makeflags(announce_jobserver(current_makeflags, jobs, auth));
+		return js;
+	}
+
+	// Take a job slot. Blocks until one is available. Returns false if the jobserver is gone, in which case the job
+	// runs without a slot and must not call 'release'.
+	[[nodiscard]] bool acquire() {
+		{
+			std::scoped_lock lock(mtx);
+			if (implicit_token_free) {
+				implicit_token_free = false;
+				return true;
+			}
+		}
+
+#ifdef _WIN32
+		if (WaitForSingleObject(semaphore, INFINITE) != WAIT_OBJECT_0)
+			return false;
+		std::scoped_lock lock(mtx);
+		held_tokens += 1;
+#else
+		char token = 0;
+		for (;;) {
+			ssize_t const n = read(read_fd, &token, 1);
+			if (n == 1)
+				break;
+			if (n < 0 && errno == EINTR)
+				continue;
+
+			// The jobserver is gone. Run the job anyway instead of deadlocking.
+			return false;
+		}
+		std::scoped_lock lock(mtx);
+		held_tokens.push_back(token);
+#endif
+		return true;
+	}
+
+	// Hand back a job slot taken by 'acquire'. Tokens are returned before the implicit slot is freed,
+	// so other processes waiting on the jobserver get them as soon as possible.
+	void release() {
+		std::unique_lock lock(mtx);
+#ifdef _WIN32
+		if (held_tokens > 0) {
+			held_tokens -= 1;
+			lock.unlock();
+			ReleaseSemaphore(semaphore, 1, nullptr);
+			return;
+		}
+#else
+		if (!held_tokens.empty()) {
+			char const token = held_tokens.back();
+			held_tokens.pop_back();
+			lock.unlock();
+			while (write(write_fd, &token, 1) < 0 && errno == EINTR) {}
+			return;
+		}
+#endif
+		implicit_token_free = true;
+	}
+};
@@ -0,0 +1,111 @@
+module;
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+export module resource_limits;
+
+// Get the amount of memory that can be used without swapping, in bytes.
+// Returns nullopt if it is not known on this platform.
+export std::optional<std::uint64_t> available_system_memory() {
+#ifdef _WIN32
+	MEMORYSTATUSEX status{};
+	status.dwLength = sizeof(status);
+	if (!GlobalMemoryStatusEx(&status))
+		return std::nullopt;
+	return status.ullAvailPhys;
+#else
+	// Linux: 'MemAvailable:    12345678 kB'
+	std::ifstream meminfo("/proc/meminfo");
+	std::string key;
+	std::uint64_t value = 0;
+	std::string unit;
+	while (meminfo >> key >> value >> unit) {
+		if (key == "MemAvailable:")
+			return value * 1024;
+	}
+	return std::nullopt;
+#endif
+}
+
+// Limits on the tasks that run at the same time.
+// A task is only started if its expected peak memory fits within the memory budget next to the
+// running tasks, and in the memory currently available on the system.
+// Links have a separate concurrency limit.
+// A task is always started if nothing else is running, so a single large job can't stall the build.
+export class resource_limits {
+	std::mutex mtx;
+
+	// 0 means no limit
+	std::uint64_t memory_budget = 0;
+	std::size_t max_links = 0;
+
+	std::uint64_t memory_in_use = 0;
+	std::size_t running = 0;
+	std::size_t links_running = 0;
+
+	// The available system memory is read at most this often, since every ready task is checked against it
+	static constexpr std::chrono::milliseconds memory_sample_interval{ 100 };
+	std::optional<std::uint64_t> available_memory;
+	std::chrono::steady_clock::time_point memory_sampled{};
+
+public:
+	resource_limits(std::uint64_t const memory_budget, std::size_t const max_links)
+		: memory_budget(memory_budget), max_links(max_links) {
+	}
+
+	// Reserve resources for a task with the expected memory use. Returns false if it can't be started yet.
+	// Never blocks, so a caller holding a job slot can give it back and try again later.
+	bool try_acquire(std::uint64_t const memory, bool const is_link) {
+		std::scoped_lock lock(mtx);
+		if (!can_start(memory, is_link))
+			return false;
+
+		memory_in_use += memory;
+		running += 1;
+		if (is_link)
+			links_running += 1;
+		return true;
+	}
+
+	// Called when a task started with 'try_acquire' is done
+	void release(std::uint64_t const memory, bool const is_link) {
+		std::scoped_lock lock(mtx);
+		memory_in_use -= memory;
+		running -= 1;
+		if (is_link)
+			links_running -= 1;
+	}
+
+private:
+	std::optional<std::uint64_t> sample_available_memory() {
+		auto const now = std::chrono::steady_clock::now();
+		if (now - memory_sampled >= memory_sample_interval) {
+			available_memory = available_system_memory();
+			memory_sampled = now;
+		}
+		return available_memory;
+	}
+
+	bool can_start(std::uint64_t const memory, bool const is_link) {
+		if (is_link && max_links > 0 && links_running >= max_links)
+			return false;
+
+		if (running == 0 || memory_budget == 0)
+			return true;
+
+		if (memory_in_use + memory > memory_budget)
+			return false;
+
+		auto const available = sample_available_memory();
+		return !available || memory <= *available;
+	}
+};
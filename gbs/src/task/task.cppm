@@ -1,13 +1,52 @@
 module;
 #include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <functional>
 #include <memory>
+#include <string>
 #include <vector>
 export module task;
 
+// What a task does. Used to apply resource limits.
+export enum class task_kind {
+	other,
+	compile,
+	link
+};
+
 export struct task {
-	std::function<void()> work;
+	// Name of the task, usually the file it builds
+	std::string name;
+
+	// The work to do. Returns false if it failed.
+	std::function<bool()> work;
+
+	// Optional quick check run before the work, on a separate pool of I/O threads.
+	// Returns true if the result is already available, in which case the work is not run.
+	std::function<bool()> lookup;
+
 	std::atomic_int32_t deps = 0;
+
+	// Set if a task this one depends on failed or was skipped
+	std::atomic_bool skip = false;
+
+	task_kind kind = task_kind::other;
+
+	// Expected run time of this task in milliseconds
+	std::int64_t cost = 0;
+
+	// Expected peak memory use of this task in bytes
+	std::uint64_t memory = 0;
+
+	// Expected run time of the longest chain of tasks starting at this one.
+	// Ready tasks with the highest priority are run first.
+	std::int64_t priority = -1;
+
+	// When the work was started and finished. Left empty if the task did not run.
+	std::chrono::steady_clock::time_point started;
+	std::chrono::steady_clock::time_point finished;
+
 	std::vector<std::shared_ptr<task>> children;
 };
 
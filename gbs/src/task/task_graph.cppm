@@ -1,21 +1,27 @@
 module;
-#include <condition_variable>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <filesystem>
 #include <functional>
 #include <memory>
-#include <queue>
+#include <mutex>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 export module task_graph;
 import task;
 import thread_pool;
+import resource_limits;
 
 export class task_graph {
 public:
 	explicit task_graph(size_t threads = std::thread::hardware_concurrency()) : pool(threads) {}
 
-	task_ptr create_task(std::filesystem::path const& name, std::function<void()> work) {
+	task_ptr create_task(std::filesystem::path const& name, std::function<bool()> work) {
 		task_ptr t = std::make_shared<task>();
+		t->name = name.generic_string();
 		if (!name.empty())
 			task_names[name] = t;
 		t->work = std::move(work);
@@ -29,78 +35,213 @@ public:
 		parent->children.push_back(child);
 	}
 
+	// Only start compiles and links while their expected memory use fits in 'memory_budget' bytes,
+	// and run at most 'max_links' links at a time. 0 means no limit.
+	void limit_resources(std::uint64_t const memory_budget, std::size_t const max_links) {
+		limits = std::make_unique<resource_limits>(memory_budget, max_links);
+	}
+
 	task_ptr find_task(std::filesystem::path const& name) const {
 		if (task_names.contains(name))
 			return task_names.at(name);
 		return {};
 	}
 
-	void run() {
-		// Initialize ready queue with tasks that have no deps
-		{
-			std::lock_guard<std::mutex> lock(ready_mtx);
-			for (auto& t : tasks) {
-				if (t->deps.load(std::memory_order_relaxed) == 0) {
-					ready.push(t);
-				}
-			}
-		}
-		
+	// Run all tasks. Tasks that depend on a failed task are skipped.
+	// Unless 'keep_going' is set, no new tasks are started after the first failure.
+	// Returns true if all tasks succeeded.
+	bool run(bool const keep_going = false) {
+		keep_going_on_failure = keep_going;
+		failed.store(false, std::memory_order_relaxed);
+
 		// Count remaining tasks
 		remaining.store(static_cast<int>(tasks.size()), std::memory_order_relaxed);
-		
+		if (tasks.empty())
+			return true;
+
+		compute_priorities();
+
+		// Lookups mostly wait on disk or network, so they get their own threads
+		if (!io_pool && std::ranges::any_of(tasks, [](task_ptr const& t) { return static_cast<bool>(t->lookup); }))
+			io_pool = std::make_unique<thread_pool>(io_threads);
+
+		// Find the tasks that have no deps before starting any of them,
+		// since running tasks decrement the deps of their children.
+		std::vector<task_ptr> ready;
+		for (auto& t : tasks) {
+			if (t->deps.load(std::memory_order_relaxed) == 0)
+				ready.push_back(t);
+		}
+
 		// Kick off initial tasks
-		schedule_ready_tasks();
-		
+		for (auto& t : ready)
+			schedule(t);
+
 		// Wait until all tasks are done
-		std::unique_lock<std::mutex> lock(done_mtx);
-		done_cv.wait(lock, [&] { return remaining.load(std::memory_order_acquire) == 0; });
+		for (int r = remaining.load(std::memory_order_acquire); r != 0; r = remaining.load(std::memory_order_acquire))
+			remaining.wait(r, std::memory_order_acquire);
+
+		return !failed.load(std::memory_order_acquire);
+	}
+
+	// The chain of tasks that determined the length of the last run.
+	// Starts at the task that finished last, and follows the dependency that finished last back to the start.
+	std::vector<task_ptr> critical_path() const {
+		auto const ran = [](task_ptr const& t) { return t->finished != std::chrono::steady_clock::time_point{}; };
+
+		std::unordered_map<task const*, std::vector<task_ptr>> parents;
+		task_ptr current;
+		for (auto const& t : tasks) {
+			for (auto const& child : t->children)
+				parents[child.get()].push_back(t);
+			if (ran(t) && (!current || t->finished > current->finished))
+				current = t;
+		}
+
+		std::vector<task_ptr> path;
+		while (current) {
+			path.push_back(current);
+
+			task_ptr next;
+			for (auto const& parent : parents[current.get()]) {
+				if (ran(parent) && (!next || parent->finished > next->finished))
+					next = parent;
+			}
+			current = next;
+		}
+
+		std::ranges::reverse(path);
+		return path;
 	}
 
 private:
-	void schedule_ready_tasks() {
-		for (;;) {
-			task_ptr t;
-			{
-				std::lock_guard<std::mutex> lock(ready_mtx);
-				if (ready.empty())
-					break;
-				
-				t = ready.front();
-				ready.pop();
+	// Give each task a priority equal to the expected time of the longest chain of tasks
+	// starting at it, so tasks on the critical path are dispatched first.
+	void compute_priorities() {
+		for (auto& t : tasks)
+			t->priority = -1;
+
+		for (auto const& t : tasks)
+			longest_path(t);
+	}
+
+	static std::int64_t longest_path(task_ptr const& t) {
+		if (t->priority >= 0)
+			return t->priority;
+
+		std::int64_t longest_child = 0;
+		for (auto const& child : t->children)
+			longest_child = std::max(longest_child, longest_path(child));
+
+		t->priority = t->cost + longest_child;
+		return t->priority;
+	}
+
+	// Hand a ready task to the pool. When called from a worker, the task
+	// goes to that worker's own queue, so no shared ready queue is needed.
+	// Tasks with a lookup go through the I/O pool first.
+	void schedule(task_ptr const& t) {
+		if (t->lookup && io_pool)
+			io_pool->enqueue([this, t] { lookup(t); }, t->priority);
+		else
+			pool.enqueue([this, t] { execute(t); }, t->priority);
+	}
+
+	void lookup(task_ptr const& t) {
+		bool const cancelled = !keep_going_on_failure && failed.load(std::memory_order_acquire);
+		if (t->skip.load(std::memory_order_acquire) || cancelled) {
+			finish(t, false);
+			return;
+		}
+
+		t->started = std::chrono::steady_clock::now();
+		if (t->lookup()) {
+			t->finished = std::chrono::steady_clock::now();
+			finish(t, true);
+			return;
+		}
+
+		pool.enqueue([this, t] { execute(t); }, t->priority);
+	}
+
+	static bool timed_work(task& t) {
+		t.started = std::chrono::steady_clock::now();
+		bool const succeeded = t.work();
+		t.finished = std::chrono::steady_clock::now();
+		return succeeded;
+	}
+
+	void execute(task_ptr const& t) {
+		bool const cancelled = !keep_going_on_failure && failed.load(std::memory_order_acquire);
+		if (t->skip.load(std::memory_order_acquire) || cancelled) {
+			finish(t, false);
+			return;
+		}
+
+		if (!limits || t->kind == task_kind::other) {
+			finish(t, timed_work(*t));
+			return;
+		}
+
+		// Tasks that don't fit yet are parked instead of waiting in the pool,
+		// so the worker and its job slot are free for other work in the meantime.
+		bool const is_link = t->kind == task_kind::link;
+		{
+			std::scoped_lock lock(waiting_mtx);
+			if (!limits->try_acquire(t->memory, is_link)) {
+				waiting.push_back(t);
+				return;
 			}
-			
-			pool.enqueue([this, t] {
-				t->work();
-
-				for (auto& child : t->children) {
-					int old = child->deps.fetch_sub(1, std::memory_order_acq_rel);
-					if (old == 1) {
-						{
-							std::lock_guard<std::mutex> lock(ready_mtx);
-							ready.push(child);
-						}
-						
-						schedule_ready_tasks(); // opportunistically schedule more
-					}
-				}
-				
-				// Decrement global remaining counter
-				if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
-					std::lock_guard<std::mutex> lock(done_mtx);
-					done_cv.notify_all();
-				}
-				});
 		}
+
+		bool const succeeded = timed_work(*t);
+
+		// Give the parked tasks another try now that resources are free
+		std::vector<task_ptr> retry;
+		{
+			std::scoped_lock lock(waiting_mtx);
+			limits->release(t->memory, is_link);
+			retry.swap(waiting);
+		}
+		for (auto const& w : retry)
+			pool.enqueue([this, w] { execute(w); }, w->priority);
+
+		finish(t, succeeded);
+	}
+
+	void finish(task_ptr const& t, bool const succeeded) {
+		if (!succeeded)
+			failed.store(true, std::memory_order_release);
+
+		for (auto& child : t->children) {
+			if (!succeeded)
+				child->skip.store(true, std::memory_order_release);
+
+			if (child->deps.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				schedule(child);
+		}
+
+		// Decrement global remaining counter
+		if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			remaining.notify_all();
 	}
 
 private:
-	std::queue<task_ptr> ready;
 	std::vector<task_ptr> tasks;
 	std::unordered_map<std::filesystem::path, task_ptr> task_names;
 	std::atomic<int> remaining{ 0 };
-	std::mutex ready_mtx;
-	std::mutex done_mtx;
-	std::condition_variable done_cv;
+	std::atomic_bool failed{ false };
+	bool keep_going_on_failure = false;
+	std::unique_ptr<resource_limits> limits;
+
+	// Tasks waiting for resources. A task is only parked while another one holds resources,
+	// and that one moves them back to the pool when it is done.
+	std::mutex waiting_mtx;
+	std::vector<task_ptr> waiting;
+
 	thread_pool pool;
+
+	// Created on the first run with lookups. Declared after 'pool', so it is stopped first.
+	static constexpr std::size_t io_threads = 8;
+	std::unique_ptr<thread_pool> io_pool;
 };
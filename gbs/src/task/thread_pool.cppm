@@ -1,61 +1,208 @@
 module;
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
+#include <cstdint>
 #include <functional>
 #include <memory>
 #include <mutex>
-#include <queue>
 #include <thread>
 #include <vector>
 export module thread_pool;
 import task;
 
+// The pool and queue index of the current worker thread, if any
+thread_local void const* current_pool = nullptr;
+thread_local std::size_t current_queue = 0;
+
+// Work-stealing thread pool.
+// Each worker has its own queue, ordered by job priority. Jobs enqueued from a worker go to its own queue.
+// Idle workers steal the most important job from the other queues.
+// There is no global lock; the per-worker locks are only contended when stealing.
 export class thread_pool{
+	struct job_entry {
+		std::int64_t priority = 0;
+		std::uint64_t sequence = 0;
+		std::function<void()> job;
+
+		// Heap order: highest priority first, then oldest first
+		friend bool operator<(job_entry const& a, job_entry const& b) noexcept {
+			if (a.priority != b.priority)
+				return a.priority < b.priority;
+			return a.sequence > b.sequence;
+		}
+	};
+
+	struct worker_queue {
+		std::mutex mtx;
+		std::vector<job_entry> jobs;
+
+		void push(job_entry&& entry) {
+			jobs.push_back(std::move(entry));
+			std::push_heap(jobs.begin(), jobs.end());
+		}
+
+		std::function<void()> pop() {
+			std::pop_heap(jobs.begin(), jobs.end());
+			std::function<void()> job = std::move(jobs.back().job);
+			jobs.pop_back();
+			return job;
+		}
+	};
+
 public:
 	thread_pool(size_t n = std::thread::hardware_concurrency()) {
-		for (size_t i = 0; i < n; ++i) {
-			workers.emplace_back([this] {
-				for (;!stop;) {
-					std::function<void()> job;
+		if (n == 0)
+			n = 1;
 
-					{
-						std::unique_lock lock(mtx);
-						cv.wait(lock, [&] { return stop || !jobs.empty(); });
+		for (size_t i = 0; i < n; ++i)
+			queues.push_back(std::make_unique<worker_queue>());
 
-						if (stop && jobs.empty())
-							return;
+		for (size_t i = 0; i < n; ++i) {
+			workers.emplace_back([this, i] {
+				current_pool = this;
+				current_queue = i;
 
-						job = std::move(jobs.front());
-						jobs.pop();
+				for (;;) {
+					std::function<void()> job;
+					if (pop_local(i, job) || steal(i, job)) {
+						pending.fetch_sub(1);
+						job();
+						continue;
 					}
-					
-					job();
+
+					if (stop)
+						return;
+
+					// Sleep until something is enqueued. Reading the epoch before checking
+					// for pending jobs ensures a concurrent enqueue is never missed.
+					auto const epoch = wake_epoch.load();
+					if (pending.load() > 0 || stop)
+						continue;
+					wake_epoch.wait(epoch);
 				}
 				});
 		}
 	}
 
 	~thread_pool() {
-		{
-			std::scoped_lock lock(mtx);
-			stop = true;
-		}
-		cv.notify_all();
+		stop = true;
+		wake_epoch.fetch_add(1);
+		wake_epoch.notify_all();
 		for (auto& t : workers)
 			t.join();
 	}
-	
-	void enqueue(std::function<void()> job) {
+
+	// Add a job to the pool. Jobs with higher priority are run first.
+	void enqueue(std::function<void()> job, std::int64_t const priority = 0) {
+		std::size_t const index = (current_pool == this)
+			? current_queue
+			: next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+
+		job_entry entry{ priority, sequence.fetch_add(1, std::memory_order_relaxed), std::move(job) };
+
+		// Counted before it can be taken, so a worker's decrement never goes below zero
+		pending.fetch_add(1);
 		{
-			std::lock_guard lock(mtx);
-			jobs.push(std::move(job));
+			std::scoped_lock lock(queues[index]->mtx);
+			queues[index]->push(std::move(entry));
 		}
-		cv.notify_one();
+
+		wake_epoch.fetch_add(1);
+		wake_epoch.notify_one();
+	}
+
+	[[nodiscard]] std::size_t size() const noexcept {
+		return workers.size();
 	}
 
 private:
+	bool pop_local(std::size_t const index, std::function<void()>& job) {
+		worker_queue& q = *queues[index];
+		std::scoped_lock lock(q.mtx);
+		if (q.jobs.empty())
+			return false;
+
+		job = q.pop();
+		return true;
+	}
+
+	// Take the most important job from the other queues. The top of the chosen queue may change before it is
+	// locked again, in which case its new top is taken.
+	bool steal(std::size_t const thief, std::function<void()>& job) {
+		for (;;) {
+			std::size_t best = queues.size();
+			job_entry top;
+			for (std::size_t offset = 1; offset < queues.size(); ++offset) {
+				std::size_t const index = (thief + offset) % queues.size();
+				worker_queue& q = *queues[index];
+				std::scoped_lock lock(q.mtx);
+				if (q.jobs.empty())
+					continue;
+
+				// The heap keeps the most important job at the front
+				job_entry const& front = q.jobs.front();
+				if (best == queues.size() || top < front) {
+					top.priority = front.priority;
+					top.sequence = front.sequence;
+					best = index;
+				}
+			}
+
+			if (best == queues.size())
+				return false;
+
+			worker_queue& q = *queues[best];
+			std::scoped_lock lock(q.mtx);
+			if (q.jobs.empty())
+				continue;
+
+			job = q.pop();
+			return true;
+		}
+	}
+
+private:
+	std::vector<std::unique_ptr<worker_queue>> queues;
 	std::vector<std::thread> workers;
-	std::queue<std::function<void()>> jobs;
+	std::atomic<std::size_t> pending{ 0 };
+	std::atomic<std::uint32_t> wake_epoch{ 0 };
+	std::atomic<std::size_t> next_queue{ 0 };
+	std::atomic<std::uint64_t> sequence{ 0 };
+	std::atomic_bool stop{ false };
+};
+
+// A set of jobs run on a pool, which can be waited on. Jobs may add more jobs to the set while they run.
+export class job_group {
+	thread_pool& pool;
 	std::mutex mtx;
-	std::condition_variable cv;
-	bool stop = false;
+	std::condition_variable done;
+	std::size_t outstanding = 0;
+
+public:
+	explicit job_group(thread_pool& p) : pool(p) {}
+
+	job_group(job_group const&) = delete;
+	job_group& operator=(job_group const&) = delete;
+
+	void run(std::function<void()> job) {
+		{
+			std::scoped_lock lock(mtx);
+			outstanding += 1;
+		}
+
+		pool.enqueue([this, job = std::move(job)] {
+			job();
+
+			std::scoped_lock lock(mtx);
+			if (--outstanding == 0)
+				done.notify_all();
+			});
+	}
+
+	// Wait for all jobs in the set, including the ones added while waiting
+	void wait() {
+		std::unique_lock lock(mtx);
+		done.wait(lock, [this] { return outstanding == 0; });
+	}
 };
@@ -0,0 +1,74 @@
+module;
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+export module unity;
+
+namespace fs = std::filesystem;
+
+// Get the names a source declares 'static' at file scope, eg. helper functions and constants.
+// Only declarations starting a line are seen, since members and locals are indented.
+// Names in an anonymous namespace are not found, so sources with one return nothing and are compiled on their own.
+export std::optional<std::set<std::string>> find_static_names(fs::path const& path) {
+	std::set<std::string> names;
+	std::ifstream in(path, std::ios::binary);
+	std::string line;
+	while (std::getline(in, line)) {
+		// 'namespace {' or 'namespace{', possibly indented inside a named namespace
+		std::string_view trimmed = line;
+		while (!trimmed.empty() && std::isspace(static_cast<unsigned char>(trimmed.front())))
+			trimmed.remove_prefix(1);
+		if (trimmed.starts_with("namespace")) {
+			trimmed.remove_prefix(9);
+			while (!trimmed.empty() && std::isspace(static_cast<unsigned char>(trimmed.front())))
+				trimmed.remove_prefix(1);
+			if (trimmed.empty() || trimmed.front() == '{')
+				return std::nullopt;
+		}
+
+		if (!line.starts_with("static "))
+			continue;
+
+		// The name is the last identifier before the parameters or initializer, eg. 'static int foo(' -> 'foo'
+		std::string_view decl = line;
+		decl = decl.substr(0, decl.find_first_of("(=;[{"));
+		while (!decl.empty() && std::isspace(static_cast<unsigned char>(decl.back())))
+			decl.remove_suffix(1);
+
+		std::size_t start = decl.size();
+		while (start > 0 && (std::isalnum(static_cast<unsigned char>(decl[start - 1])) || decl[start - 1] == '_'))
+			start -= 1;
+		if (start < decl.size())
+			names.emplace(decl.substr(start));
+	}
+	return names;
+}
+
+// Split files into 'count' batches that take about as long to compile, by adding the slowest remaining file to the
+// fastest batch. Files in a batch are sorted by path, so their order doesn't depend on the build times.
+export std::vector<std::vector<fs::path>> balance_batches(std::vector<std::pair<fs::path, std::int64_t>> files, std::size_t const count) {
+	std::ranges::sort(files, [](auto const& a, auto const& b) {
+		return a.second != b.second ? a.second > b.second : a.first < b.first;
+	});
+
+	std::vector<std::vector<fs::path>> batches(count);
+	std::vector<std::int64_t> totals(count, 0);
+	for (auto const& [file, cost] : files) {
+		std::size_t const fastest = std::ranges::min_element(totals) - totals.begin();
+		batches[fastest].push_back(file);
+		totals[fastest] += cost;
+	}
+
+	for (auto& batch : batches)
+		std::ranges::sort(batch);
+	return batches;
+}
@@ -1,38 +1,37 @@
 module;
-#include <fstream>
 #include <string>
 #include <vector>
 #include <optional>
 #include <ranges>
 #include <filesystem>
 export module wsl;
+import process;
 
 export std::vector<std::string> get_wsl_distributions() {
-	if (0 != std::system("wsl -l -q > wsl_distros.txt"))
+	process_result const result = run_process("wsl -l -q");
+	if (result.exit_code != 0)
 		return {};
 
 	std::vector<std::string> distributions;
-	if (auto file = std::ifstream("wsl_distros.txt"); file) {
-		std::string distro;
+	std::string distro;
 
-		// WSL outputs in UTF-16 LE, for some *goddamn* reason,
-		// so I'm forced to manually read it like a caveman. Unga bunga.
-		char c = 0;
-		while (file >> c) {
-			if (c == '\0') {
-				if (!distro.empty()) {
-					distributions.push_back(distro);
-					distro.clear();
-				}
+	// WSL outputs in UTF-16 LE, for some *goddamn* reason,
+	// so I'm forced to manually read it like a caveman. Unga bunga.
+	for (std::size_t i = 0; i + 1 < result.output.size(); i += 2) {
+		char const c = result.output[i];
+		if (c == '\0' || c == '\r' || c == '\n') {
+			if (!distro.empty()) {
+				distributions.push_back(distro);
+				distro.clear();
 			}
-			else {
-				distro += c;
-			}
-			file >> c; // skip null value
+		}
+		else {
+			distro += c;
 		}
 	}
+	if (!distro.empty())
+		distributions.push_back(distro);
 
-	std::remove("wsl_distros.txt");
 	return distributions;
 }
 
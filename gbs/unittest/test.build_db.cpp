@@ -0,0 +1,180 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest.h>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+import build_db;
+
+namespace fs = std::filesystem;
+using namespace std::chrono_literals;
+
+// An empty directory for the database and the files it tracks
+struct temp_dir {
+	fs::path path = fs::temp_directory_path() / "gbs_test_build_db";
+
+	temp_dir() {
+		fs::remove_all(path);
+		fs::create_directories(path);
+	}
+
+	~temp_dir() {
+		fs::remove_all(path);
+	}
+
+	// Write a file. Changes should also change the size, since files are only rehashed when their size or timestamp changes.
+	fs::path write(std::string_view const name, std::string_view const contents) const {
+		fs::path const file = path / name;
+		std::ofstream out(file, std::ios::binary);
+		out << contents;
+		return file;
+	}
+};
+
+TEST_CASE("objects and links survive a save and load") {
+	temp_dir dir;
+	fs::path const source = dir.write("a.cpp", "#include \"a.h\"\nint main() {}\n");
+	fs::path const header = dir.write("a.h", "#pragma once\n");
+	fs::path const obj = dir.write("a.obj", "object");
+	fs::path const exe = dir.write("a.exe", "executable");
+	std::vector<fs::path> const inputs{ obj };
+
+	{
+		build_db db(dir.path / "BUILDDB");
+		db.begin_object(obj, source, 42);
+		db.add_dependency(obj, header);
+		db.commit_object(obj, 1500ms, 1000);
+		db.commit_link(exe, 7, inputs, 300ms, 2000);
+		REQUIRE(db.save());
+	}
+
+	build_db db(dir.path / "BUILDDB");
+	CHECK(db.is_up_to_date(obj, source, 42));
+	CHECK_FALSE(db.is_up_to_date(obj, source, 43));
+	CHECK(db.previous_dependencies(obj) == std::vector<fs::path>{ header.lexically_normal() });
+	CHECK(db.expected_build_time(obj) == 1500ms);
+	CHECK(db.expected_build_time(exe) == 300ms);
+	CHECK(db.expected_compile_memory(obj) == 1000);
+	CHECK(db.expected_link_memory(exe) == 2000);
+	CHECK(db.is_link_up_to_date(exe, 7, inputs));
+	CHECK_FALSE(db.is_link_up_to_date(exe, 8, inputs));
+}
+
+TEST_CASE("objects are out of date when a source or header changes") {
+	temp_dir dir;
+	fs::path const source = dir.write("a.cpp", "int main() {}\n");
+	fs::path const header = dir.write("a.h", "#pragma once\n");
+	fs::path const obj = dir.write("a.obj", "object");
+
+	build_db db(dir.path / "BUILDDB");
+	db.begin_object(obj, source, 1);
+	db.add_dependency(obj, header);
+	db.commit_object(obj, 10ms, 0);
+	REQUIRE(db.is_up_to_date(obj, source, 1));
+
+	dir.write("a.h", "#pragma once\nint x;\n");
+	CHECK_FALSE(db.is_up_to_date(obj, source, 1));
+
+	// Objects that are missing are never up to date
+	db.begin_object(obj, source, 1);
+	db.commit_object(obj, 10ms, 0);
+	REQUIRE(db.is_up_to_date(obj, source, 1));
+	fs::remove(obj);
+	CHECK_FALSE(db.is_up_to_date(obj, source, 1));
+}
+
+TEST_CASE("importers are out of date when a header of an imported module changes") {
+	temp_dir dir;
+	fs::path const module_source = dir.write("m.cppm", "module;\n#include \"m.h\"\nexport module m;\n");
+	fs::path const module_header = dir.write("m.h", "#pragma once\n");
+	fs::path const module_obj = dir.write("m.obj", "module object");
+	fs::path const source = dir.write("u.cpp", "import m;\n");
+	fs::path const obj = dir.write("u.obj", "object");
+	std::vector<fs::path> const modules{ module_obj };
+
+	build_db db(dir.path / "BUILDDB");
+	db.begin_object(module_obj, module_source, 1);
+	db.add_dependency(module_obj, module_header);
+
+	// The module is still being built, so its headers come from its pending record
+	db.begin_object(obj, source, 2);
+	db.add_dependency(obj, module_source);
+	CHECK(db.add_module_dependencies(obj, modules) == std::vector<fs::path>{ module_header.lexically_normal() });
+	db.commit_object(module_obj, 10ms, 0);
+	db.commit_object(obj, 10ms, 0);
+	REQUIRE(db.is_up_to_date(obj, source, 2));
+
+	// The module's source is the same, but the header it includes is not
+	dir.write("m.h", "#pragma once\n#define CHANGED\n");
+	CHECK_FALSE(db.is_up_to_date(obj, source, 2));
+
+	// Built modules are taken from their records
+	db.begin_object(obj, source, 2);
+	CHECK(db.add_module_dependencies(obj, modules) == std::vector<fs::path>{ module_header.lexically_normal() });
+	db.commit_object(obj, 10ms, 0);
+	CHECK(db.is_up_to_date(obj, source, 2));
+}
+
+TEST_CASE("links are out of date when an input or the input list changes") {
+	temp_dir dir;
+	fs::path const a = dir.write("a.obj", "a");
+	fs::path const b = dir.write("b.obj", "b");
+	fs::path const exe = dir.write("app.exe", "executable");
+	std::vector<fs::path> const inputs{ b, a };
+
+	build_db db(dir.path / "BUILDDB");
+	db.commit_link(exe, 1, inputs, 10ms, 0);
+
+	// The order of the inputs doesn't matter
+	CHECK(db.is_link_up_to_date(exe, 1, std::vector<fs::path>{ a, b }));
+	CHECK_FALSE(db.is_link_up_to_date(exe, 1, std::vector<fs::path>{ a }));
+
+	// Content is compared, so an object restored with an old timestamp is still seen as changed
+	auto const old_time = fs::last_write_time(a);
+	dir.write("a.obj", "a restored");
+	fs::last_write_time(a, old_time - 1h);
+	CHECK_FALSE(db.is_link_up_to_date(exe, 1, inputs));
+}
+
+TEST_CASE("command hashes include the response files") {
+	temp_dir dir;
+	fs::path const rsp = dir.write("OBJLIST", "a.obj");
+	std::string const cmd = "link @" + rsp.generic_string() + " -o app";
+	CHECK(get_response_files(cmd) == std::vector<fs::path>{ rsp.generic_string() });
+
+	build_db db(dir.path / "BUILDDB");
+	auto const before = db.hash_command(cmd);
+	CHECK(db.hash_command(cmd) == before);
+
+	dir.write("OBJLIST", "a.obj b.obj");
+	CHECK(db.hash_command(cmd) != before);
+}
+
+TEST_CASE("broken databases are discarded") {
+	temp_dir dir;
+	fs::path const source = dir.write("a.cpp", "int main() {}\n");
+	fs::path const obj = dir.write("a.obj", "object");
+	{
+		build_db db(dir.path / "BUILDDB");
+		db.begin_object(obj, source, 1);
+		db.commit_object(obj, 1500ms, 0);
+		REQUIRE(db.save());
+	}
+
+	// Cut off in the middle of a line
+	std::ifstream in(dir.path / "BUILDDB", std::ios::binary);
+	std::string const text{ std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>() };
+	in.close();
+	dir.write("BUILDDB", text.substr(0, text.rfind('\t')));
+
+	build_db db(dir.path / "BUILDDB");
+	CHECK_FALSE(db.is_up_to_date(obj, source, 1));
+	CHECK(db.expected_build_time(obj) == 1000ms);
+
+	// Databases from another version are ignored
+	dir.write("BUILDDB", "gbs.db 1\n");
+	CHECK_FALSE(build_db(dir.path / "BUILDDB").is_up_to_date(obj, source, 1));
+}
@@ -0,0 +1,72 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest.h>
+#include <string>
+#include <vector>
+import build_options;
+
+TEST_CASE("parse_build_options gives the defaults for no options") {
+	auto const options = parse_build_options("");
+	REQUIRE(options);
+	CHECK_FALSE(options->keep_going);
+	CHECK(options->jobs == 0);
+	CHECK_FALSE(options->limit_memory);
+	CHECK_FALSE(options->cache);
+	CHECK(options->cache_size == 5ull << 30);
+	CHECK(options->unity_batch == 0);
+}
+
+TEST_CASE("parse_build_options reads a list of options") {
+	auto const options = parse_build_options("keep_going,jobs=8,,trace,two_phase,scan=compiler,link_jobs=2,unity=4,worker=a:1,worker=b:2");
+	REQUIRE(options);
+	CHECK(options->keep_going);
+	CHECK(options->jobs == 8);
+	CHECK(options->trace);
+	CHECK(options->two_phase);
+	CHECK(options->compiler_scan);
+	CHECK(options->link_jobs == 2);
+	CHECK(options->unity_batch == 4);
+	CHECK(options->workers == std::vector<std::string>{ "a:1", "b:2" });
+}
+
+TEST_CASE("later options override earlier ones") {
+	auto const options = parse_build_options("keep_going,fail_fast,scan=compiler,scan=builtin,unity,jobs=2,jobs=3");
+	REQUIRE(options);
+	CHECK_FALSE(options->keep_going);
+	CHECK_FALSE(options->compiler_scan);
+	CHECK(options->unity_batch == 8);
+	CHECK(options->jobs == 3);
+}
+
+TEST_CASE("parse_build_options reads sizes with suffixes") {
+	auto const options = parse_build_options("mem=512M,cache_size=2g");
+	REQUIRE(options);
+	CHECK(options->limit_memory);
+	CHECK(options->memory_budget == 512ull << 20);
+	CHECK(options->cache_size == 2ull << 30);
+
+	CHECK(parse_build_options("mem=18446744073709551615")->memory_budget == 18446744073709551615ull);
+	CHECK(parse_build_options("mem=16k")->memory_budget == 16ull << 10);
+	CHECK(parse_build_options("mem")->limit_memory);
+}
+
+TEST_CASE("parse_build_options sets the cache from a url") {
+	auto const options = parse_build_options("cache=http://cache:8080");
+	REQUIRE(options);
+	CHECK(options->cache);
+	CHECK(options->cache_url == "http://cache:8080");
+}
+
+TEST_CASE("parse_build_options rejects bad options") {
+	CHECK_FALSE(parse_build_options("bogus"));
+	CHECK_FALSE(parse_build_options("jobs=0"));
+	CHECK_FALSE(parse_build_options("jobs=-1"));
+	CHECK_FALSE(parse_build_options("jobs=4x"));
+	CHECK_FALSE(parse_build_options("unity=0"));
+	CHECK_FALSE(parse_build_options("mem=12T"));
+	CHECK_FALSE(parse_build_options("mem=M"));
+
+	// Sizes that don't fit in 64 bits
+	CHECK_FALSE(parse_build_options("mem=18446744073709551616"));
+	CHECK_FALSE(parse_build_options("cache_size=17179869184G"));
+	CHECK_FALSE(parse_build_options("cache_size=18014398509481984K"));
+}
@@ -0,0 +1,112 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest.h>
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+import compiler;
+import compiler_cache;
+import enumerate_compilers_gcc;
+import env;
+
+namespace fs = std::filesystem;
+
+// A home directory with an installed compiler, and an environment that points to it
+struct fake_install {
+	fs::path home = fs::temp_directory_path() / "gbs_test_compiler_cache";
+	std::string home_var = "HOME=" + home.string();
+	char const* envp[3]{ home_var.c_str(), "PATH=", nullptr };
+	environment env{ envp };
+	compiler comp;
+
+	fake_install() {
+		fs::remove_all(home);
+		fs::create_directories(home / "toolchain" / "bin");
+		write_executable("g++");
+
+		init_gcc_commands(comp);
+		comp.major = 14;
+		comp.minor = 2;
+		comp.patch = 1;
+		comp.name_and_version = "gcc 14.2.1";
+		comp.dir = home / "toolchain" / "bin";
+		comp.executable = comp.dir / "g++";
+		comp.linker = comp.dir / "g++";
+		comp.slib = comp.dir / "ar";
+		comp.dlib = comp.dir / "g++";
+		comp.std_module = home / "toolchain" / "include" / "bits" / "std.cc";
+	}
+
+	~fake_install() {
+		fs::remove_all(home);
+	}
+
+	void write_executable(std::string_view const contents) const {
+		std::ofstream out(home / "toolchain" / "bin" / "g++", std::ios::binary);
+		out << contents;
+	}
+};
+
+TEST_CASE("compilers saved to the cache are loaded back") {
+	fake_install install;
+	std::array<std::string_view, 1> const families{ "gcc" };
+	save_compiler_cache(install.env, families, { &install.comp, 1 });
+
+	auto const loaded = load_compiler_cache(install.env, "gcc");
+	REQUIRE(loaded);
+	REQUIRE(loaded->size() == 1);
+
+	compiler const& comp = loaded->front();
+	CHECK(comp.name == "gcc");
+	CHECK(comp.major == 14);
+	CHECK(comp.minor == 2);
+	CHECK(comp.patch == 1);
+	CHECK(comp.name_and_version == "gcc 14.2.1");
+	CHECK(comp.dir == install.comp.dir);
+	CHECK(comp.executable == install.comp.executable);
+	CHECK(comp.linker == install.comp.linker);
+	CHECK(comp.slib == install.comp.slib);
+	CHECK(comp.dlib == install.comp.dlib);
+	CHECK(comp.std_module == install.comp.std_module);
+	CHECK_FALSE(comp.wsl);
+
+	// The command templates are restored from the family
+	CHECK(comp.link_command == install.comp.link_command);
+}
+
+TEST_CASE("families are only cached once they have been searched for") {
+	fake_install install;
+	std::array<std::string_view, 1> const gcc{ "gcc" };
+	save_compiler_cache(install.env, gcc, { &install.comp, 1 });
+	CHECK_FALSE(load_compiler_cache(install.env, "clang"));
+
+	// A search that found nothing is remembered, and the compilers of other families are kept
+	std::array<std::string_view, 1> const clang{ "clang" };
+	save_compiler_cache(install.env, clang, {});
+	auto const clangs = load_compiler_cache(install.env, "clang");
+	REQUIRE(clangs);
+	CHECK(clangs->empty());
+	REQUIRE(load_compiler_cache(install.env, "gcc"));
+	CHECK(load_compiler_cache(install.env, "gcc")->size() == 1);
+}
+
+TEST_CASE("the cache is out of date when a compiler changes") {
+	fake_install install;
+	std::array<std::string_view, 1> const families{ "gcc" };
+	save_compiler_cache(install.env, families, { &install.comp, 1 });
+	REQUIRE(load_compiler_cache(install.env, "gcc"));
+
+	install.write_executable("g++ 14.2.2");
+	CHECK_FALSE(load_compiler_cache(install.env, "gcc"));
+}
+
+TEST_CASE("the cache is out of date when PATH changes") {
+	fake_install install;
+	std::array<std::string_view, 1> const families{ "gcc" };
+	save_compiler_cache(install.env, families, { &install.comp, 1 });
+
+	char const* envp[]{ install.home_var.c_str(), "PATH=/opt/other/bin", nullptr };
+	environment const other{ envp };
+	CHECK_FALSE(load_compiler_cache(other, "gcc"));
+}
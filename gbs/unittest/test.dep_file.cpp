@@ -0,0 +1,83 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest.h>
+#include <filesystem>
+#include <fstream>
+#include <string_view>
+#include <vector>
+import dep_file;
+import json;
+
+namespace fs = std::filesystem;
+
+// Write a dependency file to the temp directory and read it back
+static std::vector<fs::path> read_deps(std::string_view const text) {
+	fs::path const path = fs::temp_directory_path() / "gbs_test_dep_file.d";
+	{
+		std::ofstream out(path, std::ios::binary);
+		out << text;
+	}
+	auto deps = read_dependency_file(path);
+	fs::remove(path);
+	return deps;
+}
+
+TEST_CASE("make depfiles drop the targets and keep the prerequisites") {
+	auto const deps = read_deps("out/a.obj: src/a.cpp \\\n  inc/a.h inc/b.h\n");
+	CHECK(deps == std::vector<fs::path>{ "src/a.cpp", "inc/a.h", "inc/b.h" });
+}
+
+TEST_CASE("make depfiles handle escapes, crlf continuations and order-only prerequisites") {
+	auto const deps = read_deps("a.obj: my\\ dir/a.cpp \\\r\n  cost$$.h | order.h\r\n");
+	CHECK(deps == std::vector<fs::path>{ "my dir/a.cpp", "cost$.h", "order.h" });
+}
+
+TEST_CASE("make depfiles keep drive letters") {
+	auto const deps = read_deps("C:/out/a.obj: C:/src/a.cpp C:/inc/a.h\n");
+	CHECK(deps == std::vector<fs::path>{ "C:/src/a.cpp", "C:/inc/a.h" });
+}
+
+TEST_CASE("msvc json depfiles list the includes") {
+	auto const deps = read_deps(R"(
+		{
+			"Version": "1.2",
+			"Data": {
+				"Source": "c:\\src\\a.cpp",
+				"Includes": [ "c:\\inc\\a.h", "c:\\inc\\b \"quoted\".h" ],
+				"ImportedModules": [],
+				"ImportedHeaderUnits": []
+			}
+		})");
+	CHECK(deps == std::vector<fs::path>{ "c:\\inc\\a.h", "c:\\inc\\b \"quoted\".h" });
+}
+
+TEST_CASE("broken or missing depfiles give no dependencies") {
+	CHECK(read_deps(R"({ "Data": { "Includes": [ "a.h", )").empty());
+	CHECK(read_deps("").empty());
+	CHECK(read_dependency_file(fs::temp_directory_path() / "gbs_test_missing.d").empty());
+}
+
+TEST_CASE("parse_json reads nested documents") {
+	auto const doc = parse_json(R"({ "a": [1, true, null, "x\u0041\n"], "b": { "c": -2.5e1 } })");
+	REQUIRE(doc);
+	REQUIRE(doc->find("a"));
+	REQUIRE(doc->find("a")->is_array());
+
+	auto const& a = doc->find("a")->values;
+	REQUIRE(a.size() == 4);
+	CHECK(a[0].number == 1.0);
+	CHECK(a[1].boolean);
+	CHECK(a[2].type == json_value::kind::null);
+	CHECK(a[3].string == "xA\n");
+
+	REQUIRE(doc->find("b"));
+	REQUIRE(doc->find("b")->find("c"));
+	CHECK(doc->find("b")->find("c")->number == -25.0);
+	CHECK(doc->find("missing") == nullptr);
+
+	auto const quoted = parse_json(json_quote("a\"b\\c\n\x01"));
+	REQUIRE(quoted);
+	CHECK(quoted->string == "a\"b\\c\n\x01");
+
+	CHECK_FALSE(parse_json(R"({ "a": 1 } trailing)"));
+	CHECK_FALSE(parse_json(R"([1, 2)"));
+}
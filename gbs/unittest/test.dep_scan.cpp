@@ -0,0 +1,136 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest.h>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+import dep_scan;
+
+namespace fs = std::filesystem;
+using names = std::set<std::string>;
+
+// Write a source to the temp directory and scan it
+static source_dependency scan(std::string_view const text) {
+	fs::path const path = fs::temp_directory_path() / "gbs_test_dep_scan.cppm";
+	{
+		std::ofstream out(path, std::ios::binary);
+		out << text;
+	}
+	auto deps = extract_module_dependencies(path);
+	fs::remove(path);
+	return deps;
+}
+
+TEST_CASE("module interfaces export their name and import others") {
+	auto const deps = scan("module;\n#include <vector>\nexport module foo.bar;\nimport baz;\nexport import qux;\nimport <string>;\nimport \"local.h\";\n");
+	CHECK(deps.export_name == "foo.bar");
+	CHECK(deps.import_names == names{ "baz", "qux", "<string>", "\"local.h\"" });
+}
+
+TEST_CASE("implementation units import their interface") {
+	auto const deps = scan("module foo;\nimport bar;\n");
+	CHECK_FALSE(deps.is_export());
+	CHECK(deps.import_names == names{ "foo", "bar" });
+}
+
+TEST_CASE("partitions are named after their module") {
+	auto const part = scan("export module foo:part;\nimport :other;\n");
+	CHECK(part.export_name == "foo:part");
+	CHECK(part.import_names == names{ "foo:other" });
+
+	// Implementation partitions are imported by name too
+	auto const impl = scan("module foo:impl;\nimport :part;\n");
+	CHECK(impl.export_name == "foo:impl");
+	CHECK(impl.import_names == names{ "foo:part" });
+}
+
+TEST_CASE("imports in comments are ignored") {
+	auto const deps = scan(
+		"// import line;\n"
+		"/* import block;\n"
+		"   import block2; */\n"
+		"// spliced \\\n"
+		"import spliced;\n"
+		"/* before */ import real;\n");
+	CHECK(deps.import_names == names{ "real" });
+}
+
+TEST_CASE("imports in strings are ignored") {
+	auto const deps = scan(
+		"char const* a = R\"x(\n"
+		"import raw; )\"\n"
+		")x\";\n"
+		"char const* b = \"\\\"\";\n"
+		"int c = 1'000;\n"
+		"char d = '\"';\n"
+		"import real;\n");
+	CHECK(deps.import_names == names{ "real" });
+}
+
+TEST_CASE("the scan stops at the end of the module preamble") {
+	auto const deps = scan("export module foo;\nimport a;\n\nexport int f();\nimport b;\n");
+	CHECK(deps.import_names == names{ "a" });
+
+	// Files that are not modules can import anywhere
+	auto const plain = scan("int f();\nimport a;\nint g();\nimport b;\n");
+	CHECK_FALSE(plain.is_export());
+	CHECK(plain.import_names == names{ "a", "b" });
+}
+
+TEST_CASE("a byte order mark and crlf line endings are handled") {
+	auto const deps = scan("\xEF\xBB\xBFmodule;\r\n#include <vector>\r\nexport module foo;\r\nimport bar;\r\n");
+	CHECK(deps.export_name == "foo");
+	CHECK(deps.import_names == names{ "bar" });
+}
+
+TEST_CASE("extract_includes finds the headers as written") {
+	fs::path const path = fs::temp_directory_path() / "gbs_test_dep_scan.cpp";
+	{
+		std::ofstream out(path, std::ios::binary);
+		out << "#include <vector>\n  #  include \"a/b.h\"\n#define X\n#include NOT_FOUND\nint x;\n";
+	}
+	auto const includes = extract_includes(path);
+	fs::remove(path);
+	CHECK(includes == std::vector<std::string>{ "<vector>", "\"a/b.h\"" });
+}
+
+TEST_CASE("parse_p1689 reads the first rule") {
+	std::string_view const text = R"(warning: something
+		{
+			"version": 1,
+			"revision": 0,
+			"rules": [ {
+				"primary-output": "foo.obj",
+				"provides": [ { "logical-name": "foo", "is-interface": true } ],
+				"requires": [
+					{ "logical-name": "bar" },
+					{ "logical-name": "vector", "lookup-method": "include-angle" },
+					{ "logical-name": "local.h", "lookup-method": "include-quote" }
+				]
+			} ]
+		})";
+	auto const deps = parse_p1689("foo.cppm", text);
+	REQUIRE(deps);
+	CHECK(deps->path == "foo.cppm");
+	CHECK(deps->export_name == "foo");
+	CHECK(deps->import_names == names{ "bar", "<vector>", "\"local.h\"" });
+}
+
+TEST_CASE("parse_p1689 names implementation partitions but not implementation units") {
+	auto const partition = parse_p1689("a.cpp", R"({ "rules": [ { "provides": [ { "logical-name": "foo:impl", "is-interface": false } ] } ] })");
+	REQUIRE(partition);
+	CHECK(partition->export_name == "foo:impl");
+
+	auto const unit = parse_p1689("b.cpp", R"({ "rules": [ { "provides": [ { "logical-name": "foo", "is-interface": false } ] } ] })");
+	REQUIRE(unit);
+	CHECK_FALSE(unit->is_export());
+}
+
+TEST_CASE("parse_p1689 rejects broken output") {
+	CHECK_FALSE(parse_p1689("a.cpp", ""));
+	CHECK_FALSE(parse_p1689("a.cpp", "error: no such file"));
+	CHECK_FALSE(parse_p1689("a.cpp", R"({ "rules": [] })"));
+	CHECK_FALSE(parse_p1689("a.cpp", R"({ "rules": [ { )"));
+}
@@ -0,0 +1,37 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest.h>
+#include <string>
+import hash;
+
+TEST_CASE("hash_bytes matches the XXH64 reference vectors") {
+	CHECK(hash_bytes("") == 0xef46db3751d8e999ull);
+	CHECK(hash_bytes("a") == 0xd24ec4f1a98c6e5bull);
+	CHECK(hash_bytes("abc") == 0x44bc2cf5ad770999ull);
+	CHECK(hash_bytes("abc", 1) == 0xbea9ca8199328908ull);
+
+	// Inputs of 32 bytes or more take the striped path
+	CHECK(hash_bytes("The quick brown fox jumps over the lazy dog") == 0x0b242d361fda71bcull);
+	CHECK(hash_bytes("0123456789abcdef0123456789abcdef0123456789") == 0xa76190c3acf08a1cull);
+}
+
+TEST_CASE("hash strings round trip") {
+	CHECK(hash_to_string(0x0b242d361fda71bcull) == "0b242d361fda71bc");
+	CHECK(hash_from_string("0b242d361fda71bc") == 0x0b242d361fda71bcull);
+	CHECK(hash_from_string("0B242D361FDA71BC") == 0x0b242d361fda71bcull);
+	CHECK(hash_from_string(hash_to_string(0)) == 0ull);
+
+	CHECK_FALSE(hash_from_string(""));
+	CHECK_FALSE(hash_from_string("0123456789abcdef0"));
+	CHECK_FALSE(hash_from_string("xyz"));
+}
+
+TEST_CASE("sha256_hex matches the FIPS 180-2 vectors") {
+	CHECK(sha256_hex("") == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+	CHECK(sha256_hex("abc") == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+
+	// Padding spills into a second block
+	CHECK(sha256_hex("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq") == "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+
+	// Several full blocks
+	CHECK(sha256_hex(std::string(1000, 'a')) == "41edece42d63e8d9bf515a9ba6932e1c20cbc9f5a5d134645adb5db1b9737ea3");
+}
@@ -0,0 +1,31 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest.h>
+#include <string>
+#include <vector>
+import process;
+
+using args = std::vector<std::string>;
+
+TEST_CASE("split_command_line splits on whitespace") {
+	CHECK(split_command_line("clang++ -c  a.cpp\t-o a.obj\r\n") == args{ "clang++", "-c", "a.cpp", "-o", "a.obj" });
+	CHECK(split_command_line("").empty());
+	CHECK(split_command_line(" \t\n").empty());
+}
+
+TEST_CASE("split_command_line groups quoted text") {
+	CHECK(split_command_line(R"("C:/Program Files/cl.exe" /c "a b.cpp")") == args{ "C:/Program Files/cl.exe", "/c", "a b.cpp" });
+
+	// Quotes can start in the middle of an argument, and empty quotes are an empty argument
+	CHECK(split_command_line(R"(-I"my dir"/inc "" x)") == args{ "-Imy dir/inc", "", "x" });
+}
+
+TEST_CASE("split_command_line unescapes backslashes inside quotes") {
+	CHECK(split_command_line(R"("say \"hi\"" "C:\\dir\\")") == args{ R"(say "hi")", R"(C:\dir\)" });
+
+	// Outside quotes a backslash is just a character, so windows paths are kept as they are
+	CHECK(split_command_line(R"(C:\dir\a.cpp)") == args{ R"(C:\dir\a.cpp)" });
+}
+
+TEST_CASE("split_command_line keeps an unterminated quote to the end") {
+	CHECK(split_command_line(R"(a "b c)") == args{ "a", "b c" });
+}
@@ -0,0 +1,84 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest.h>
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+import unity;
+
+namespace fs = std::filesystem;
+using names = std::set<std::string>;
+
+// Write a source to the temp directory and find its static names
+static std::optional<names> statics(std::string_view const text) {
+	fs::path const path = fs::temp_directory_path() / "gbs_test_unity.cpp";
+	{
+		std::ofstream out(path, std::ios::binary);
+		out << text;
+	}
+	auto result = find_static_names(path);
+	fs::remove(path);
+	return result;
+}
+
+TEST_CASE("find_static_names finds file scope statics") {
+	auto const found = statics(
+		"static int counter = 0;\n"
+		"static constexpr char const* name{ \"x\" };\n"
+		"static std::vector<int> table[4];\n"
+		"static bool helper(int x) {\n"
+		"	static int local = 0;\n"
+		"	return x == local;\n"
+		"}\n"
+		"struct s {\n"
+		"	static int member;\n"
+		"};\n"
+		"int visible();\n");
+	REQUIRE(found);
+	CHECK(*found == names{ "counter", "name", "table", "helper" });
+}
+
+TEST_CASE("find_static_names gives up on anonymous namespaces") {
+	CHECK_FALSE(statics("namespace {\nint hidden;\n}\n"));
+	CHECK_FALSE(statics("namespace outer {\n\tnamespace{\n\tint hidden;\n\t}\n}\n"));
+	CHECK(statics("namespace named {\nstatic int x;\n}\n") == names{ "x" });
+}
+
+TEST_CASE("balance_batches spreads the cost evenly") {
+	std::vector<std::pair<fs::path, std::int64_t>> files{
+		{ "a.cpp", 10 }, { "b.cpp", 7 }, { "c.cpp", 5 }, { "d.cpp", 4 }, { "e.cpp", 3 }, { "f.cpp", 1 },
+	};
+	auto const batches = balance_batches(files, 2);
+	REQUIRE(batches.size() == 2);
+
+	// The slowest remaining file goes to the fastest batch, which gives 10 + 4 + 1 and 7 + 5 + 3
+	CHECK(batches[0] == std::vector<fs::path>{ "a.cpp", "d.cpp", "f.cpp" });
+	CHECK(batches[1] == std::vector<fs::path>{ "b.cpp", "c.cpp", "e.cpp" });
+}
+
+TEST_CASE("balance_batches doesn't depend on the order of the files") {
+	std::vector<std::pair<fs::path, std::int64_t>> files{ { "c.cpp", 1 }, { "a.cpp", 1 }, { "b.cpp", 1 }, { "d.cpp", 1 } };
+	auto const first = balance_batches(files, 3);
+	std::ranges::reverse(files);
+	CHECK(balance_batches(files, 3) == first);
+
+	// Every file ends up in exactly one batch
+	std::size_t total = 0;
+	for (auto const& batch : first)
+		total += batch.size();
+	CHECK(total == files.size());
+}
+
+TEST_CASE("balance_batches leaves extra batches empty") {
+	auto const batches = balance_batches({ { "a.cpp", 5 } }, 3);
+	REQUIRE(batches.size() == 3);
+	CHECK(batches[0] == std::vector<fs::path>{ "a.cpp" });
+	CHECK(batches[1].empty());
+	CHECK(batches[2].empty());
+}